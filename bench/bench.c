@@ -0,0 +1,932 @@
+/**
+ * @author Marius Orcsik <marius@habarnam.ro>
+ *
+ * End to end benchmark for mpris-ctl.
+ * It starts a private session bus with a number of mock players, and measures the wall time,
+ * the calls received by the players, all the messages sent by mpris-ctl on the bus, and the
+ * peak RSS of mpris-ctl for the common commands.
+ * Every scenario adds one misbehaving player to the regular ones: a slow one, one which never
+ * replies, and one with huge metadata. The results are written as JSON.
+ * With --check, it runs instead the checks of the behaviour which needs the players to change,
+ * or a daemon: the batches of --stdin, the JSON and escaped output, the quarantine, and the
+ * daemon with its snapshot, and the fallback to the bus when either of them can't be used.
+ */
+
+#define _DEFAULT_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <limits.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <dbus/dbus.h>
+
+#define BENCH_DEFAULT_PLAYERS  8
+#define BENCH_DEFAULT_RUNS     20
+#define BENCH_MAX_PLAYERS      200
+#define BENCH_MAX_ARGS         8
+#define BENCH_STARTUP_TIMEOUT  5000 //ms
+#define BENCH_CALL_TIMEOUT     1000 //ms
+
+#define MOCK_NAMESPACE         "org.mpris.MediaPlayer2."
+#define MOCK_PATH              "/org/mpris/MediaPlayer2"
+#define MOCK_STATS_INTERFACE   "org.mpris.mprisctl.Mock"
+#define MOCK_STATS_METHOD      "Stats"
+
+// the files of mpris-ctl in the runtime directory
+#define HEALTH_FILE_NAME       "mpris-ctl.health"
+#define DAEMON_SOCKET_NAME     "mpris-ctl.sock"
+#define SNAPSHOT_FILE_NAME     "mpris-ctl.state"
+// the identity of the mock used by the checks of the escaped output
+#define CHECK_IDENTITY         "Say \"hi\", it's <b>&"
+
+struct bench_command {
+    const char *name;
+    const char *args[BENCH_MAX_ARGS];
+    // the command changes the state of the players, and is run an even number of times
+    bool toggles;
+};
+
+const struct bench_command bench_commands[] = {
+    { "pp", { "--player", "active", "--player", "inactive", "pp" }, true },
+    { "info %full", { "info", "%full" }, false },
+    { "list", { "list" }, false },
+    { "volume +5", { "volume", "+5" }, false },
+    { "seek", { "seek", "1s" }, false },
+};
+
+struct bench_scenario {
+    const char *name;
+    // the arguments of the extra mock player, if any
+    const char *args[BENCH_MAX_ARGS];
+};
+
+const struct bench_scenario bench_scenarios[] = {
+    { "baseline", { NULL } },
+    { "slow", { "--delay", "50" } },
+    { "no-reply", { "--no-reply" } },
+    { "huge-metadata", { "--meta-size", "524288" } },
+};
+
+struct mock_player {
+    pid_t pid;
+    char name[64];
+};
+
+struct bench {
+    const char *bin;
+    const char *mock;
+    const char *dbus_daemon;
+    int player_count;
+    int runs;
+
+    pid_t bus_pid;
+    DBusConnection *conn;
+    // sees a copy of the calls sent on the bus, to count the ones of mpris-ctl
+    DBusConnection *monitor;
+    struct mock_player players[BENCH_MAX_PLAYERS + 1];
+    int mock_count;
+};
+
+struct bench_result {
+    double p50_ms;
+    double p95_ms;
+    double p99_ms;
+    double max_ms;
+    double messages_per_run;
+    double bus_messages_per_run;
+    long peak_rss_kb;
+    int failures;
+};
+
+int64_t now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000000L + ts.tv_nsec;
+}
+
+/**
+ * Starts a program with its standard output and error discarded.
+ * Returns the pid of the child, or -1 on error.
+ */
+pid_t spawn(const char *path, char *const argv[])
+{
+    const pid_t pid = fork();
+    if (pid != 0) { return pid; }
+
+    const int null_fd = open("/dev/null", O_RDWR);
+    if (null_fd >= 0) {
+        dup2(null_fd, STDOUT_FILENO);
+        dup2(null_fd, STDERR_FILENO);
+        close(null_fd);
+    }
+    execvp(path, argv);
+    _exit(127);
+}
+
+void stop_process(const pid_t pid)
+{
+    if (pid <= 0) { return; }
+    kill(pid, SIGTERM);
+    waitpid(pid, NULL, 0);
+}
+
+/**
+ * Starts the private session bus, and points the environment to it.
+ */
+bool start_bus(struct bench *b)
+{
+    int fds[2];
+    if (pipe(fds) < 0) { return false; }
+
+    char print_address[32];
+    snprintf(print_address, sizeof(print_address), "--print-address=%d", fds[1]);
+    char *argv[] = { (char*)b->dbus_daemon, "--session", "--nofork", print_address, NULL };
+
+    b->bus_pid = fork();
+    if (b->bus_pid == 0) {
+        close(fds[0]);
+        execvp(b->dbus_daemon, argv);
+        _exit(127);
+    }
+    close(fds[1]);
+    if (b->bus_pid < 0) {
+        close(fds[0]);
+        return false;
+    }
+
+    char address[1024] = {0};
+    size_t len = 0;
+    while (len < sizeof(address) - 1) {
+        const ssize_t loaded = read(fds[0], address + len, sizeof(address) - 1 - len);
+        if (loaded < 0 && errno == EINTR) { continue; }
+        if (loaded <= 0) { break; }
+        len += loaded;
+        if (NULL != memchr(address, '\n', len)) { break; }
+    }
+    close(fds[0]);
+
+    char *end = memchr(address, '\n', len);
+    if (NULL == end) {
+        fprintf(stderr, "bench: unable to start '%s'\n", b->dbus_daemon);
+        return false;
+    }
+    *end = 0;
+    setenv("DBUS_SESSION_BUS_ADDRESS", address, 1);
+    return true;
+}
+
+bool spawn_mock(struct bench *b, const char *name, const char *status, const char *const extra[])
+{
+    if (b->mock_count > BENCH_MAX_PLAYERS) { return false; }
+
+    char *argv[BENCH_MAX_ARGS + 8] = { (char*)b->mock, "--name", (char*)name, "--status", (char*)status };
+    int argc = 5;
+    for (int i = 0; NULL != extra && i < BENCH_MAX_ARGS && NULL != extra[i]; i++) {
+        argv[argc++] = (char*)extra[i];
+    }
+
+    struct mock_player *player = &b->players[b->mock_count];
+    snprintf(player->name, sizeof(player->name), MOCK_NAMESPACE "%s", name);
+    player->pid = spawn(b->mock, argv);
+    if (player->pid < 0) { return false; }
+    b->mock_count++;
+    return true;
+}
+
+void stop_mock(struct bench *b)
+{
+    if (b->mock_count == 0) { return; }
+    b->mock_count--;
+    stop_process(b->players[b->mock_count].pid);
+}
+
+/**
+ * Waits until all the mock players own their names on the bus.
+ */
+bool wait_for_players(struct bench *b)
+{
+    const int64_t deadline = now_ns() + (int64_t)BENCH_STARTUP_TIMEOUT * 1000000L;
+    while (now_ns() < deadline) {
+        int ready = 0;
+        for (int i = 0; i < b->mock_count; i++) {
+            if (dbus_bus_name_has_owner(b->conn, b->players[i].name, NULL)) {
+                ready++;
+            }
+        }
+        if (ready == b->mock_count) { return true; }
+
+        const struct timespec ts = { .tv_nsec = 10 * 1000000L };
+        nanosleep(&ts, NULL);
+    }
+    fprintf(stderr, "bench: the mock players didn't start in time\n");
+    return false;
+}
+
+/**
+ * Returns the total number of calls received by the mock players from first, to first + count.
+ */
+uint64_t count_mock_messages(struct bench *b, const int first, const int count)
+{
+    DBusPendingCall *pending[BENCH_MAX_PLAYERS + 1] = {0};
+    for (int i = first; i < first + count; i++) {
+        DBusMessage *msg = dbus_message_new_method_call(b->players[i].name, MOCK_PATH, MOCK_STATS_INTERFACE, MOCK_STATS_METHOD);
+        if (NULL == msg) { continue; }
+        dbus_connection_send_with_reply(b->conn, msg, &pending[i], BENCH_CALL_TIMEOUT);
+        dbus_message_unref(msg);
+    }
+    dbus_connection_flush(b->conn);
+
+    uint64_t total = 0;
+    for (int i = first; i < first + count; i++) {
+        if (NULL == pending[i]) { continue; }
+        dbus_pending_call_block(pending[i]);
+        DBusMessage *reply = dbus_pending_call_steal_reply(pending[i]);
+        dbus_pending_call_unref(pending[i]);
+        if (NULL == reply) { continue; }
+
+        dbus_uint64_t received = 0;
+        if (dbus_message_get_args(reply, NULL, DBUS_TYPE_UINT64, &received, DBUS_TYPE_INVALID)) {
+            total += received;
+        }
+        dbus_message_unref(reply);
+    }
+    return total;
+}
+
+/**
+ * Returns the total number of calls received by the mock players.
+ */
+uint64_t count_player_messages(struct bench *b)
+{
+    return count_mock_messages(b, 0, b->mock_count);
+}
+
+/**
+ * Turns a new connection into a monitor of the method calls, which are all the messages mpris-ctl
+ * sends: the calls to the players, and the ones to the bus itself, like ListNames, GetNameOwner and
+ * AddMatch. The disconnections are monitored too, so the count is known to be complete.
+ */
+bool start_monitor(struct bench *b)
+{
+    DBusError err;
+    dbus_error_init(&err);
+    b->monitor = dbus_bus_get_private(DBUS_BUS_SESSION, &err);
+    if (NULL == b->monitor) {
+        fprintf(stderr, "bench: connection error: %s\n", err.message);
+        dbus_error_free(&err);
+        return false;
+    }
+
+    const char *rules[] = {
+        "type='method_call'",
+        "type='signal',sender='" DBUS_SERVICE_DBUS "',member='NameOwnerChanged'",
+    };
+    const char **rules_ptr = rules;
+    DBusMessage *msg = dbus_message_new_method_call(DBUS_SERVICE_DBUS, DBUS_PATH_DBUS, DBUS_INTERFACE_MONITORING, "BecomeMonitor");
+    if (NULL == msg) { return false; }
+
+    const dbus_uint32_t flags = 0;
+    dbus_message_append_args(msg, DBUS_TYPE_ARRAY, DBUS_TYPE_STRING, &rules_ptr, 2, DBUS_TYPE_UINT32, &flags, DBUS_TYPE_INVALID);
+    DBusMessage *reply = dbus_connection_send_with_reply_and_block(b->monitor, msg, BENCH_CALL_TIMEOUT, &err);
+    dbus_message_unref(msg);
+    if (NULL == reply) {
+        fprintf(stderr, "bench: unable to monitor the bus: %s\n", err.message);
+        dbus_error_free(&err);
+        return false;
+    }
+    dbus_message_unref(reply);
+    return true;
+}
+
+/**
+ * Returns the number of calls sent by the mpris-ctl which just exited, as seen by the monitor.
+ * The mock players only send replies and signals, so the calls from any other connection than
+ * the one of the benchmark are the ones of mpris-ctl. They are read until the bus reports that
+ * it disconnected, as it handles the messages of a connection before its disconnection.
+ */
+uint64_t count_bus_messages(struct bench *b)
+{
+    const char *self = dbus_bus_get_unique_name(b->conn);
+    const int64_t deadline = now_ns() + (int64_t)BENCH_CALL_TIMEOUT * 1000000L;
+
+    uint64_t total = 0;
+    bool disconnected = false;
+    while (!disconnected && now_ns() < deadline) {
+        DBusMessage *msg = dbus_connection_pop_message(b->monitor);
+        if (NULL == msg) {
+            if (!dbus_connection_read_write(b->monitor, 10)) { break; }
+            continue;
+        }
+
+        const char *sender = dbus_message_get_sender(msg);
+        if (dbus_message_get_type(msg) == DBUS_MESSAGE_TYPE_METHOD_CALL) {
+            if (NULL != sender && strcmp(sender, self) != 0) {
+                total++;
+            }
+        } else {
+            const char *name = NULL;
+            const char *old_owner = NULL;
+            const char *new_owner = NULL;
+            if (dbus_message_get_args(msg, NULL, DBUS_TYPE_STRING, &name, DBUS_TYPE_STRING, &old_owner,
+                    DBUS_TYPE_STRING, &new_owner, DBUS_TYPE_INVALID)) {
+                // a unique name which is released, the mock players keep theirs
+                disconnected = name[0] == ':' && strlen(new_owner) == 0;
+            }
+        }
+        dbus_message_unref(msg);
+    }
+    return total;
+}
+
+/**
+ * Runs mpris-ctl once, returning its wall time in nanoseconds.
+ */
+int64_t run_command(struct bench *b, const struct bench_command *command, long *max_rss, int *status)
+{
+    char *argv[BENCH_MAX_ARGS + 2] = { (char*)b->bin };
+    for (int i = 0; i < BENCH_MAX_ARGS && NULL != command->args[i]; i++) {
+        argv[i + 1] = (char*)command->args[i];
+    }
+
+    const int64_t start = now_ns();
+    const pid_t pid = spawn(b->bin, argv);
+    if (pid < 0) {
+        *status = -1;
+        return 0;
+    }
+
+    int wstatus = 0;
+    struct rusage usage = {0};
+    while (wait4(pid, &wstatus, 0, &usage) < 0 && errno == EINTR) { }
+    const int64_t elapsed = now_ns() - start;
+
+    *max_rss = usage.ru_maxrss;
+    *status = WIFEXITED(wstatus) ? WEXITSTATUS(wstatus) : -1;
+    return elapsed;
+}
+
+int compare_times(const void *a, const void *b)
+{
+    const int64_t x = *(const int64_t*)a;
+    const int64_t y = *(const int64_t*)b;
+    return (x > y) - (x < y);
+}
+
+/**
+ * Returns the nearest rank percentile of the sorted times, in milliseconds.
+ */
+double percentile_ms(const int64_t *sorted, const int count, const int p)
+{
+    if (count == 0) { return 0; }
+
+    int rank = (p * count + 99) / 100;
+    if (rank < 1) { rank = 1; }
+    return sorted[rank - 1] / 1e6;
+}
+
+bool run_bench_command(struct bench *b, const struct bench_command *command, struct bench_result *result)
+{
+    int64_t *times = calloc(b->runs, sizeof(int64_t));
+    if (NULL == times) { return false; }
+
+    long rss = 0;
+    int status = 0;
+    // the first run warms up the caches of the bus and of the file system
+    run_command(b, command, &rss, &status);
+    count_bus_messages(b);
+
+    uint64_t bus_messages = 0;
+    const uint64_t messages_before = count_player_messages(b);
+    for (int i = 0; i < b->runs; i++) {
+        times[i] = run_command(b, command, &rss, &status);
+        bus_messages += count_bus_messages(b);
+        if (status != 0) {
+            result->failures++;
+        }
+        if (rss > result->peak_rss_kb) {
+            result->peak_rss_kb = rss;
+        }
+    }
+    const uint64_t messages_after = count_player_messages(b);
+
+    if (command->toggles && (b->runs + 1) % 2 != 0) {
+        // restore the initial state of the players for the next commands
+        run_command(b, command, &rss, &status);
+        count_bus_messages(b);
+    }
+
+    qsort(times, b->runs, sizeof(int64_t), compare_times);
+    result->p50_ms = percentile_ms(times, b->runs, 50);
+    result->p95_ms = percentile_ms(times, b->runs, 95);
+    result->p99_ms = percentile_ms(times, b->runs, 99);
+    result->max_ms = times[b->runs - 1] / 1e6;
+    result->messages_per_run = (double)(messages_after - messages_before) / b->runs;
+    result->bus_messages_per_run = (double)bus_messages / b->runs;
+
+    free(times);
+    return true;
+}
+
+void print_json_string(FILE *out, const char *str)
+{
+    fputc('"', out);
+    for (; *str; str++) {
+        if (*str == '"' || *str == '\\') {
+            fputc('\\', out);
+        }
+        fputc(*str, out);
+    }
+    fputc('"', out);
+}
+
+bool run_bench_scenario(struct bench *b, const struct bench_scenario *scenario, FILE *out)
+{
+    const bool extra = NULL != scenario->args[0];
+    if (extra && !spawn_mock(b, scenario->name, "Playing", scenario->args)) { return false; }
+    if (!wait_for_players(b)) { return false; }
+
+    fprintf(out, "    {\n      \"name\": ");
+    print_json_string(out, scenario->name);
+    fprintf(out, ",\n      \"players\": %d,\n      \"commands\": [\n", b->mock_count);
+
+    const int command_count = sizeof(bench_commands) / sizeof(bench_commands[0]);
+    for (int i = 0; i < command_count; i++) {
+        const struct bench_command *command = &bench_commands[i];
+        struct bench_result result = {0};
+        if (!run_bench_command(b, command, &result)) { return false; }
+
+        fprintf(out, "        {\"command\": ");
+        print_json_string(out, command->name);
+        fprintf(out, ", \"p50_ms\": %.3f, \"p95_ms\": %.3f, \"p99_ms\": %.3f, \"max_ms\": %.3f, "
+                "\"player_messages_per_run\": %.1f, \"bus_messages_per_run\": %.1f, \"peak_rss_kb\": %ld, \"failures\": %d}%s\n",
+                result.p50_ms, result.p95_ms, result.p99_ms, result.max_ms,
+                result.messages_per_run, result.bus_messages_per_run, result.peak_rss_kb, result.failures,
+                i + 1 < command_count ? "," : "");
+        fprintf(stderr, "bench: %-14s %-12s p50 %8.3fms p99 %8.3fms %6.1f msgs %6.1f bus msgs %6ldKB %d failures\n",
+                scenario->name, command->name, result.p50_ms, result.p99_ms,
+                result.messages_per_run, result.bus_messages_per_run, result.peak_rss_kb, result.failures);
+    }
+    fprintf(out, "      ]\n    }");
+
+    if (extra) {
+        stop_mock(b);
+        // its disconnection isn't taken for the one of the next mpris-ctl
+        count_bus_messages(b);
+    }
+    return true;
+}
+
+/**
+ * Runs mpris-ctl with the input written to its standard input in a single write, its errors are discarded.
+ * Returns the length of its output, or -1 on error. The exit status is set when it's not NULL.
+ */
+ssize_t run_with_input(struct bench *b, char *const argv[], const char *input, char *output, const size_t size, int *status)
+{
+    int in[2];
+    int out[2];
+    if (pipe(in) < 0) { return -1; }
+    if (pipe(out) < 0) {
+        close(in[0]);
+        close(in[1]);
+        return -1;
+    }
+
+    const pid_t pid = fork();
+    if (pid == 0) {
+        dup2(in[0], STDIN_FILENO);
+        dup2(out[1], STDOUT_FILENO);
+        const int null_fd = open("/dev/null", O_WRONLY);
+        if (null_fd >= 0) {
+            dup2(null_fd, STDERR_FILENO);
+            close(null_fd);
+        }
+        close(in[0]);
+        close(in[1]);
+        close(out[0]);
+        close(out[1]);
+        execvp(b->bin, argv);
+        _exit(127);
+    }
+    close(in[0]);
+    close(out[1]);
+
+    ssize_t len = -1;
+    if (pid > 0 && write(in[1], input, strlen(input)) == (ssize_t)strlen(input)) {
+        len = 0;
+    }
+    close(in[1]);
+    while (len >= 0 && (size_t)len < size - 1) {
+        const ssize_t loaded = read(out[0], output + len, size - 1 - len);
+        if (loaded < 0 && errno == EINTR) { continue; }
+        if (loaded <= 0) { break; }
+        len += loaded;
+    }
+    close(out[0]);
+    int wstatus = 0;
+    if (pid > 0) {
+        while (waitpid(pid, &wstatus, 0) < 0 && errno == EINTR) { }
+    }
+    if (NULL != status) {
+        *status = WIFEXITED(wstatus) ? WEXITSTATUS(wstatus) : -1;
+    }
+    if (len >= 0) {
+        output[len] = 0;
+    }
+    return len;
+}
+
+/**
+ * Returns true if the output is made of the fragments in order: it starts with the first one and ends
+ * with the last one, the text between the fragments is ignored. A single fragment is the whole output.
+ */
+bool match_fragments(const char *output, const char *const fragments[])
+{
+    const char *cur = output;
+    for (int i = 0; NULL != fragments[i]; i++) {
+        const size_t len = strlen(fragments[i]);
+        const char *found = NULL;
+        if (i == 0) {
+            found = strncmp(cur, fragments[i], len) == 0 ? cur : NULL;
+        } else if (NULL == fragments[i+1]) {
+            const size_t left = strlen(cur);
+            found = left >= len && strcmp(cur + left - len, fragments[i]) == 0 ? cur + left - len : NULL;
+        } else {
+            found = strstr(cur, fragments[i]);
+        }
+        if (NULL == found) { return false; }
+        cur = found + len;
+    }
+    return *cur == 0;
+}
+
+/**
+ * Runs mpris-ctl, and checks its exit status and that its output matches the fragments.
+ */
+bool check_command(struct bench *b, const char *check, char *const argv[], const char *input, const char *const expected[], const int expected_status)
+{
+    char output[8192];
+    int status = -1;
+    if (run_with_input(b, argv, input, output, sizeof(output), &status) < 0) {
+        fprintf(stderr, "bench: check %s failed, unable to run '%s'\n", check, b->bin);
+        return false;
+    }
+    if (status != expected_status || !match_fragments(output, expected)) {
+        fprintf(stderr, "bench: check %s failed with the status %d, the output was:\n%s\n", check, status, output);
+        return false;
+    }
+    fprintf(stderr, "bench: check %s passed\n", check);
+    return true;
+}
+
+/**
+ * Checks that the lines read together by --stdin see the changes of the previous ones: the relative
+ * volume changes add up, and the info which follows them prints the volume they set.
+ */
+bool check_stdin_batch(struct bench *b)
+{
+    char *argv[] = { (char*)b->bin, "--stdin", NULL };
+    const char *input =
+        "--player mock0 volume 50\n"
+        "--player mock0 volume +5\n"
+        "--player mock0 volume +5\n"
+        "--player mock0 volume +5\n"
+        "--player mock0 info %volume\n";
+    const char *const expected[] = { "\x1e" "0\n\x1e" "0\n\x1e" "0\n\x1e" "0\n65.00%\n\x1e" "0\n", NULL };
+    return check_command(b, "stdin-batch", argv, input, expected, EXIT_SUCCESS);
+}
+
+/**
+ * Checks the JSON output of all the players and of every player, and the values escaped for
+ * every language, with the identity of the "quoted" mock.
+ */
+bool check_output_modes(struct bench *b)
+{
+    char *json_argv[] = { (char*)b->bin, "--player", "mock0", "--player", "mock1", "--json", "info", NULL };
+    const char *const json[] = {
+        "[{\"player\":\"mock0\",", "\"PlaybackStatus\":\"Playing\"", "},{\"player\":\"mock1\",", "\"PlaybackStatus\":\"Paused\"", "}]\n", NULL
+    };
+    char *ndjson_argv[] = { (char*)b->bin, "--player", "quoted", "--ndjson", "info", NULL };
+    const char *const ndjson[] = { "{\"player\":\"quoted\",\"Identity\":\"Say \\\"hi\\\", it's <b>&\",", "}\n", NULL };
+    if (!check_command(b, "json", json_argv, "", json, EXIT_SUCCESS)) { return false; }
+    if (!check_command(b, "ndjson", ndjson_argv, "", ndjson, EXIT_SUCCESS)) { return false; }
+
+    const char *escapes[][2] = {
+        { "json", "[Say \\\"hi\\\", it's <b>&]\n" },
+        { "shell", "['Say \"hi\", it'\\''s <b>&']\n" },
+        { "xml", "[Say &quot;hi&quot;, it&apos;s &lt;b&gt;&amp;]\n" },
+        { "csv", "[\"Say \"\"hi\"\", it's <b>&\"]\n" },
+    };
+    for (size_t i = 0; i < sizeof(escapes) / sizeof(escapes[0]); i++) {
+        char check[32];
+        snprintf(check, sizeof(check), "escape-%s", escapes[i][0]);
+        char *argv[] = { (char*)b->bin, "--player", "quoted", "--escape", (char*)escapes[i][0], "info", "[%player_identity]", NULL };
+        const char *const expected[] = { escapes[i][1], NULL };
+        if (!check_command(b, check, argv, "", expected, EXIT_SUCCESS)) { return false; }
+    }
+    return true;
+}
+
+/**
+ * Returns the path of a file of mpris-ctl in the runtime directory.
+ */
+bool get_runtime_path(char *path, const size_t max_len, const char *name)
+{
+    const int len = snprintf(path, max_len, "%s/%s", getenv("XDG_RUNTIME_DIR"), name);
+    return len > 0 && (size_t)len < max_len;
+}
+
+/**
+ * Checks that a player which didn't answer in the previous invocations isn't called anymore,
+ * not even by the commands which call the players that aren't selected, unless it's named.
+ * The player which never replies is recorded as quarantined, it's the last mock started.
+ */
+bool check_quarantine(struct bench *b)
+{
+    char path[PATH_MAX];
+    if (!get_runtime_path(path, sizeof(path), HEALTH_FILE_NAME)) { return false; }
+    FILE *file = fopen(path, "w");
+    if (NULL == file) { return false; }
+    // the owner is unknown, as for the players recorded for the first time
+    fprintf(file, "%s - 0 2 \n", b->players[b->mock_count - 1].name);
+    fclose(file);
+
+    const int broken = b->mock_count - 1;
+    char *raise_argv[] = { (char*)b->bin, "raise", NULL };
+    char *named_argv[] = { (char*)b->bin, "--player", "broken", "raise", NULL };
+    const char *const empty[] = { "", NULL };
+
+    const uint64_t before = count_mock_messages(b, broken, 1);
+    if (!check_command(b, "quarantine-raise", raise_argv, "", empty, EXIT_SUCCESS)) { return false; }
+    if (count_mock_messages(b, broken, 1) != before) {
+        fprintf(stderr, "bench: check quarantine-raise failed, the quarantined player was called\n");
+        return false;
+    }
+    // the named player doesn't reply, so the command fails
+    if (!check_command(b, "quarantine-named", named_argv, "", empty, EXIT_FAILURE)) { return false; }
+    if (count_mock_messages(b, broken, 1) == before) {
+        fprintf(stderr, "bench: check quarantine-named failed, the named player wasn't called\n");
+        return false;
+    }
+    return true;
+}
+
+/**
+ * Waits until the file exists.
+ */
+bool wait_for_file(const char *path)
+{
+    const int64_t deadline = now_ns() + (int64_t)BENCH_STARTUP_TIMEOUT * 1000000L;
+    while (now_ns() < deadline) {
+        if (access(path, F_OK) == 0) { return true; }
+
+        const struct timespec ts = { .tv_nsec = 10 * 1000000L };
+        nanosleep(&ts, NULL);
+    }
+    fprintf(stderr, "bench: '%s' wasn't created in time\n", path);
+    return false;
+}
+
+/**
+ * Connects to the socket, or listens on it when listen is set. Returns -1 on error.
+ */
+int open_unix_socket(const char *path, const bool listening)
+{
+    struct sockaddr_un addr = {0};
+    addr.sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(addr.sun_path)) { return -1; }
+    memcpy(addr.sun_path, path, strlen(path) + 1);
+
+    const int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0) { return -1; }
+    const bool opened = listening ?
+        bind(fd, (struct sockaddr*)&addr, sizeof(addr)) == 0 && listen(fd, 4) == 0 :
+        connect(fd, (struct sockaddr*)&addr, sizeof(addr)) == 0;
+    if (!opened) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+/**
+ * Checks the daemon and its snapshot, and that the commands still work when they can't be used:
+ *  * a client which doesn't send its request doesn't keep the daemon from serving the next ones.
+ *  * the information is read from the snapshot, without the bus nor the daemon.
+ *  * the snapshot of a daemon which was killed isn't used anymore.
+ *  * an empty snapshot, as left by a daemon which couldn't set it up, is ignored.
+ *  * the commands are executed directly when the daemon doesn't answer.
+ */
+bool check_daemon(struct bench *b)
+{
+    char socket_path[PATH_MAX];
+    char hidden_path[PATH_MAX + 8];
+    char snapshot_path[PATH_MAX];
+    if (!get_runtime_path(socket_path, sizeof(socket_path), DAEMON_SOCKET_NAME)) { return false; }
+    if (!get_runtime_path(snapshot_path, sizeof(snapshot_path), SNAPSHOT_FILE_NAME)) { return false; }
+    snprintf(hidden_path, sizeof(hidden_path), "%s.hidden", socket_path);
+
+    char *daemon_argv[] = { (char*)b->bin, "daemon", NULL };
+    const pid_t daemon = spawn(b->bin, daemon_argv);
+    if (daemon < 0) { return false; }
+
+    char *pause_argv[] = { (char*)b->bin, "--player", "mock1", "pause", NULL };
+    char *status_argv[] = { (char*)b->bin, "--player", "mock1", "status", NULL };
+    const char *const empty[] = { "", NULL };
+    const char *const paused[] = { "Paused\n", NULL };
+    bool passed = false;
+    if (!wait_for_file(socket_path) || !wait_for_file(snapshot_path)) { goto _stop_daemon; }
+
+    const int silent = open_unix_socket(socket_path, false);
+    if (silent < 0) { goto _stop_daemon; }
+    const int64_t start = now_ns();
+    passed = check_command(b, "daemon-silent-client", pause_argv, "", empty, EXIT_SUCCESS);
+    close(silent);
+    // the client gives up on the daemon after 2s
+    if (passed && now_ns() - start > 1000 * 1000000L) {
+        fprintf(stderr, "bench: check daemon-silent-client failed, the command waited for the silent client\n");
+        passed = false;
+    }
+    if (!passed) { goto _stop_daemon; }
+
+    // the snapshot is the only way left to get the information
+    const char *address = getenv("DBUS_SESSION_BUS_ADDRESS");
+    char bus_address[1024];
+    snprintf(bus_address, sizeof(bus_address), "%s", address);
+    setenv("DBUS_SESSION_BUS_ADDRESS", "unix:path=/nonexistent", 1);
+    rename(socket_path, hidden_path);
+    passed = check_command(b, "snapshot", status_argv, "", paused, EXIT_SUCCESS);
+    if (passed) {
+        kill(daemon, SIGKILL);
+        waitpid(daemon, NULL, 0);
+        passed = check_command(b, "snapshot-stale", status_argv, "", empty, EXIT_FAILURE);
+    }
+    setenv("DBUS_SESSION_BUS_ADDRESS", bus_address, 1);
+    unlink(hidden_path);
+    if (!passed) { goto _stop_daemon; }
+
+    const int empty_fd = open(snapshot_path, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+    if (empty_fd < 0) { goto _stop_daemon; }
+    close(empty_fd);
+    passed = check_command(b, "snapshot-empty", status_argv, "", paused, EXIT_SUCCESS);
+    unlink(snapshot_path);
+    if (!passed) { goto _stop_daemon; }
+
+    const int stuck = open_unix_socket(socket_path, true);
+    if (stuck < 0) { goto _stop_daemon; }
+    passed = check_command(b, "daemon-fallback", status_argv, "", paused, EXIT_SUCCESS);
+    close(stuck);
+
+_stop_daemon:
+    stop_process(daemon);
+    unlink(socket_path);
+    unlink(snapshot_path);
+    return passed;
+}
+
+void print_usage(const char *name)
+{
+    fprintf(stderr, "usage: %s --bin MPRIS_CTL --mock MOCK_PLAYER [--players N] [--runs N] [--output FILE] [--dbus-daemon PATH] [--check]\n", name);
+}
+
+int main(int argc, char **argv)
+{
+    struct bench b = {
+        .dbus_daemon = "dbus-daemon",
+        .player_count = BENCH_DEFAULT_PLAYERS,
+        .runs = BENCH_DEFAULT_RUNS,
+    };
+    const char *output = NULL;
+    bool check = false;
+    FILE *out = stdout;
+    int status = EXIT_FAILURE;
+
+    static struct option long_options[] = {
+        {"bin", required_argument, NULL, 1},
+        {"mock", required_argument, NULL, 2},
+        {"players", required_argument, NULL, 3},
+        {"runs", required_argument, NULL, 4},
+        {"output", required_argument, NULL, 5},
+        {"dbus-daemon", required_argument, NULL, 6},
+        {"check", no_argument, NULL, 7},
+        {0},
+    };
+    while (true) {
+        const int char_arg = getopt_long(argc, argv, "", long_options, NULL);
+        if (char_arg == -1) { break; }
+        switch (char_arg) {
+            case 1: b.bin = optarg; break;
+            case 2: b.mock = optarg; break;
+            case 3: b.player_count = atoi(optarg); break;
+            case 4: b.runs = atoi(optarg); break;
+            case 5: output = optarg; break;
+            case 6: b.dbus_daemon = optarg; break;
+            case 7: check = true; break;
+            default:
+                print_usage(argv[0]);
+                return EXIT_FAILURE;
+        }
+    }
+    if (NULL == b.bin || NULL == b.mock || b.runs <= 0 || b.player_count < 1 || b.player_count > BENCH_MAX_PLAYERS) {
+        print_usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    // a private runtime directory, so the commands are not forwarded to a running daemon
+    char runtime_dir[] = "/tmp/mpris-ctl-bench.XXXXXX";
+    const char *runtime_files[] = { HEALTH_FILE_NAME, DAEMON_SOCKET_NAME, SNAPSHOT_FILE_NAME };
+    if (NULL == mkdtemp(runtime_dir)) {
+        perror("bench");
+        return EXIT_FAILURE;
+    }
+    setenv("XDG_RUNTIME_DIR", runtime_dir, 1);
+
+    if (!start_bus(&b)) { goto _free_dir; }
+
+    DBusError err;
+    dbus_error_init(&err);
+    b.conn = dbus_bus_get_private(DBUS_BUS_SESSION, &err);
+    if (NULL == b.conn) {
+        fprintf(stderr, "bench: connection error: %s\n", err.message);
+        dbus_error_free(&err);
+        goto _stop_bus;
+    }
+
+    for (int i = 0; i < b.player_count; i++) {
+        char name[32];
+        snprintf(name, sizeof(name), "mock%d", i);
+        // half of the players are active
+        if (!spawn_mock(&b, name, i % 2 == 0 ? "Playing" : "Paused", NULL)) { goto _stop_players; }
+    }
+
+    if (check) {
+        const char *const quoted[] = { "--identity", CHECK_IDENTITY, NULL };
+        const char *const broken[] = { "--no-reply", NULL };
+        if (!spawn_mock(&b, "quoted", "Paused", quoted) || !spawn_mock(&b, "broken", "Playing", broken)) { goto _stop_players; }
+        if (wait_for_players(&b) && check_stdin_batch(&b) && check_output_modes(&b) && check_quarantine(&b) && check_daemon(&b)) {
+            status = EXIT_SUCCESS;
+        }
+        goto _stop_players;
+    }
+    if (!start_monitor(&b)) { goto _stop_players; }
+
+    if (NULL != output) {
+        out = fopen(output, "w");
+        if (NULL == out) {
+            perror(output);
+            goto _stop_players;
+        }
+    }
+
+    fprintf(out, "{\n  \"binary\": ");
+    print_json_string(out, b.bin);
+    fprintf(out, ",\n  \"runs\": %d,\n  \"scenarios\": [\n", b.runs);
+    const int scenario_count = sizeof(bench_scenarios) / sizeof(bench_scenarios[0]);
+    status = EXIT_SUCCESS;
+    for (int i = 0; i < scenario_count; i++) {
+        if (!run_bench_scenario(&b, &bench_scenarios[i], out)) {
+            status = EXIT_FAILURE;
+            break;
+        }
+        fprintf(out, "%s\n", i + 1 < scenario_count ? "," : "");
+    }
+    fprintf(out, "  ]\n}\n");
+    if (out != stdout) {
+        fclose(out);
+    }
+
+_stop_players:
+    while (b.mock_count > 0) {
+        stop_mock(&b);
+    }
+    if (NULL != b.monitor) {
+        dbus_connection_close(b.monitor);
+        dbus_connection_unref(b.monitor);
+    }
+    dbus_connection_close(b.conn);
+    dbus_connection_unref(b.conn);
+_stop_bus:
+    stop_process(b.bus_pid);
+_free_dir:
+    for (size_t i = 0; i < sizeof(runtime_files) / sizeof(runtime_files[0]); i++) {
+        char path[sizeof(runtime_dir) + 32];
+        snprintf(path, sizeof(path), "%s/%s", runtime_dir, runtime_files[i]);
+        unlink(path);
+    }
+    rmdir(runtime_dir);
+    return status;
+}
@@ -0,0 +1,535 @@
+/**
+ * @author Marius Orcsik <marius@habarnam.ro>
+ *
+ * Micro benchmarks for the code paths which don't depend on the bus: replacing the format
+ * specifiers, compiling and rendering the info templates, decoding the properties and the
+ * metadata from prebuilt replies, formatting the time intervals, and escaping the values.
+ * For every case it reports the time and the allocations per operation, and the bytes
+ * read or written by one operation.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <getopt.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <inttypes.h>
+
+#include "../src/sstring.h"
+#include "../src/sescape.h"
+#include "../src/sarena.h"
+#include "../src/sstats.h"
+#include "../src/shealth.h"
+#include "../src/sdbus.h"
+#include "../src/sformat.h"
+
+#define MICROBENCH_MIN_TIME      200 //ms
+#define MICROBENCH_MAX_ITERATIONS (1 << 28)
+#define MICROBENCH_INPUT_LENGTH  4000
+
+#ifdef __GLIBC__
+// all the allocations are counted, including the ones made inside libdbus
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t count, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+
+#define MICROBENCH_COUNTS_ALLOCATIONS 1
+uint64_t allocations = 0;
+
+void *malloc(size_t size)
+{
+    allocations++;
+    return __libc_malloc(size);
+}
+
+void *calloc(size_t count, size_t size)
+{
+    allocations++;
+    return __libc_calloc(count, size);
+}
+
+void *realloc(void *ptr, size_t size)
+{
+    allocations++;
+    return __libc_realloc(ptr, size);
+}
+#else
+#define MICROBENCH_COUNTS_ALLOCATIONS 0
+uint64_t allocations = 0;
+#endif
+
+typedef void (*microbench_fn)(void *data);
+
+// keeps the compiler from dropping the results of the benchmarked code
+volatile size_t sink;
+
+const char *filter = NULL;
+
+int64_t now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000000L + ts.tv_nsec;
+}
+
+/**
+ * Runs the case for at least MICROBENCH_MIN_TIME, doubling the number of iterations, and prints the results.
+ */
+void run_microbench(const char *name, microbench_fn fn, void *data, const size_t bytes)
+{
+    if (NULL != filter && NULL == strstr(name, filter)) { return; }
+
+    fn(data);
+    uint64_t iterations = 1;
+    while (true) {
+        const uint64_t allocations_before = allocations;
+        const int64_t start = now_ns();
+        for (uint64_t i = 0; i < iterations; i++) {
+            fn(data);
+        }
+        const int64_t elapsed = now_ns() - start;
+        const uint64_t allocated = allocations - allocations_before;
+
+        if (elapsed >= MICROBENCH_MIN_TIME * 1000000L || iterations >= MICROBENCH_MAX_ITERATIONS) {
+            fprintf(stdout, "%-36s %12" PRIu64 " %12.1f %12zu", name, iterations, (double)elapsed / iterations, bytes);
+            if (MICROBENCH_COUNTS_ALLOCATIONS) {
+                fprintf(stdout, " %12.2f\n", (double)allocated / iterations);
+            } else {
+                fprintf(stdout, " %12s\n", "-");
+            }
+            return;
+        }
+        iterations *= 2;
+    }
+}
+
+struct replace_case {
+    char input[MAX_OUTPUT_LENGTH];
+    const char *search;
+    const char *replace;
+    char buffer[MAX_OUTPUT_LENGTH];
+};
+
+void bench_str_replace(void *data)
+{
+    struct replace_case *c = data;
+    memcpy(c->buffer, c->input, sizeof(c->buffer));
+    str_replace(c->buffer, c->search, c->replace);
+    sink += c->buffer[0];
+}
+
+void repeat_into(char *destination, const char *pattern, const size_t len)
+{
+    const size_t pattern_len = strlen(pattern);
+    size_t pos = 0;
+    while (pos + pattern_len <= len) {
+        memcpy(destination + pos, pattern, pattern_len);
+        pos += pattern_len;
+    }
+    destination[pos] = 0;
+}
+
+void bench_str_replace_cases(void)
+{
+    struct replace_case c = {0};
+
+    // a format made only of specifiers, each of them replaced
+    repeat_into(c.input, INFO_TRACK_NAME " ", MICROBENCH_INPUT_LENGTH);
+    c.search = INFO_TRACK_NAME;
+    c.replace = "Giant Steps";
+    run_microbench("str_replace/specifiers", bench_str_replace, &c, MICROBENCH_INPUT_LENGTH);
+
+    // a long string without any match
+    repeat_into(c.input, "x", MICROBENCH_INPUT_LENGTH);
+    c.search = INFO_FULL;
+    c.replace = "";
+    run_microbench("str_replace/4k-no-match", bench_str_replace, &c, MICROBENCH_INPUT_LENGTH);
+
+    // overlapping matches, every other position matches
+    repeat_into(c.input, "a", MICROBENCH_INPUT_LENGTH);
+    c.search = "aa";
+    c.replace = "b";
+    run_microbench("str_replace/overlapping", bench_str_replace, &c, MICROBENCH_INPUT_LENGTH);
+
+    // a specifier which is a prefix of another one
+    repeat_into(c.input, INFO_ALBUM_ARTIST INFO_ALBUM_NAME, MICROBENCH_INPUT_LENGTH);
+    c.search = "%album";
+    c.replace = "Album!";
+    run_microbench("str_replace/prefixes", bench_str_replace, &c, MICROBENCH_INPUT_LENGTH);
+}
+
+void append_variant(DBusMessageIter *iter, const int type, const void *value)
+{
+    const char signature[2] = { (char)type, 0 };
+    DBusMessageIter variant;
+    dbus_message_iter_open_container(iter, DBUS_TYPE_VARIANT, signature, &variant);
+    dbus_message_iter_append_basic(&variant, type, value);
+    dbus_message_iter_close_container(iter, &variant);
+}
+
+void append_entry(DBusMessageIter *dict, const char *key, const int type, const void *value)
+{
+    DBusMessageIter entry;
+    dbus_message_iter_open_container(dict, DBUS_TYPE_DICT_ENTRY, NULL, &entry);
+    dbus_message_iter_append_basic(&entry, DBUS_TYPE_STRING, &key);
+    append_variant(&entry, type, value);
+    dbus_message_iter_close_container(dict, &entry);
+}
+
+void append_string_array_entry(DBusMessageIter *dict, const char *key, const char *prefix, const int count)
+{
+    DBusMessageIter entry, variant, array;
+    dbus_message_iter_open_container(dict, DBUS_TYPE_DICT_ENTRY, NULL, &entry);
+    dbus_message_iter_append_basic(&entry, DBUS_TYPE_STRING, &key);
+    dbus_message_iter_open_container(&entry, DBUS_TYPE_VARIANT, "as", &variant);
+    dbus_message_iter_open_container(&variant, DBUS_TYPE_ARRAY, "s", &array);
+    for (int i = 0; i < count; i++) {
+        char value[64];
+        snprintf(value, sizeof(value), "%s %d", prefix, i + 1);
+        const char *str = value;
+        dbus_message_iter_append_basic(&array, DBUS_TYPE_STRING, &str);
+    }
+    dbus_message_iter_close_container(&variant, &array);
+    dbus_message_iter_close_container(&entry, &variant);
+    dbus_message_iter_close_container(dict, &entry);
+}
+
+/**
+ * Appends the metadata variant, the oversized one has long lists of artists, a long comment,
+ * and many keys which mpris-ctl doesn't use.
+ */
+void append_metadata(DBusMessageIter *iter, const bool oversized)
+{
+    const char *track_id = "/org/mpris/MediaPlayer2/Track/42";
+    const char *title = "Giant Steps";
+    const char *album = "Giant Steps (Remastered)";
+    const char *art_url = "file:///home/user/.cache/covers/giant-steps.jpg";
+    const char *url = "file:///home/user/Music/John%20Coltrane/Giant%20Steps/01.flac";
+    const int64_t length = 283 * 1000000L;
+    const int32_t track_number = 1;
+    const int32_t bitrate = 1411;
+
+    char *comment = NULL;
+    const size_t comment_len = oversized ? 64 * 1024 : 64;
+    comment = malloc(comment_len + 1);
+    repeat_into(comment, "lorem ipsum ", comment_len);
+    const char *comment_str = comment;
+
+    DBusMessageIter variant, dict;
+    dbus_message_iter_open_container(iter, DBUS_TYPE_VARIANT, "a{sv}", &variant);
+    dbus_message_iter_open_container(&variant, DBUS_TYPE_ARRAY, "{sv}", &dict);
+    append_entry(&dict, MPRIS_METADATA_TRACKID, DBUS_TYPE_OBJECT_PATH, &track_id);
+    append_entry(&dict, MPRIS_METADATA_LENGTH, DBUS_TYPE_INT64, &length);
+    append_entry(&dict, MPRIS_METADATA_ART_URL, DBUS_TYPE_STRING, &art_url);
+    append_entry(&dict, MPRIS_METADATA_TITLE, DBUS_TYPE_STRING, &title);
+    append_entry(&dict, MPRIS_METADATA_ALBUM, DBUS_TYPE_STRING, &album);
+    append_entry(&dict, MPRIS_METADATA_URL, DBUS_TYPE_STRING, &url);
+    append_entry(&dict, MPRIS_METADATA_TRACK_NUMBER, DBUS_TYPE_INT32, &track_number);
+    append_entry(&dict, MPRIS_METADATA_BITRATE, DBUS_TYPE_INT32, &bitrate);
+    append_entry(&dict, MPRIS_METADATA_COMMENT, DBUS_TYPE_STRING, &comment_str);
+    append_string_array_entry(&dict, MPRIS_METADATA_ARTIST, "Artist", oversized ? 64 : 2);
+    append_string_array_entry(&dict, MPRIS_METADATA_ALBUM_ARTIST, "Album Artist", 1);
+    append_string_array_entry(&dict, "xesam:genre", "Genre", oversized ? 32 : 1);
+    for (int i = 0; oversized && i < 256; i++) {
+        char key[32];
+        snprintf(key, sizeof(key), "xesam:custom%d", i);
+        append_entry(&dict, key, DBUS_TYPE_STRING, &title);
+    }
+    dbus_message_iter_close_container(&variant, &dict);
+    dbus_message_iter_close_container(iter, &variant);
+    free(comment);
+}
+
+/**
+ * Builds a reply to GetAll on the player interface, like the players send.
+ */
+DBusMessage* build_properties_reply(const bool oversized)
+{
+    DBusMessage *msg = dbus_message_new(DBUS_MESSAGE_TYPE_METHOD_RETURN);
+    if (NULL == msg) { return NULL; }
+
+    const char *status = MPRIS_METADATA_VALUE_PLAYING;
+    const char *loop_status = MPRIS_LOOPSTATUS_VALUE_NONE;
+    const dbus_bool_t yes = TRUE;
+    const dbus_bool_t no = FALSE;
+    const double volume = 0.8;
+    const double rate = 1.0;
+    const int64_t position = 42 * 1000000L;
+
+    DBusMessageIter args, dict, entry;
+    dbus_message_iter_init_append(msg, &args);
+    dbus_message_iter_open_container(&args, DBUS_TYPE_ARRAY, "{sv}", &dict);
+    append_entry(&dict, MPRIS_PNAME_PLAYBACKSTATUS, DBUS_TYPE_STRING, &status);
+    append_entry(&dict, MPRIS_PNAME_LOOPSTATUS, DBUS_TYPE_STRING, &loop_status);
+    append_entry(&dict, MPRIS_PNAME_SHUFFLE, DBUS_TYPE_BOOLEAN, &no);
+    append_entry(&dict, MPRIS_PNAME_VOLUME, DBUS_TYPE_DOUBLE, &volume);
+    append_entry(&dict, "Rate", DBUS_TYPE_DOUBLE, &rate);
+    append_entry(&dict, MPRIS_PNAME_POSITION, DBUS_TYPE_INT64, &position);
+    append_entry(&dict, MPRIS_PNAME_CANCONTROL, DBUS_TYPE_BOOLEAN, &yes);
+    append_entry(&dict, MPRIS_PNAME_CANGONEXT, DBUS_TYPE_BOOLEAN, &yes);
+    append_entry(&dict, MPRIS_PNAME_CANGOPREVIOUS, DBUS_TYPE_BOOLEAN, &yes);
+    append_entry(&dict, MPRIS_PNAME_CANPLAY, DBUS_TYPE_BOOLEAN, &yes);
+    append_entry(&dict, MPRIS_PNAME_CANPAUSE, DBUS_TYPE_BOOLEAN, &yes);
+    append_entry(&dict, MPRIS_PNAME_CANSEEK, DBUS_TYPE_BOOLEAN, &yes);
+
+    const char *key = MPRIS_PNAME_METADATA;
+    dbus_message_iter_open_container(&dict, DBUS_TYPE_DICT_ENTRY, NULL, &entry);
+    dbus_message_iter_append_basic(&entry, DBUS_TYPE_STRING, &key);
+    append_metadata(&entry, oversized);
+    dbus_message_iter_close_container(&dict, &entry);
+
+    dbus_message_iter_close_container(&args, &dict);
+    return msg;
+}
+
+/**
+ * Builds a message holding only the metadata variant, like the reply to Get Metadata.
+ */
+DBusMessage* build_metadata_reply(const bool oversized)
+{
+    DBusMessage *msg = dbus_message_new(DBUS_MESSAGE_TYPE_METHOD_RETURN);
+    if (NULL == msg) { return NULL; }
+
+    DBusMessageIter args;
+    dbus_message_iter_init_append(msg, &args);
+    append_metadata(&args, oversized);
+    return msg;
+}
+
+size_t get_message_size(DBusMessage *msg)
+{
+    char *data = NULL;
+    int len = 0;
+    if (!dbus_message_marshal(msg, &data, &len)) { return 0; }
+    dbus_free(data);
+    return len;
+}
+
+void bench_load_properties(void *data)
+{
+    mpris_properties properties = {0};
+    load_properties(&properties, data);
+    mpris_metadata_decode(&properties.metadata, 1u << mpris_meta_track_number);
+    sink += properties.metadata.track_number;
+    mpris_properties_free(&properties);
+}
+
+void bench_load_metadata(void *data)
+{
+    mpris_metadata track = {0};
+    DBusMessageIter iter;
+    if (dbus_message_iter_init(data, &iter)) {
+        load_metadata(&track, &iter);
+    }
+    mpris_metadata_decode(&track, 1u << mpris_meta_track_number);
+    sink += track.track_number;
+    mpris_metadata_free(&track);
+}
+
+void bench_decode_cases(void)
+{
+    const char *names[2][2] = {
+        { "load_properties/realistic", "load_properties/oversized" },
+        { "load_metadata/realistic", "load_metadata/oversized" },
+    };
+    for (int oversized = 0; oversized < 2; oversized++) {
+        DBusMessage *properties = build_properties_reply(oversized);
+        DBusMessage *metadata = build_metadata_reply(oversized);
+        if (NULL != properties) {
+            run_microbench(names[0][oversized], bench_load_properties, properties, get_message_size(properties));
+            dbus_message_unref(properties);
+        }
+        if (NULL != metadata) {
+            run_microbench(names[1][oversized], bench_load_metadata, metadata, get_message_size(metadata));
+            dbus_message_unref(metadata);
+        }
+    }
+}
+
+struct render_case {
+    const char *format;
+    info_template tpl;
+    mpris_properties properties;
+    sbuf output;
+};
+
+void bench_template_compile(void *data)
+{
+    struct render_case *c = data;
+    info_template tpl;
+    info_template_compile(&tpl, c->format);
+    sink += tpl.segment_count;
+    info_template_free(&tpl);
+}
+
+void bench_template_render(void *data)
+{
+    struct render_case *c = data;
+    sbuf_reset(&c->output);
+    info_template_render(&c->tpl, &c->properties, &c->output);
+    sink += c->output.len;
+}
+
+void bench_render_json(void *data)
+{
+    struct render_case *c = data;
+    sbuf_reset(&c->output);
+    info_render_json(&c->properties, &c->output);
+    sink += c->output.len;
+}
+
+void bench_render_cases(void)
+{
+    const char *formats[][2] = {
+        { "default", INFO_DEFAULT_STATUS },
+        { "full", INFO_FULL },
+        { "status", INFO_PLAYBACK_STATUS },
+        { "meta", "%meta:xesam:genre - %meta:mpris:trackid" },
+    };
+    DBusMessage *reply = build_properties_reply(false);
+    if (NULL == reply) { return; }
+
+    for (size_t i = 0; i < sizeof(formats) / sizeof(formats[0]); i++) {
+        struct render_case c = { .format = formats[i][1] };
+        load_properties(&c.properties, reply);
+        c.properties.player_name = "spotify";
+        c.properties.player_identity = "Spotify";
+        info_template_compile(&c.tpl, c.format);
+        info_template_render(&c.tpl, &c.properties, &c.output);
+
+        char name[64];
+        snprintf(name, sizeof(name), "info_template_compile/%s", formats[i][0]);
+        run_microbench(name, bench_template_compile, &c, strlen(c.format));
+        snprintf(name, sizeof(name), "info_template_render/%s", formats[i][0]);
+        run_microbench(name, bench_template_render, &c, c.output.len);
+
+        sbuf_free(&c.output);
+        info_template_free(&c.tpl);
+        mpris_properties_free(&c.properties);
+    }
+
+    struct render_case c = {0};
+    load_properties(&c.properties, reply);
+    c.properties.player_name = "spotify";
+    c.properties.player_identity = "Spotify";
+    info_render_json(&c.properties, &c.output);
+    run_microbench("info_render_json", bench_render_json, &c, c.output.len);
+    sbuf_free(&c.output);
+    mpris_properties_free(&c.properties);
+
+    dbus_message_unref(reply);
+}
+
+struct escape_case {
+    const char *value;
+    enum escape_mode mode;
+    sbuf output;
+};
+
+void bench_escape(void *data)
+{
+    struct escape_case *c = data;
+    sbuf_reset(&c->output);
+    escape_append(&c->output, c->value, c->mode);
+    sink += c->output.len;
+}
+
+/**
+ * Escapes a long comment without any special character, which is compared with copying it
+ * with no escaping, and one where a special character comes every few words.
+ */
+void bench_escape_cases(void)
+{
+    const char *modes[] = { ESCAPE_NONE, ESCAPE_JSON, ESCAPE_SHELL, ESCAPE_XML, ESCAPE_CSV };
+    sbuf plain = {0};
+    sbuf special = {0};
+    for (int i = 0; i < 64; i++) {
+        sbuf_append_str(&plain, "https://example.org/a/long/comment/without/any/quotes ");
+        sbuf_append_str(&special, "a \"long\" comment, with <some> & 'quotes'\n ");
+    }
+    const struct { const char *name; const char *value; } values[] = {
+        { "plain", plain.data },
+        { "special", special.data },
+    };
+    for (size_t v = 0; v < sizeof(values) / sizeof(values[0]); v++) {
+        for (size_t m = 0; m < sizeof(modes) / sizeof(modes[0]); m++) {
+            struct escape_case c = { .value = values[v].value };
+            parse_escape_mode(modes[m], &c.mode);
+
+            char name[64];
+            snprintf(name, sizeof(name), "escape_append/%s/%s", modes[m], values[v].name);
+            run_microbench(name, bench_escape, &c, strlen(c.value));
+            sbuf_free(&c.output);
+        }
+    }
+    sbuf_free(&plain);
+    sbuf_free(&special);
+}
+
+void bench_format_interval(void *data)
+{
+    const int64_t *intervals = data;
+    char label[MAX_OUTPUT_LENGTH];
+    for (int i = 0; i < 4; i++) {
+        format_nanosecond_interval(label, sizeof(label), intervals[i]);
+        sink += label[0];
+    }
+}
+
+void bench_format_cases(void)
+{
+    // seconds, minutes, hours and days, in the unit the players use for the length
+    int64_t intervals[4] = { 42 * 1000000L, 283 * 1000000L, 7384 * 1000000L, 273600 * 1000000L };
+    run_microbench("format_nanosecond_interval/x4", bench_format_interval, intervals, 4 * sizeof(int64_t));
+}
+
+/**
+ * Checks that every key is found in the constant slots of its table, as they are written by hand.
+ */
+bool check_field_slots(const mpris_field *const slots[MPRIS_FIELD_SLOTS], const mpris_field *fields, const int count)
+{
+    bool found = true;
+    for (int i = 0; i < count; i++) {
+        if (find_field(slots, fields[i].key) != &fields[i]) {
+            fprintf(stderr, "microbench: the key '%s' isn't in its slot %u\n", fields[i].key,
+                MPRIS_FIELD_SLOT(hash_field_key(fields[i].key)));
+            found = false;
+        }
+    }
+    return found;
+}
+
+int main(int argc, char **argv)
+{
+    static struct option long_options[] = {
+        {"filter", required_argument, NULL, 1},
+        {0},
+    };
+    while (true) {
+        const int char_arg = getopt_long(argc, argv, "", long_options, NULL);
+        if (char_arg == -1) { break; }
+        if (char_arg == 1) {
+            filter = optarg;
+            continue;
+        }
+        fprintf(stderr, "usage: %s [--filter NAME]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    if (!check_field_slots(mpris_metadata_slots, mpris_metadata_fields, array_size(mpris_metadata_fields)) ||
+        !check_field_slots(mpris_properties_slots, mpris_properties_fields, array_size(mpris_properties_fields))) {
+        return EXIT_FAILURE;
+    }
+
+    fprintf(stdout, "%-36s %12s %12s %12s %12s\n", "benchmark", "iterations", "ns/op", "bytes/op", "allocs/op");
+    bench_str_replace_cases();
+    bench_render_cases();
+    bench_decode_cases();
+    bench_format_cases();
+    bench_escape_cases();
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,350 @@
+/**
+ * @author Marius Orcsik <marius@habarnam.ro>
+ *
+ * Scripted MPRIS player used by the benchmark suite.
+ * It only implements as much of the org.mpris.MediaPlayer2 interfaces as mpris-ctl uses.
+ * The number of calls it received is returned by the Stats method of the
+ * org.mpris.mprisctl.Mock interface, which isn't counted itself.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <getopt.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <dbus/dbus.h>
+
+#define MOCK_NAMESPACE      "org.mpris.MediaPlayer2."
+#define MOCK_PATH           "/org/mpris/MediaPlayer2"
+#define MOCK_ROOT_INTERFACE "org.mpris.MediaPlayer2"
+#define MOCK_INTERFACE      "org.mpris.MediaPlayer2.Player"
+#define MOCK_STATS          "org.mpris.mprisctl.Mock"
+
+struct mock {
+    const char *name;
+    const char *identity;
+    char status[16];
+    char loop_status[16];
+    double volume;
+    double rate;
+    int64_t position;
+    int64_t length;
+    bool shuffle;
+    int track;
+    int delay_ms;
+    bool no_reply;
+    size_t meta_size;
+    char *comment;
+    uint64_t received;
+};
+
+void sleep_ms(int ms)
+{
+    if (ms <= 0) { return; }
+    struct timespec ts = { .tv_sec = ms / 1000, .tv_nsec = (ms % 1000) * 1000000L };
+    nanosleep(&ts, NULL);
+}
+
+void append_variant(DBusMessageIter *iter, int type, const void *value)
+{
+    char sig[2] = { (char)type, 0 };
+    DBusMessageIter variant;
+    dbus_message_iter_open_container(iter, DBUS_TYPE_VARIANT, sig, &variant);
+    dbus_message_iter_append_basic(&variant, type, value);
+    dbus_message_iter_close_container(iter, &variant);
+}
+
+void append_dict_entry(DBusMessageIter *dict, const char *key, int type, const void *value)
+{
+    DBusMessageIter entry;
+    dbus_message_iter_open_container(dict, DBUS_TYPE_DICT_ENTRY, NULL, &entry);
+    dbus_message_iter_append_basic(&entry, DBUS_TYPE_STRING, &key);
+    append_variant(&entry, type, value);
+    dbus_message_iter_close_container(dict, &entry);
+}
+
+void append_metadata(DBusMessageIter *iter, struct mock *m)
+{
+    char trackid[64], title[64];
+    snprintf(trackid, sizeof(trackid), "/org/mpris/MediaPlayer2/Track/%d", m->track);
+    snprintf(title, sizeof(title), "Track %d", m->track);
+    const char *p_trackid = trackid, *p_title = title, *album = "Mock Album", *comment = m->comment;
+    const char *art = "file:///tmp/mock-cover.png";
+    const int32_t track_number = m->track;
+
+    DBusMessageIter variant, dict, entry, artists_variant, artists;
+    dbus_message_iter_open_container(iter, DBUS_TYPE_VARIANT, "a{sv}", &variant);
+    dbus_message_iter_open_container(&variant, DBUS_TYPE_ARRAY, "{sv}", &dict);
+    append_dict_entry(&dict, "mpris:trackid", DBUS_TYPE_OBJECT_PATH, &p_trackid);
+    append_dict_entry(&dict, "mpris:length", DBUS_TYPE_INT64, &m->length);
+    append_dict_entry(&dict, "mpris:artUrl", DBUS_TYPE_STRING, &art);
+    append_dict_entry(&dict, "xesam:title", DBUS_TYPE_STRING, &p_title);
+    append_dict_entry(&dict, "xesam:album", DBUS_TYPE_STRING, &album);
+    append_dict_entry(&dict, "xesam:trackNumber", DBUS_TYPE_INT32, &track_number);
+    if (NULL != comment) {
+        append_dict_entry(&dict, "xesam:comment", DBUS_TYPE_STRING, &comment);
+    }
+
+    const char *key = "xesam:artist";
+    const char *artist1 = "Mock Artist", *artist2 = "Guest Artist";
+    dbus_message_iter_open_container(&dict, DBUS_TYPE_DICT_ENTRY, NULL, &entry);
+    dbus_message_iter_append_basic(&entry, DBUS_TYPE_STRING, &key);
+    dbus_message_iter_open_container(&entry, DBUS_TYPE_VARIANT, "as", &artists_variant);
+    dbus_message_iter_open_container(&artists_variant, DBUS_TYPE_ARRAY, "s", &artists);
+    dbus_message_iter_append_basic(&artists, DBUS_TYPE_STRING, &artist1);
+    dbus_message_iter_append_basic(&artists, DBUS_TYPE_STRING, &artist2);
+    dbus_message_iter_close_container(&artists_variant, &artists);
+    dbus_message_iter_close_container(&entry, &artists_variant);
+    dbus_message_iter_close_container(&dict, &entry);
+
+    dbus_message_iter_close_container(&variant, &dict);
+    dbus_message_iter_close_container(iter, &variant);
+}
+
+bool append_property(DBusMessageIter *iter, struct mock *m, const char *prop)
+{
+    const char *status = m->status, *loop = m->loop_status, *identity = m->identity;
+    const dbus_bool_t yes = TRUE, shuffle = m->shuffle;
+    if (strcmp(prop, "PlaybackStatus") == 0) {
+        append_variant(iter, DBUS_TYPE_STRING, &status);
+    } else if (strcmp(prop, "LoopStatus") == 0) {
+        append_variant(iter, DBUS_TYPE_STRING, &loop);
+    } else if (strcmp(prop, "Volume") == 0) {
+        append_variant(iter, DBUS_TYPE_DOUBLE, &m->volume);
+    } else if (strcmp(prop, "Rate") == 0) {
+        append_variant(iter, DBUS_TYPE_DOUBLE, &m->rate);
+    } else if (strcmp(prop, "Position") == 0) {
+        append_variant(iter, DBUS_TYPE_INT64, &m->position);
+    } else if (strcmp(prop, "Shuffle") == 0) {
+        append_variant(iter, DBUS_TYPE_BOOLEAN, &shuffle);
+    } else if (strcmp(prop, "Metadata") == 0) {
+        append_metadata(iter, m);
+    } else if (strcmp(prop, "Identity") == 0) {
+        append_variant(iter, DBUS_TYPE_STRING, &identity);
+    } else if (strncmp(prop, "Can", 3) == 0) {
+        append_variant(iter, DBUS_TYPE_BOOLEAN, &yes);
+    } else {
+        return false;
+    }
+    return true;
+}
+
+const char *player_properties[] = {
+    "PlaybackStatus", "LoopStatus", "Rate", "Shuffle", "Metadata", "Volume", "Position",
+    "CanGoNext", "CanGoPrevious", "CanPlay", "CanPause", "CanSeek", "CanControl",
+};
+
+void emit_changed(DBusConnection *conn, struct mock *m, const char *prop)
+{
+    DBusMessage *sig = dbus_message_new_signal(MOCK_PATH, DBUS_INTERFACE_PROPERTIES, "PropertiesChanged");
+    if (NULL == sig) { return; }
+    DBusMessageIter args, dict, entry, invalidated;
+    const char *iface = MOCK_INTERFACE;
+    dbus_message_iter_init_append(sig, &args);
+    dbus_message_iter_append_basic(&args, DBUS_TYPE_STRING, &iface);
+    dbus_message_iter_open_container(&args, DBUS_TYPE_ARRAY, "{sv}", &dict);
+    dbus_message_iter_open_container(&dict, DBUS_TYPE_DICT_ENTRY, NULL, &entry);
+    dbus_message_iter_append_basic(&entry, DBUS_TYPE_STRING, &prop);
+    append_property(&entry, m, prop);
+    dbus_message_iter_close_container(&dict, &entry);
+    dbus_message_iter_close_container(&args, &dict);
+    dbus_message_iter_open_container(&args, DBUS_TYPE_ARRAY, "s", &invalidated);
+    dbus_message_iter_close_container(&args, &invalidated);
+    dbus_connection_send(conn, sig, NULL);
+    dbus_message_unref(sig);
+}
+
+void set_status(DBusConnection *conn, struct mock *m, const char *status)
+{
+    snprintf(m->status, sizeof(m->status), "%s", status);
+    emit_changed(conn, m, "PlaybackStatus");
+}
+
+DBusMessage *handle(DBusConnection *conn, struct mock *m, DBusMessage *msg)
+{
+    const char *iface = dbus_message_get_interface(msg);
+    const char *member = dbus_message_get_member(msg);
+    if (NULL == iface || NULL == member) { return NULL; }
+
+    if (strcmp(iface, MOCK_STATS) == 0 && strcmp(member, "Stats") == 0) {
+        DBusMessage *reply = dbus_message_new_method_return(msg);
+        dbus_message_append_args(reply, DBUS_TYPE_UINT64, &m->received, DBUS_TYPE_INVALID);
+        return reply;
+    }
+    m->received++;
+    if (m->no_reply) { return NULL; }
+    sleep_ms(m->delay_ms);
+
+    if (strcmp(iface, DBUS_INTERFACE_PROPERTIES) == 0) {
+        const char *arg_iface = NULL, *prop = NULL;
+        DBusMessageIter args;
+        dbus_message_iter_init(msg, &args);
+        if (DBUS_TYPE_STRING == dbus_message_iter_get_arg_type(&args)) {
+            dbus_message_iter_get_basic(&args, &arg_iface);
+            dbus_message_iter_next(&args);
+        }
+        if (DBUS_TYPE_STRING == dbus_message_iter_get_arg_type(&args)) {
+            dbus_message_iter_get_basic(&args, &prop);
+            dbus_message_iter_next(&args);
+        }
+        if (strcmp(member, "GetAll") == 0) {
+            DBusMessage *reply = dbus_message_new_method_return(msg);
+            DBusMessageIter out, dict, entry;
+            dbus_message_iter_init_append(reply, &out);
+            dbus_message_iter_open_container(&out, DBUS_TYPE_ARRAY, "{sv}", &dict);
+            if (NULL != arg_iface && strcmp(arg_iface, MOCK_INTERFACE) == 0) {
+                for (size_t i = 0; i < sizeof(player_properties)/sizeof(player_properties[0]); i++) {
+                    const char *key = player_properties[i];
+                    dbus_message_iter_open_container(&dict, DBUS_TYPE_DICT_ENTRY, NULL, &entry);
+                    dbus_message_iter_append_basic(&entry, DBUS_TYPE_STRING, &key);
+                    append_property(&entry, m, key);
+                    dbus_message_iter_close_container(&dict, &entry);
+                }
+            }
+            dbus_message_iter_close_container(&out, &dict);
+            return reply;
+        }
+        if (strcmp(member, "Get") == 0 && NULL != prop) {
+            DBusMessage *reply = dbus_message_new_method_return(msg);
+            DBusMessageIter out;
+            dbus_message_iter_init_append(reply, &out);
+            if (!append_property(&out, m, prop)) {
+                dbus_message_unref(reply);
+                return dbus_message_new_error(msg, DBUS_ERROR_UNKNOWN_PROPERTY, prop);
+            }
+            return reply;
+        }
+        if (strcmp(member, "Set") == 0 && NULL != prop) {
+            DBusMessageIter variant;
+            dbus_message_iter_recurse(&args, &variant);
+            if (strcmp(prop, "Volume") == 0) {
+                dbus_message_iter_get_basic(&variant, &m->volume);
+            } else if (strcmp(prop, "Shuffle") == 0) {
+                dbus_bool_t value;
+                dbus_message_iter_get_basic(&variant, &value);
+                m->shuffle = value;
+            } else if (strcmp(prop, "LoopStatus") == 0) {
+                const char *value;
+                dbus_message_iter_get_basic(&variant, &value);
+                snprintf(m->loop_status, sizeof(m->loop_status), "%s", value);
+            }
+            emit_changed(conn, m, prop);
+            return dbus_message_new_method_return(msg);
+        }
+        return dbus_message_new_error(msg, DBUS_ERROR_UNKNOWN_METHOD, member);
+    }
+
+    if (strcmp(iface, MOCK_INTERFACE) == 0) {
+        if (strcmp(member, "Next") == 0 || strcmp(member, "Previous") == 0) {
+            m->track += strcmp(member, "Next") == 0 ? 1 : -1;
+            m->position = 0;
+            emit_changed(conn, m, "Metadata");
+        } else if (strcmp(member, "Play") == 0) {
+            set_status(conn, m, "Playing");
+        } else if (strcmp(member, "Pause") == 0) {
+            set_status(conn, m, "Paused");
+        } else if (strcmp(member, "Stop") == 0) {
+            set_status(conn, m, "Stopped");
+        } else if (strcmp(member, "PlayPause") == 0) {
+            set_status(conn, m, strcmp(m->status, "Playing") == 0 ? "Paused" : "Playing");
+        } else if (strcmp(member, "Seek") == 0) {
+            int64_t offset = 0;
+            dbus_message_get_args(msg, NULL, DBUS_TYPE_INT64, &offset, DBUS_TYPE_INVALID);
+            m->position += offset;
+            if (m->position < 0) { m->position = 0; }
+            DBusMessage *sig = dbus_message_new_signal(MOCK_PATH, MOCK_INTERFACE, "Seeked");
+            dbus_message_append_args(sig, DBUS_TYPE_INT64, &m->position, DBUS_TYPE_INVALID);
+            dbus_connection_send(conn, sig, NULL);
+            dbus_message_unref(sig);
+        }
+        return dbus_message_new_method_return(msg);
+    }
+    if (strcmp(iface, MOCK_ROOT_INTERFACE) == 0) {
+        return dbus_message_new_method_return(msg);
+    }
+    return dbus_message_new_error(msg, DBUS_ERROR_UNKNOWN_METHOD, member);
+}
+
+int main(int argc, char **argv)
+{
+    struct mock m = {
+        .name = "mock", .identity = "Mock Player", .volume = 0.5, .rate = 1.0,
+        .length = 180 * 1000000L, .track = 1,
+    };
+    snprintf(m.status, sizeof(m.status), "%s", "Playing");
+    snprintf(m.loop_status, sizeof(m.loop_status), "%s", "None");
+
+    static struct option long_options[] = {
+        {"name", required_argument, NULL, 'n'},
+        {"identity", required_argument, NULL, 'i'},
+        {"status", required_argument, NULL, 's'},
+        {"delay", required_argument, NULL, 'd'},
+        {"no-reply", no_argument, NULL, 'r'},
+        {"meta-size", required_argument, NULL, 'm'},
+        {0},
+    };
+    while (true) {
+        const int c = getopt_long(argc, argv, "", long_options, NULL);
+        if (c == -1) { break; }
+        switch (c) {
+            case 'n': m.name = optarg; break;
+            case 'i': m.identity = optarg; break;
+            case 's': snprintf(m.status, sizeof(m.status), "%s", optarg); break;
+            case 'd': m.delay_ms = atoi(optarg); break;
+            case 'r': m.no_reply = true; break;
+            case 'm': m.meta_size = strtoul(optarg, NULL, 10); break;
+            default:
+                fprintf(stderr, "usage: %s --name NAME [--identity ID] [--status STATUS] [--delay MS] [--no-reply] [--meta-size BYTES]\n", argv[0]);
+                return EXIT_FAILURE;
+        }
+    }
+    if (m.meta_size > 0) {
+        m.comment = malloc(m.meta_size + 1);
+        if (NULL == m.comment) { return EXIT_FAILURE; }
+        for (size_t i = 0; i < m.meta_size; i++) {
+            m.comment[i] = 'a' + (char)(i % 26);
+        }
+        m.comment[m.meta_size] = 0;
+    }
+
+    DBusError err;
+    dbus_error_init(&err);
+    DBusConnection *conn = dbus_bus_get_private(DBUS_BUS_SESSION, &err);
+    if (NULL == conn) {
+        fprintf(stderr, "mock: connection error: %s\n", err.message);
+        return EXIT_FAILURE;
+    }
+    dbus_connection_set_exit_on_disconnect(conn, FALSE);
+
+    char bus_name[256];
+    snprintf(bus_name, sizeof(bus_name), MOCK_NAMESPACE "%s", m.name);
+    if (dbus_bus_request_name(conn, bus_name, DBUS_NAME_FLAG_DO_NOT_QUEUE, &err) != DBUS_REQUEST_NAME_REPLY_PRIMARY_OWNER) {
+        fprintf(stderr, "mock: unable to own %s\n", bus_name);
+        return EXIT_FAILURE;
+    }
+
+    while (dbus_connection_read_write(conn, -1)) {
+        DBusMessage *msg;
+        while (NULL != (msg = dbus_connection_pop_message(conn))) {
+            if (dbus_message_get_type(msg) == DBUS_MESSAGE_TYPE_METHOD_CALL) {
+                DBusMessage *reply = handle(conn, &m, msg);
+                if (NULL != reply) {
+                    if (!dbus_message_get_no_reply(msg)) {
+                        dbus_connection_send(conn, reply, NULL);
+                    }
+                    dbus_message_unref(reply);
+                }
+            }
+            dbus_message_unref(msg);
+        }
+        dbus_connection_flush(conn);
+    }
+    dbus_connection_close(conn);
+    dbus_connection_unref(conn);
+    free(m.comment);
+    return EXIT_SUCCESS;
+}
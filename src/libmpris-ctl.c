@@ -0,0 +1,429 @@
+/**
+ * @author Marius Orcsik <marius@habarnam.ro>
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "sstring.h"
+#include "sarena.h"
+#include "sstats.h"
+#include "shealth.h"
+#include "sdbus.h"
+#include "splayers.h"
+#include "mpris-ctl.h"
+
+/**
+ * The library is built from this single translation unit, which includes the same modules as the
+ * command line, so they are still compiled only once. Only the functions declared in mpris-ctl.h
+ * are exported, everything else is hidden in the shared library and localized in the static one.
+ *
+ * The player table is the one of the daemon: all the players with all their properties, kept up to
+ * date from the signals. Only its loads don't block, their replies are read by the dispatch like the
+ * signals. The health record isn't used, as it belongs to the command line.
+ */
+
+// the properties kept up to date for every player
+#define CTL_PROPERTIES      (mpris_prop_all | mpris_prop_identity)
+// the initial capacity of the table of the commands waiting for a reply
+#define CTL_MIN_CALLS       16
+// the time the players get to answer a command
+#define CTL_CALL_TIMEOUT    (DBUS_CONNECTION_TIMEOUT * 1000L) //µs
+
+/**
+ * A command sent to a player, matched with its reply by the serial of the message.
+ */
+typedef struct ctl_call {
+    dbus_uint32_t serial;
+    // a copy of the name of the player, as it can leave the bus before answering
+    char *player;
+    int64_t deadline;
+    mpris_ctl_callback callback;
+    void *data;
+} ctl_call;
+
+struct mpris_ctl {
+    DBusConnection *conn;
+    player_table table;
+    ctl_call *calls;
+    int call_count;
+    int call_cap;
+};
+
+struct mpris_ctl_snapshot {
+    mpris_ctl_player *players;
+    int player_count;
+    // the strings of the players
+    arena strings;
+};
+
+/**
+ * Calls the callback of the command the message replies to, if it's one.
+ * Returns false if the message isn't the reply of a command.
+ */
+bool ctl_handle_reply(mpris_ctl *ctl, DBusMessage *msg)
+{
+    const int type = dbus_message_get_type(msg);
+    if (type != DBUS_MESSAGE_TYPE_METHOD_RETURN && type != DBUS_MESSAGE_TYPE_ERROR) { return false; }
+
+    const dbus_uint32_t serial = dbus_message_get_reply_serial(msg);
+    for (int i = 0; i < ctl->call_count; i++) {
+        const ctl_call call = ctl->calls[i];
+        if (call.serial != serial) { continue; }
+
+        // the call is removed first, so the callback can send other commands
+        ctl->calls[i] = ctl->calls[--ctl->call_count];
+        if (NULL != call.callback) {
+            DBusError err = {0};
+            dbus_error_init(&err);
+            dbus_set_error_from_message(&err, msg);
+            const char *error = dbus_error_is_set(&err) ? (NULL != err.message ? err.message : err.name) : NULL;
+            call.callback(ctl, call.player, NULL == error ? 0 : -1, error, call.data);
+            dbus_error_free(&err);
+        }
+        free(call.player);
+        return true;
+    }
+    return false;
+}
+
+/**
+ * Calls the callbacks of the commands which weren't answered in time, and forgets them.
+ */
+void ctl_expire_calls(mpris_ctl *ctl, const int64_t now)
+{
+    for (int i = ctl->call_count - 1; i >= 0; i--) {
+        const ctl_call call = ctl->calls[i];
+        if (call.deadline > now) { continue; }
+
+        ctl->calls[i] = ctl->calls[--ctl->call_count];
+        if (NULL != call.callback) {
+            call.callback(ctl, call.player, -1, "The player didn't reply in time.", call.data);
+        }
+        free(call.player);
+    }
+}
+
+mpris_ctl *mpris_ctl_open(void)
+{
+    mpris_ctl *ctl = calloc(1, sizeof(mpris_ctl));
+    if (NULL == ctl) { return NULL; }
+
+    ctl->table.properties = CTL_PROPERTIES;
+    ctl->table.resync = MPRIS_POSITION_RESYNC * 1000000L;
+    ctl->table.nonblocking = true;
+
+    DBusError err = {0};
+    dbus_error_init(&err);
+
+    // a private connection, so the program can have its own shared one without interference
+    ctl->conn = dbus_bus_get_private(DBUS_BUS_SESSION, &err);
+    if (NULL == ctl->conn) { goto _free_ctl; }
+
+    // the program is the one to decide what to do when the bus goes away
+    dbus_connection_set_exit_on_disconnect(ctl->conn, FALSE);
+
+    // subscribed before loading the players, so no change is lost in between
+    add_mpris_signal_matches(ctl->conn, &err);
+    if (dbus_error_is_set(&err)) { goto _close_conn; }
+
+    if (mpris_ctl_refresh(ctl) < 0) { goto _close_conn; }
+    return ctl;
+
+_close_conn:
+    dbus_connection_close(ctl->conn);
+    dbus_connection_unref(ctl->conn);
+_free_ctl:
+    dbus_error_free(&err);
+    free(ctl);
+    return NULL;
+}
+
+void mpris_ctl_close(mpris_ctl *ctl)
+{
+    if (NULL == ctl) { return; }
+
+    for (int i = 0; i < ctl->call_count; i++) {
+        free(ctl->calls[i].player);
+    }
+    free(ctl->calls);
+    table_free(&ctl->table);
+    dbus_connection_close(ctl->conn);
+    dbus_connection_unref(ctl->conn);
+    free(ctl);
+}
+
+int mpris_ctl_refresh(mpris_ctl *ctl)
+{
+    if (NULL == ctl) { return -1; }
+    if (!dbus_connection_get_is_connected(ctl->conn)) { return -1; }
+
+    player_table *table = &ctl->table;
+    table_free_players(table);
+    table->player_count = load_mpris_players(ctl->conn, &table->players, &table->player_cap, &table->names);
+    load_mpris_players_owners(ctl->conn, table->players, table->player_count, &table->names);
+    for (int i = 0; i < table->player_count; i++) {
+        mpris_player_alloc_properties(&table->players[i]);
+    }
+    // the refresh is the only call which waits for the players
+    load_mpris_players_properties(ctl->conn, table->players, table->player_count, table->properties);
+    return table->player_count;
+}
+
+int mpris_ctl_player_count(const mpris_ctl *ctl)
+{
+    if (NULL == ctl) { return 0; }
+    return ctl->table.player_count;
+}
+
+const char *mpris_ctl_player_name(const mpris_ctl *ctl, const int index)
+{
+    if (NULL == ctl) { return NULL; }
+    if (index < 0 || index >= ctl->table.player_count) { return NULL; }
+    return get_player_name(ctl->table.players[index].name);
+}
+
+mpris_ctl_snapshot *mpris_ctl_snapshot_take(mpris_ctl *ctl)
+{
+    if (NULL == ctl) { return NULL; }
+
+    mpris_ctl_snapshot *snapshot = calloc(1, sizeof(mpris_ctl_snapshot));
+    if (NULL == snapshot) { return NULL; }
+    if (ctl->table.player_count == 0) { return snapshot; }
+
+    snapshot->players = calloc(ctl->table.player_count, sizeof(mpris_ctl_player));
+    if (NULL == snapshot->players) { goto _free_snapshot; }
+
+    const int64_t now = mpris_now();
+    arena *strings = &snapshot->strings;
+    for (int i = 0; i < ctl->table.player_count; i++) {
+        const mpris_player *source = &ctl->table.players[i];
+        mpris_properties *props = source->properties;
+        if (NULL == props) { continue; }
+
+        mpris_metadata_decode(&props->metadata, MPRIS_METADATA_ALL);
+        const mpris_metadata *track = &props->metadata;
+        mpris_ctl_player *player = &snapshot->players[snapshot->player_count++];
+        *player = (mpris_ctl_player){
+            .name = arena_strdup(strings, get_player_name(source->name)),
+            .bus_name = arena_strdup(strings, source->name),
+            .identity = arena_strdup(strings, props->player_identity),
+            .playback_status = arena_strdup(strings, props->playback_status),
+            .loop_status = arena_strdup(strings, props->loop_status),
+            .shuffle = props->shuffle,
+            .volume = props->volume,
+            .position = mpris_properties_position(props, now),
+            .rate = props->rate,
+            .can_control = props->can_control,
+            .can_go_next = props->can_go_next,
+            .can_go_previous = props->can_go_previous,
+            .can_play = props->can_play,
+            .can_pause = props->can_pause,
+            .can_seek = props->can_seek,
+            .track_id = arena_strdup(strings, track->track_id),
+            .title = arena_strdup(strings, track->title),
+            .artist = arena_strdup(strings, track->artist),
+            .album = arena_strdup(strings, track->album),
+            .album_artist = arena_strdup(strings, track->album_artist),
+            .composer = arena_strdup(strings, track->composer),
+            .genre = arena_strdup(strings, track->genre),
+            .comment = arena_strdup(strings, track->comment),
+            .content_created = arena_strdup(strings, track->content_created),
+            .url = arena_strdup(strings, track->url),
+            .art_url = arena_strdup(strings, track->art_url),
+            .length = track->length,
+            .track_number = track->track_number,
+            .disc_number = track->disc_number,
+            .bitrate = track->bitrate,
+        };
+        if (NULL == player->name || NULL == player->bus_name) { goto _free_snapshot; }
+    }
+    return snapshot;
+
+_free_snapshot:
+    mpris_ctl_snapshot_free(snapshot);
+    return NULL;
+}
+
+int mpris_ctl_snapshot_count(const mpris_ctl_snapshot *snapshot)
+{
+    if (NULL == snapshot) { return 0; }
+    return snapshot->player_count;
+}
+
+const mpris_ctl_player *mpris_ctl_snapshot_player(const mpris_ctl_snapshot *snapshot, const int index)
+{
+    if (NULL == snapshot) { return NULL; }
+    if (index < 0 || index >= snapshot->player_count) { return NULL; }
+    return &snapshot->players[index];
+}
+
+void mpris_ctl_snapshot_free(mpris_ctl_snapshot *snapshot)
+{
+    if (NULL == snapshot) { return; }
+
+    free(snapshot->players);
+    arena_free(&snapshot->strings);
+    free(snapshot);
+}
+
+/**
+ * Builds the message calling the player for a command, or returns NULL if the command is unknown.
+ */
+DBusMessage* ctl_command_request(const mpris_player *player, const enum mpris_ctl_command command, const double value)
+{
+    const char *method = NULL;
+    switch (command) {
+        case mpris_ctl_play:
+            method = MPRIS_METHOD_PLAY;
+            break;
+        case mpris_ctl_pause:
+            method = MPRIS_METHOD_PAUSE;
+            break;
+        case mpris_ctl_stop:
+            method = MPRIS_METHOD_STOP;
+            break;
+        case mpris_ctl_play_pause:
+            method = MPRIS_METHOD_PLAY_PAUSE;
+            break;
+        case mpris_ctl_next:
+            method = MPRIS_METHOD_NEXT;
+            break;
+        case mpris_ctl_previous:
+            method = MPRIS_METHOD_PREVIOUS;
+            break;
+        case mpris_ctl_raise:
+            return dbus_message_new_method_call(player->name, MPRIS_PLAYER_PATH, MPRIS_MEDIA_PLAYER_INTERFACE, MPRIS_METHOD_RAISE);
+        case mpris_ctl_seek:
+            return seek_request(player->name, (int)value);
+        case mpris_ctl_volume:
+            return volume_request(player->name, value);
+        case mpris_ctl_shuffle:
+            return shuffle_request(player->name, value != 0);
+        case mpris_ctl_loop:
+            if (value == mpris_ctl_loop_track) {
+                return loop_status_request(player->name, MPRIS_LOOPSTATUS_VALUE_TRACK);
+            }
+            if (value == mpris_ctl_loop_playlist) {
+                return loop_status_request(player->name, MPRIS_LOOPSTATUS_VALUE_PLAYLIST);
+            }
+            return loop_status_request(player->name, MPRIS_LOOPSTATUS_VALUE_NONE);
+    }
+    if (NULL == method) { return NULL; }
+    return dbus_message_new_method_call(player->name, MPRIS_PLAYER_PATH, MPRIS_MEDIA_PLAYER_PLAYER_INTERFACE, method);
+}
+
+/**
+ * Sends the command to a player, and records it to be matched with its reply.
+ */
+bool ctl_send_command(mpris_ctl *ctl, const mpris_player *player, const enum mpris_ctl_command command, const double value,
+    mpris_ctl_callback callback, void *data)
+{
+    if (ctl->call_count == ctl->call_cap) {
+        const int cap = MAX(ctl->call_cap * 2, CTL_MIN_CALLS);
+        ctl_call *calls = realloc(ctl->calls, cap * sizeof(ctl_call));
+        if (NULL == calls) { return false; }
+        ctl->calls = calls;
+        ctl->call_cap = cap;
+    }
+
+    DBusMessage *msg = ctl_command_request(player, command, value);
+    if (NULL == msg) { return false; }
+
+    ctl_call *call = &ctl->calls[ctl->call_count];
+    *call = (ctl_call){ .callback = callback, .data = data };
+    call->player = strdup(get_player_name(player->name));
+    if (NULL == call->player) { goto _unref_message; }
+
+    // the reply is read from the connection as any other message, the timeout is ours to enforce
+    if (!dbus_connection_send(ctl->conn, msg, &call->serial)) {
+        free(call->player);
+        goto _unref_message;
+    }
+    call->deadline = mpris_now() + CTL_CALL_TIMEOUT;
+    ctl->call_count++;
+    dbus_message_unref(msg);
+    return true;
+
+_unref_message:
+    dbus_message_unref(msg);
+    return false;
+}
+
+int mpris_ctl_send(mpris_ctl *ctl, const char *player, const enum mpris_ctl_command command, const double value,
+    mpris_ctl_callback callback, void *data)
+{
+    if (NULL == ctl) { return -1; }
+
+    int sent = 0;
+    for (int i = 0; i < ctl->table.player_count; i++) {
+        const mpris_player *target = &ctl->table.players[i];
+        if (NULL != player && strcmp(get_player_name(target->name), player) != 0 && strcmp(target->name, player) != 0) {
+            continue;
+        }
+        if (!ctl_send_command(ctl, target, command, value, callback, data)) { return -1; }
+        sent++;
+    }
+    dbus_connection_flush(ctl->conn);
+    return sent;
+}
+
+int mpris_ctl_get_fd(const mpris_ctl *ctl)
+{
+    if (NULL == ctl) { return -1; }
+
+    int fd = -1;
+    if (!dbus_connection_get_unix_fd(ctl->conn, &fd)) { return -1; }
+    return fd;
+}
+
+int mpris_ctl_get_timeout(const mpris_ctl *ctl)
+{
+    if (NULL == ctl) { return -1; }
+
+    int64_t next = 0;
+    for (int i = 0; i < ctl->call_count; i++) {
+        next = next == 0 ? ctl->calls[i].deadline : MIN(next, ctl->calls[i].deadline);
+    }
+    const int64_t loads = table_next_load_deadline(&ctl->table);
+    if (loads != 0) {
+        next = next == 0 ? loads : MIN(next, loads);
+    }
+    for (int i = 0; i < ctl->table.player_count; i++) {
+        const int64_t deadline = table_position_deadline(&ctl->table, &ctl->table.players[i]);
+        if (deadline == 0) { continue; }
+        next = next == 0 ? deadline : MIN(next, deadline);
+    }
+    if (next == 0) { return -1; }
+
+    const int64_t wait = next - mpris_now();
+    // rounded up, so the dispatch isn't called just before the deadline
+    return wait <= 0 ? 0 : (int)(wait / 1000) + 1;
+}
+
+int mpris_ctl_dispatch(mpris_ctl *ctl)
+{
+    if (NULL == ctl) { return -1; }
+    if (!dbus_connection_read_write(ctl->conn, 0)) { return -1; }
+
+    bool changed = false;
+    DBusMessage *msg;
+    while (NULL != (msg = dbus_connection_pop_message(ctl->conn))) {
+        if (!ctl_handle_reply(ctl, msg)) {
+            changed |= table_handle_message(&ctl->table, ctl->conn, msg);
+        }
+        dbus_message_unref(msg);
+    }
+    const int64_t now = mpris_now();
+    ctl_expire_calls(ctl, now);
+    table_expire_loads(&ctl->table, now);
+    table_resync_positions(&ctl->table, ctl->conn);
+    // the requests for the properties are sent now, instead of when the dispatch is called again
+    dbus_connection_flush(ctl->conn);
+    return changed ? 1 : 0;
+}
@@ -2,7 +2,11 @@
  * @author Marius Orcsik <marius@habarnam.ro>
  */
 
+#define _POSIX_C_SOURCE 200809L
+
 #include <getopt.h>
+#include <poll.h>
+#include <signal.h>
 #include <stdio.h>
 #include <stdint.h>
 #include <stdbool.h>
@@ -11,7 +15,16 @@
 #include <inttypes.h>
 
 #include "sstring.h"
+#include "sescape.h"
+#include "sarena.h"
+#include "sstats.h"
+#include "shealth.h"
 #include "sdbus.h"
+#include "splayers.h"
+#include "sformat.h"
+#include "sdaemon.h"
+#include "ssnapshot.h"
+#include "shook.h"
 
 #define CMD_HELP        "help"
 #define CMD_PLAY        "play"
@@ -29,10 +42,29 @@
 
 #define CMD_LIST        "list"
 #define CMD_INFO        "info"
+#define CMD_DAEMON      "daemon"
+#define CMD_ON_CHANGE   "on-change"
 
 #define ARG_PLAYER       "--player"
 #define ARG_REPEAT_TRACK "--track"
 #define ARG_REPEAT_PLIST "--playlist"
+#define ARG_FOLLOW       "--follow"
+#define ARG_STDIN        "--stdin"
+#define ARG_TRACE        "--trace"
+#define ARG_STATS        "--stats"
+#define ARG_NO_WAIT      "--no-wait"
+#define ARG_CLEAR_QUARANTINE "--clear-quarantine"
+#define ARG_RESYNC       "--resync"
+#define ARG_JSON         "--json"
+#define ARG_NDJSON       "--ndjson"
+#define ARG_ESCAPE       "--escape"
+#define ARG_EXEC         "--exec"
+#define ARG_FIFO         "--fifo"
+#define ARG_ON           "--on"
+#define ARG_MIN_INTERVAL "--min-interval"
+
+// Ends every response in the --stdin mode, followed by the exit status of the command
+#define RESPONSE_SEPARATOR '\x1e'
 
 #define PLAYER_ACTIVE    "active"
 #define PLAYER_INACTIVE  "inactive"
@@ -40,59 +72,31 @@
 #define BOOL_ON          "on"
 #define BOOL_OFF         "off"
 
-#define INFO_DEFAULT_STATUS "%track_name - %album_name - %artist_name"
-#define INFO_FULL_STATUS    "Player name:\t" INFO_PLAYER_IDENTITY "\n" \
-"Play status:\t" INFO_PLAYBACK_STATUS "\n" \
-"Track:\t\t" INFO_TRACK_NAME "\n" \
-"Artist:\t\t" INFO_ARTIST_NAME "\n" \
-"Album:\t\t" INFO_ALBUM_NAME "\n" \
-"Album Artist:\t" INFO_ALBUM_ARTIST "\n" \
-"Art URL:\t" INFO_ART_URL "\n" \
-"Track:\t\t" INFO_TRACK_NUMBER "\n" \
-"Length:\t\t" INFO_TRACK_LENGTH "\n" \
-"Volume:\t\t" INFO_VOLUME "\n" \
-"Loop status:\t" INFO_LOOP_STATUS "\n" \
-"Shuffle:\t" INFO_SHUFFLE_MODE "\n" \
-"Position:\t" INFO_POSITION "\n" \
-"Bitrate:\t" INFO_BITRATE "\n" \
-"Comment:\t" INFO_COMMENT \
-""
-
-#define INFO_PLAYER_IDENTITY "%player_identity"
-#define INFO_PLAYER_NAME     "%player_name"
-#define INFO_TRACK_NAME      "%track_name"
-#define INFO_TRACK_NUMBER    "%track_number"
-#define INFO_TRACK_LENGTH    "%track_length"
-#define INFO_ARTIST_NAME     "%artist_name"
-#define INFO_ALBUM_NAME      "%album_name"
-#define INFO_ALBUM_ARTIST    "%album_artist"
-#define INFO_ART_URL         "%art_url"
-#define INFO_BITRATE         "%bitrate"
-#define INFO_COMMENT         "%comment"
-
-#define INFO_PLAYBACK_STATUS "%play_status"
-#define INFO_SHUFFLE_MODE    "%shuffle"
-#define INFO_VOLUME          "%volume"
-#define INFO_LOOP_STATUS     "%loop_status"
-#define INFO_POSITION        "%position"
-
-#define INFO_FULL            "%full"
-
-#define TRUE_LABEL      "true"
-#define FALSE_LABEL     "false"
-
-#define MAX_VOLUME      100.0f
-#define MIN_VOLUME        0.0f
-
 #define HELP_MESSAGE    "MPRIS control, version %s\n" \
-"Usage:\n  %s [" ARG_PLAYER " " PLAYER_ACTIVE " | " PLAYER_INACTIVE " | <name ...>] [COMMAND] - Control running MPRIS player\n" \
+"Usage:\n  %s [" ARG_PLAYER " " PLAYER_ACTIVE " | " PLAYER_INACTIVE " | <name ...>] [COMMAND ...] - Control running MPRIS player\n" \
 "\n" \
 "Options:\n" \
 ARG_PLAYER" "PLAYER_ACTIVE"\t\tExecute command only for the active player(s) (default)\n" \
 "         "PLAYER_INACTIVE"\tExecute command only for the inactive player(s)\n" \
 "         <name ...>\tExecute command only for player(s) named <name ...>\n" \
-"\n" \
-"Commands:\n"\
+ARG_FOLLOW "\t\tKeep running and print the information again every time it changes\n" \
+"\t\t\tOnly valid for the " CMD_INFO ", " CMD_STATUS " and " CMD_LIST " commands.\n" \
+ARG_JSON "\t\tPrint all the information of the players as a JSON array, instead of the format.\n" \
+ARG_NDJSON "\t\tPrint all the information of every player as a JSON object on its own line.\n" \
+ARG_ESCAPE "=<mode>\tEscape the values printed by the format, not its text, for embedding them in another language.\n" \
+"\t\t\tThe mode can be one of " ESCAPE_JSON ", " ESCAPE_SHELL ", " ESCAPE_PANGO ", " ESCAPE_XML " or " ESCAPE_CSV ".\n" \
+ARG_STDIN "\t\tRead the commands from the standard input, one per line, and execute them over a single connection.\n" \
+"\t\t\tThe output of each command is followed by a line with the ASCII record separator and its exit status.\n" \
+ARG_NO_WAIT "\t\tSend the commands to the players and exit, without waiting for their replies.\n" \
+ARG_RESYNC " <seconds>\tLoad again the position of the playing players after extrapolating it for this long.\n" \
+"\t\t\tThe default is 30 seconds.\n" \
+ARG_CLEAR_QUARANTINE "\tForget the recorded response times of the players, and call again the ones quarantined\n" \
+"\t\t\tfor not answering. It can be used without a command.\n" \
+ARG_TRACE "\t\tPrint every call made on the bus to the standard error, as a JSON line.\n" \
+ARG_STATS "\t\tPrint a summary of the calls made on the bus, for every player and method, to the standard error.\n" \
+"\n"
+
+#define HELP_COMMANDS_MESSAGE "Commands:\n"\
 "\t" CMD_HELP "\t\tThis help message\n" \
 "\n" \
 "\t" CMD_PLAY "\t\tBegin playing\n" \
@@ -122,6 +126,20 @@ ARG_PLAYER" "PLAYER_ACTIVE"\t\tExecute command only for the active player(s) (de
 "\t" CMD_INFO "\t\t<format> Display information about the current track.\n" \
 "\t\t\tThe default format is '%s'\n" \
 "\n" \
+"\t" CMD_DAEMON "\t\tRun in the background keeping the player information up to date.\n" \
+"\t\t\tWhile it is running, the other invocations forward their commands to it.\n" \
+"\n" \
+"\t" CMD_ON_CHANGE "\t<format> Keep running and run a hook every time the watched fields of a player change.\n" \
+"\t\t\tThe hook gets the format rendered for the player, the default format is the one of " CMD_INFO ".\n" \
+"\t\t" ARG_EXEC " <command>\tRun the shell command, with the format on its standard input, and the values in\n" \
+"\t\t\t\t" HOOK_ENV_PLAYER ", " HOOK_ENV_CHANGED ", " HOOK_ENV_TRACK ", " HOOK_ENV_STATUS ", " HOOK_ENV_VOLUME " and " HOOK_ENV_OUTPUT ".\n" \
+"\t\t" ARG_FIFO " <path>\tWrite the format as a line to the FIFO, when it has a reader.\n" \
+"\t\t\t\tWithout " ARG_EXEC " or " ARG_FIFO ", the format is printed.\n" \
+"\t\t" ARG_ON " <fields>\tThe fields to watch, separated by commas, among " HOOK_FIELD_TRACK ", " HOOK_FIELD_STATUS " and " HOOK_FIELD_VOLUME ".\n" \
+"\t\t\t\tThe default is " HOOK_FIELD_TRACK "," HOOK_FIELD_STATUS ".\n" \
+"\t\t" ARG_MIN_INTERVAL " <seconds>\tThe minimum time between the start of two hooks, the default is 1 second.\n" \
+"\t\t\t\tA hook never starts while the previous one is running, the changes are merged in the meantime.\n" \
+"\n" \
 "Format specifiers for " CMD_INFO " command:\n" \
 "\t%" INFO_PLAYER_IDENTITY "\tprints the player identity\n" \
 "\t%" INFO_TRACK_NAME "\tprints the track name\n" \
@@ -136,8 +154,11 @@ ARG_PLAYER" "PLAYER_ACTIVE"\t\tExecute command only for the active player(s) (de
 "\t%" INFO_VOLUME "\t\tprints the volume\n" \
 "\t%" INFO_LOOP_STATUS "\tprints the loop status\n" \
 "\t%" INFO_POSITION "\tprints the song position in seconds\n" \
+"\t%" INFO_PROGRESS "\tprints the song position as a percentage of its length\n" \
+"\t%" INFO_REMAINING "\tprints the time remaining until the end of the song\n" \
 "\t%" INFO_BITRATE "\tprints the track's bitrate\n" \
 "\t%" INFO_COMMENT "\tprints the track's comment\n" \
+"\t%" INFO_META "<key>\tprints the value of any metadata key, eg: %" INFO_META "xesam:genre\n" \
 "\t%" INFO_FULL "\t\tprints all available information\n" \
 ""
 
@@ -149,8 +170,9 @@ const char* get_version(void)
     return VERSION_HASH;
 }
 
-const char commands[15][9] = {CMD_HELP, CMD_PLAY, CMD_PAUSE, CMD_STOP, CMD_NEXT, CMD_PREVIOUS,
-    CMD_PLAY_PAUSE, CMD_RAISE, CMD_STATUS, CMD_SEEK, CMD_LIST, CMD_INFO, CMD_SHUFFLE, CMD_REPEAT, CMD_VOLUME, };
+const char commands[17][10] = {CMD_HELP, CMD_PLAY, CMD_PAUSE, CMD_STOP, CMD_NEXT, CMD_PREVIOUS,
+    CMD_PLAY_PAUSE, CMD_RAISE, CMD_STATUS, CMD_SEEK, CMD_LIST, CMD_INFO, CMD_SHUFFLE, CMD_REPEAT, CMD_VOLUME, CMD_DAEMON,
+    CMD_ON_CHANGE, };
 
 enum cmd {
     c_help,
@@ -168,20 +190,12 @@ enum cmd {
     c_repeat,
     c_volume,
     c_raise,
+    c_daemon,
+    c_on_change,
 
     c_count
 };
 
-struct ctl {
-    int status;
-    enum cmd command;
-
-    char player_names[MAX_PLAYERS][MAX_OUTPUT_LENGTH];
-    mpris_player players[MAX_PLAYERS];
-    int player_count;
-
-};
-
 int volume_change_valid(const struct volume_change v)
 {
     if (v.type == volume_change_absolute) {
@@ -232,73 +246,12 @@ void print_help(char* name)
     const char* version = get_version();
 
     const char *help_msg = HELP_MESSAGE;
+    // the commands are a separate string, as the whole help is too long for a single literal
+    const char *commands_msg = HELP_COMMANDS_MESSAGE;
     char* info_def = INFO_DEFAULT_STATUS;
 
-    fprintf(stdout, help_msg, version, name, info_def);
-}
-
-void format_nanosecond_interval(char *destination, const size_t max_len, const int64_t time_nanoseconds)
-{
-    int32_t time_seconds = time_nanoseconds / 1000000;
-    const short time_minutes = time_seconds / 60;
-    const short time_hours = time_minutes / 60;
-    const short time_days = time_hours / 24;
-    if (time_minutes > 0) {
-        if (time_hours > 0) {
-            if (time_days > 0) {
-                snprintf(destination, max_len, "%dd %dh %dm %ds", time_days, time_hours, time_minutes, time_seconds % 60);
-                return;
-            }
-            snprintf(destination, max_len, "%dh %dm %ds", time_hours, time_minutes, time_seconds % 60);
-            return;
-        }
-        snprintf(destination, max_len, "%dm %ds", time_minutes, time_seconds % 60);
-        return;
-    }
-
-    snprintf(destination, max_len, "%ds", time_seconds);
-}
-
-void print_mpris_info(const mpris_properties *props, const char* format)
-{
-    const char* info_full = INFO_FULL_STATUS;
-    const char* shuffle_label = (props->shuffle ? TRUE_LABEL : FALSE_LABEL);
-    char volume_label[8];
-    snprintf(volume_label, 8, "%.2lf%%", props->volume*MAX_VOLUME);
-    char pos_label[20];
-    format_nanosecond_interval(pos_label, 20, props->position);
-    char track_number_label[6];
-    snprintf(track_number_label, 6, "%d", props->metadata.track_number);
-    char bitrate_label[6];
-    snprintf(bitrate_label, 6, "%d", props->metadata.bitrate);
-    char length_label[20];
-    format_nanosecond_interval(length_label, 20, props->metadata.length);
-
-    char output[MAX_OUTPUT_LENGTH*10];
-    memcpy(output, format, strlen(format) + 1);
-
-    str_replace(output, "\\n", "\n");
-    str_replace(output, "\\t", "\t");
-
-    str_replace(output, INFO_FULL, info_full);
-    str_replace(output, INFO_PLAYER_NAME, props->player_name);
-    str_replace(output, INFO_PLAYER_IDENTITY, props->player_identity);
-    str_replace(output, INFO_SHUFFLE_MODE, shuffle_label);
-    str_replace(output, INFO_PLAYBACK_STATUS, props->playback_status);
-    str_replace(output, INFO_VOLUME, volume_label);
-    str_replace(output, INFO_LOOP_STATUS, props->loop_status);
-    str_replace(output, INFO_POSITION, pos_label);
-    str_replace(output, INFO_TRACK_NAME, props->metadata.title);
-    str_replace(output, INFO_ARTIST_NAME, props->metadata.artist);
-    str_replace(output, INFO_ALBUM_ARTIST, props->metadata.album_artist);
-    str_replace(output, INFO_ALBUM_NAME, props->metadata.album);
-    str_replace(output, INFO_TRACK_LENGTH, length_label);
-    str_replace(output, INFO_TRACK_NUMBER, track_number_label);
-    str_replace(output, INFO_BITRATE, bitrate_label);
-    str_replace(output, INFO_COMMENT, props->metadata.comment);
-    str_replace(output, INFO_ART_URL, props->metadata.art_url);
-
-    fprintf(stdout, "%s\n", output);
+    fprintf(stdout, help_msg, version, name);
+    fprintf(stdout, commands_msg, info_def);
 }
 
 #define DEFAULT_SKEEP_MSEC       5*1000 // 5 seconds
@@ -319,6 +272,52 @@ enum repeat_mode {
     ls_count,
 };
 
+// The maximum number of commands which can be chained in one invocation
+#define MAX_COMMANDS             16
+
+struct ctl_command {
+    enum cmd command;
+    // the name of the command, as given on the command line
+    const char *name;
+    int status;
+
+    // the arguments of the command
+    int ms;
+    const char *info_format;
+    info_template tpl;
+    enum bool_arg on_arg;
+    struct volume_change volume;
+};
+
+struct ctl {
+    int status;
+    // the commands are executed in the order they were given, the first one decides the mode
+    struct ctl_command commands[MAX_COMMANDS];
+    int command_count;
+    enum repeat_mode repeat_mode;
+
+    // the names point to the command line arguments
+    const char **player_names;
+    int player_names_count;
+    bool active_players;
+    bool inactive_players;
+    // the players, with the mask of their properties which are loaded and the resync interval of their positions
+    player_table table;
+
+    bool follow;
+    bool read_stdin;
+    enum trace_mode trace;
+    bool no_wait;
+    bool clear_quarantine;
+    enum info_output output;
+    enum escape_mode escape;
+    // the hooks of the on-change command
+    struct hooks hooks;
+
+    // the strings living as long as the command, like the names of the selected players
+    arena arena;
+};
+
 int parse_bool_argument(const char *bool_string, enum bool_arg *state)
 {
     if (strncmp(bool_string, FALSE_LABEL, strlen(FALSE_LABEL)) == 0) {
@@ -396,125 +395,652 @@ bool arg_is_command(const char *param)
     return false;
 }
 
-void load_players_flags(struct ctl *cmd, DBusConnection *conn, char *params[], int param_count, enum repeat_mode *ls)
+/**
+ * Returns true if the player is the one named, with or without the MPRIS prefix.
+ * A name also matches the instances of the player, like "vlc" for "vlc.instance42".
+ */
+bool is_named_player(const mpris_player *player, const char *player_name)
+{
+    const char *name = get_player_name(player->name);
+    if (strcmp(name, player_name) == 0 || strcmp(player->name, player_name) == 0) { return true; }
+
+    const size_t len = strlen(player_name);
+    return strncmp(name, player_name, len) == 0 && strncmp(name + len, MPRIS_INSTANCE_SUFFIX, strlen(MPRIS_INSTANCE_SUFFIX)) == 0;
+}
+
+void filter_player(const struct ctl *cmd, mpris_player *player)
+{
+    player->skip = true;
+    if (cmd->active_players && player->status == mpris_playback_playing) {
+        player->skip = false;
+    }
+
+    if (cmd->inactive_players &&
+        (player->status == mpris_playback_paused || player->status == mpris_playback_stopped)) {
+        player->skip = false;
+    }
+    // the quarantined players are only selected by name
+    if (player->quarantined) {
+        player->skip = true;
+    }
+
+    for (int i = 0; player->skip && i < cmd->player_names_count; i++) {
+        if (is_named_player(player, cmd->player_names[i])) {
+            player->skip = false;
+        }
+    }
+}
+
+bool is_info_command(const enum cmd command)
+{
+    return command == c_info || command == c_status || command == c_list;
+}
+
+/**
+ * Returns true if all the commands only print information, without calling the players.
+ */
+bool has_only_info_commands(const struct ctl *cmd)
+{
+    for (int i = 0; i < cmd->command_count; i++) {
+        if (!is_info_command(cmd->commands[i].command)) { return false; }
+    }
+    return cmd->command_count > 0;
+}
+
+/**
+ * Returns the mask of MPRIS properties the command needs to be executed.
+ * The properties needed for filtering the players are added when loading them.
+ */
+unsigned get_command_properties(const struct ctl_command *cmd)
+{
+    switch (cmd->command) {
+        case c_info:
+        case c_status:
+        case c_list:
+            return cmd->tpl.properties;
+        case c_shuffle:
+            return cmd->on_arg == b_unset ? mpris_prop_shuffle : mpris_prop_none;
+        case c_repeat:
+            return cmd->on_arg == b_unset ? mpris_prop_loop_status : mpris_prop_none;
+        case c_volume:
+            return cmd->volume.type == volume_change_relative ? mpris_prop_volume : mpris_prop_none;
+        case c_on_change:
+            return cmd->tpl.properties;
+        default:
+            return mpris_prop_none;
+    }
+}
+
+int parse_players_flags(struct ctl *cmd, char *params[], int param_count)
 {
     static struct option long_options[] = {
         {"player", required_argument, NULL, 1},
         {"help", no_argument, NULL, 2},
         {"track", no_argument, NULL, 3},
         {"playlist", no_argument, NULL, 4},
+        {"follow", no_argument, NULL, 5},
+        {"stdin", no_argument, NULL, 6},
+        {"trace", no_argument, NULL, 7},
+        {"stats", no_argument, NULL, 8},
+        {"no-wait", no_argument, NULL, 9},
+        {"clear-quarantine", no_argument, NULL, 10},
+        {"resync", required_argument, NULL, 11},
+        {"json", no_argument, NULL, 12},
+        {"ndjson", no_argument, NULL, 13},
+        {"escape", required_argument, NULL, 14},
+        {"exec", required_argument, NULL, 15},
+        {"fifo", required_argument, NULL, 16},
+        {"on", required_argument, NULL, 17},
+        {"min-interval", required_argument, NULL, 18},
         {0},
     };
 
     opterr = 0; // Skip errors
+    optind = 0; // Reset the parser, the daemon parses multiple command lines
+
+    cmd->table.resync = MPRIS_POSITION_RESYNC * 1000000L;
+    cmd->hooks.fields = hook_field_default;
+    cmd->hooks.interval = HOOK_MIN_INTERVAL * 1000000L;
+
+    // there can't be more player names than arguments
+    cmd->player_names = arena_alloc(&cmd->arena, param_count * sizeof(char*));
 
-    int player_names_count = 0;
-    bool active_players = false;
-    bool inactive_players = false;
     while (true) {
         const int char_arg = getopt_long(param_count, params, "", long_options, NULL);
         if (char_arg == -1) { break; }
         switch (char_arg) {
             case 1:
                 if (strncmp(optarg, PLAYER_ACTIVE, strlen(PLAYER_ACTIVE)) == 0) {
-                    active_players = true;
+                    cmd->active_players = true;
                     continue;
                 }
                 if (strncmp(optarg, PLAYER_INACTIVE, strlen(PLAYER_INACTIVE)) == 0) {
-                    inactive_players = true;
+                    cmd->inactive_players = true;
                     continue;
                 }
                 optind--;
-                for( ;optind < param_count && *params[optind] != '-'; optind++){
-                    optarg = params[optind];
-                    int len = strlen(optarg);
-                    memcpy(cmd->player_names[player_names_count++], optarg, MIN(MAX_OUTPUT_LENGTH - 1, len));
+                for( ;optind < param_count && *params[optind] != '-' && NULL != cmd->player_names; optind++){
+                    // like for parse_command, only the first name can start like a command
+                    if (params[optind] != optarg && arg_is_command(params[optind])) { break; }
+                    cmd->player_names[cmd->player_names_count++] = params[optind];
                 }
                 break;
             case 2:
                 // TODO(marius): I should make it that the --help argument shows the current command's help
                 // Currently we just show full help.
-                cmd->command = c_help;
+                cmd->command_count = 0;
                 break;
             case 3:
-                *ls = ls_track;
+                cmd->repeat_mode = ls_track;
                 break;
             case 4:
-                *ls = ls_playlist;
+                cmd->repeat_mode = ls_playlist;
+                break;
+            case 5:
+                cmd->follow = true;
+                break;
+            case 6:
+                cmd->read_stdin = true;
+                break;
+            case 7:
+                cmd->trace = trace_lines;
+                break;
+            case 8:
+                if (cmd->trace == trace_off) {
+                    cmd->trace = trace_stats;
+                }
+                break;
+            case 9:
+                cmd->no_wait = true;
+                break;
+            case 10:
+                cmd->clear_quarantine = true;
+                break;
+            case 11: {
+                const double seconds = strtod(optarg, NULL);
+                if (seconds > 0) {
+                    cmd->table.resync = seconds * 1000000L;
+                }
+                break;
+            }
+            case 12:
+                cmd->output = info_output_json;
+                break;
+            case 13:
+                cmd->output = info_output_ndjson;
+                break;
+            case 14:
+                if (!parse_escape_mode(optarg, &cmd->escape)) {
+                    fprintf(stderr, "Invalid escape mode '%s'.\n", optarg);
+                    return -1;
+                }
+                break;
+            case 15:
+                cmd->hooks.exec = optarg;
+                break;
+            case 16:
+                cmd->hooks.fifo = optarg;
+                break;
+            case 17:
+                if (!parse_hook_fields(optarg, &cmd->hooks.fields)) {
+                    fprintf(stderr, "Invalid fields '%s'. Use some of '" HOOK_FIELD_TRACK "', '" HOOK_FIELD_STATUS "', '"
+                        HOOK_FIELD_VOLUME "', separated by commas.\n", optarg);
+                    return -1;
+                }
                 break;
+            case 18: {
+                const double seconds = strtod(optarg, NULL);
+                if (seconds >= 0) {
+                    cmd->hooks.interval = seconds * 1000000L;
+                }
+                break;
+            }
             default:
                 break;
         }
     }
 
-    if (!active_players && !inactive_players && player_names_count == 0) {
-        active_players = true;
-        inactive_players = false;
+    if (!cmd->active_players && !cmd->inactive_players && cmd->player_names_count == 0) {
+        cmd->active_players = true;
+        cmd->inactive_players = false;
     }
 
-    cmd->player_count = load_mpris_players(conn, cmd->players);
-    for (int i = 0; i < cmd->player_count; i++) {
-        mpris_player *player = &cmd->players[i];
-        load_mpris_properties(conn, player->name, &player->properties);
-
-        player->skip = true;
-        if (active_players && (strncmp(player->properties.playback_status, MPRIS_METADATA_VALUE_PLAYING, 8) == 0)) {
-            player->skip = false;
+    cmd->table.properties = mpris_prop_none;
+    for (int i = 0; i < cmd->command_count; i++) {
+        cmd->commands[i].tpl.escape = cmd->escape;
+        cmd->table.properties |= get_command_properties(&cmd->commands[i]);
+        if (cmd->commands[i].command == c_on_change) {
+            cmd->table.properties |= HOOK_PROPERTIES;
+        }
+        if (cmd->output != info_output_text && is_info_command(cmd->commands[i].command)) {
+            // all the properties are serialized
+            cmd->table.properties |= mpris_prop_all | mpris_prop_identity;
         }
+    }
+    if (cmd->table.properties & mpris_prop_position) {
+        // the position is extrapolated only while playing
+        cmd->table.properties |= mpris_prop_playback_status;
+    }
+    const bool on_change = cmd->command_count > 0 && cmd->commands[0].command == c_on_change;
+    if ((cmd->follow || on_change) && (cmd->active_players || cmd->inactive_players)) {
+        // the players are selected again every time their playback status changes
+        cmd->table.properties |= mpris_prop_playback_status;
+    }
+    return 0;
+}
 
-        if (inactive_players &&
-            (strncmp(player->properties.playback_status, MPRIS_METADATA_VALUE_PAUSED, 7) == 0 ||
-            strncmp(player->properties.playback_status, MPRIS_METADATA_VALUE_STOPPED, 8) == 0)) {
-            player->skip = false;
+/**
+ * Quarantines the players which didn't answer in the previous invocations, before any of them is called.
+ * The players are recorded by their unique names, so these are loaded first, when any of them is in the record.
+ * When cached is set, the identities recorded for the players are used, which is only done for the
+ * tables that are not kept up to date from the signals, as the strings live in the arena.
+ */
+void check_players_health(struct ctl *cmd, DBusConnection *conn, const bool cached)
+{
+    if (!player_health.enabled) { return; }
+
+    // the owners are only compared with the recorded ones, the new players are recorded without them
+    bool recorded = false;
+    for (int i = 0; !recorded && i < cmd->table.player_count; i++) {
+        recorded = health_recorded(cmd->table.players[i].name);
+    }
+    if (recorded) {
+        load_mpris_players_owners(conn, cmd->table.players, cmd->table.player_count, &cmd->table.names);
+    }
+    for (int i = 0; i < cmd->table.player_count; i++) {
+        mpris_player *player = &cmd->table.players[i];
+        player->quarantined = health_check_player(player->name, player->unique_name);
+        if (cached) {
+            player->identity = arena_strdup(&cmd->table.names, health_identity(player->name));
         }
+    }
+}
 
-        for (int i = 0; i < player_names_count; i++) {
-            const char *player_name = cmd->player_names[i];
-            if (NULL != player_name) {
-                size_t name_len = strlen(player_name);
-                size_t prop_name_len = strlen(player->properties.player_name);
-                size_t prop_ns_len = strlen(player->name);
-                if (prop_name_len < name_len) {
-                    prop_name_len = name_len ;
-                }
-                if (prop_ns_len < name_len) {
-                    prop_ns_len = name_len;
-                }
-                if (strncmp(player->properties.player_name, player_name, prop_name_len) == 0 ||
-                   strncmp(player->name, player_name, prop_ns_len) == 0) {
-                    player->skip = false;
-                }
-            }
+/**
+ * Records the identities of the players, for the next invocations.
+ */
+void record_players_identity(const struct ctl *cmd)
+{
+    for (int i = 0; i < cmd->table.player_count; i++) {
+        const mpris_player *player = &cmd->table.players[i];
+        if (NULL == player->properties) { continue; }
+        health_set_identity(player->name, player->properties->player_identity);
+    }
+}
+
+/**
+ * Loads only the players named on the command line, when they are the only ones selected.
+ * Returns false if the whole bus needs to be listed instead.
+ */
+bool load_named_players(struct ctl *cmd, DBusConnection *conn)
+{
+    if (cmd->active_players || cmd->inactive_players) { return false; }
+
+    const int count = load_mpris_players_by_name(conn, cmd->player_names, cmd->player_names_count, &cmd->table.players, &cmd->table.player_cap, &cmd->table.names);
+    if (count < 0) { return false; }
+
+    cmd->table.player_count = count;
+    return true;
+}
+
+/**
+ * Loads the player table. The players are first selected by their name and playback status,
+ * and only then the properties needed by the command are loaded for the selected ones.
+ * When all is set, the properties are loaded for every player, as needed by a table which is
+ * kept up to date from the signals.
+ */
+void load_players(struct ctl *cmd, DBusConnection *conn, const bool all)
+{
+    if (all || !load_named_players(cmd, conn)) {
+        cmd->table.player_count = load_mpris_players(conn, &cmd->table.players, &cmd->table.player_cap, &cmd->table.names);
+    }
+    check_players_health(cmd, conn, !all);
+    unsigned properties = cmd->table.properties;
+    if (!all) {
+        if (cmd->active_players || cmd->inactive_players) {
+            load_mpris_players_status(conn, cmd->table.players, cmd->table.player_count, properties);
+            // the volume was loaded with the status, in the same round trip
+            properties &= ~mpris_prop_volume;
+        }
+        for (int i = 0; i < cmd->table.player_count; i++) {
+            filter_player(cmd, &cmd->table.players[i]);
         }
     }
+    for (int i = 0; i < cmd->table.player_count; i++) {
+        mpris_player *player = &cmd->table.players[i];
+        if ((all && !player->quarantined) || !player->skip) {
+            mpris_player_alloc_properties(player);
+        }
+        if (NULL != player->properties && (cmd->table.properties & ~properties & mpris_prop_volume)) {
+            player->properties->volume = player->volume;
+        }
+    }
+    load_mpris_players_properties(conn, cmd->table.players, cmd->table.player_count, properties);
+    record_players_identity(cmd);
+    for (int i = 0; i < cmd->table.player_count; i++) {
+        filter_player(cmd, &cmd->table.players[i]);
+    }
 }
 
-bool has_next_argument(const int argc, char** argv, const int i)
+/**
+ * Renders the information of a player in the output mode of the command.
+ * In the JSON mode the objects are separated inside the array, which the caller opens and closes.
+ */
+void render_player_info(const struct ctl *cmd, const info_template *tpl, mpris_properties *props, const bool first, sbuf *output)
 {
-    return i+1 < argc && strncmp(argv[i+1], "--", 2) != 0;
+    switch (cmd->output) {
+        case info_output_json:
+            if (!first) { sbuf_append_char(output, ','); }
+            info_render_json(props, output);
+            break;
+        case info_output_ndjson:
+            info_render_json(props, output);
+            sbuf_append_char(output, '\n');
+            break;
+        default:
+            info_template_render(tpl, props, output);
+            sbuf_append_char(output, '\n');
+            break;
+    }
 }
 
-int main(int argc, char** argv)
+/**
+ * Renders the information for all the selected players, one line for each, or a single line in the JSON mode.
+ */
+void render_players_info(const struct ctl *cmd, const info_template *tpl, sbuf *output)
 {
-    struct ctl cmd = {0};
-    cmd.status = EXIT_FAILURE;
+    sbuf_reset(output);
+    if (cmd->output == info_output_json) { sbuf_append_char(output, '['); }
+    bool first = true;
+    for (int i = 0; i < cmd->table.player_count; i++) {
+        const mpris_player *player = &cmd->table.players[i];
+        if (player->skip || NULL == player->properties) { continue; }
+
+        render_player_info(cmd, tpl, player->properties, first, output);
+        first = false;
+    }
+    if (cmd->output == info_output_json) { sbuf_append(output, "]\n", 2); }
+}
 
-    char* name = argv[0];
-    if (argc == 0) {
-        cmd.command = c_help;
-        goto _help;
+/**
+ * Updates the players from a signal message, and selects them again.
+ * The players which appeared on the bus are checked against the health record.
+ * Returns true if any of the players changed.
+ */
+bool handle_mpris_signal(struct ctl *cmd, DBusConnection *conn, DBusMessage *msg)
+{
+    const char *name = NULL;
+    const char *old_owner = NULL;
+    const char *new_owner = NULL;
+    // checked before the player is loaded, so the record of a previous owner doesn't count its replies
+    const bool appeared = is_name_owner_changed(msg, &name, &old_owner, &new_owner) && strlen(new_owner) > 0 &&
+        strncmp(name, MPRIS_PLAYER_NAMESPACE, strlen(MPRIS_PLAYER_NAMESPACE)) == 0;
+    const bool quarantined = appeared && health_check_player(name, new_owner);
+
+    if (!table_handle_message(&cmd->table, conn, msg)) { return false; }
+
+    const int index = appeared ? find_player_by_name(cmd->table.players, cmd->table.player_count, name) : -1;
+    if (index >= 0) {
+        cmd->table.players[index].quarantined = quarantined;
+    }
+    for (int i = 0; i < cmd->table.player_count; i++) {
+        filter_player(cmd, &cmd->table.players[i]);
+    }
+    return true;
+}
+
+/**
+ * Returns the time in ms until the displayed position of a playing player reaches its next second,
+ * or its position has to be loaded again, or -1 when there's no playing player whose position is displayed.
+ */
+int next_position_tick(const struct ctl *cmd, const info_template *tpl)
+{
+    if (!(tpl->properties & mpris_prop_position)) { return -1; }
+
+    const int64_t now = mpris_now();
+    int64_t next = -1;
+    for (int i = 0; i < cmd->table.player_count; i++) {
+        mpris_player *player = &cmd->table.players[i];
+        if (player->skip || NULL == player->properties) { continue; }
+        if (player->status != mpris_playback_playing || player->properties->position_time == 0) { continue; }
+
+        const double rate = player->properties->rate > 0 ? player->properties->rate : 1.0;
+        const uint64_t position = mpris_properties_position(player->properties, now);
+        const int64_t second = (1000000 - position % 1000000) / rate;
+        const int64_t resync = table_position_deadline(&cmd->table, player) - now;
+        const int64_t wait = MIN(second, resync);
+        next = next < 0 ? wait : MIN(next, wait);
     }
+    // rounded up, so we don't wake up just before the second changes
+    return next < 0 ? -1 : (int)(MAX(next, 0) / 1000) + 1;
+}
 
-    int ms = DEFAULT_SKEEP_MSEC;
-    char *info_format = NULL;
+/**
+ * Keeps the connection open and prints the information again every time the rendered output changes.
+ * The player properties are updated incrementally from the PropertiesChanged signals, and the players
+ * appearing on, or disappearing from, the bus are tracked through the NameOwnerChanged signals.
+ */
+int follow_mpris_info(struct ctl *cmd, DBusConnection *conn, const info_template *tpl)
+{
+    DBusError err = {0};
+    dbus_error_init(&err);
 
-    bool shuffle_mode = false;
-    enum bool_arg on_arg;
-    enum repeat_mode repeat_mode = {0};
-    struct volume_change volume = {0};
+    add_mpris_signal_matches(conn, &err);
+    if (dbus_error_is_set(&err)) {
+        fprintf(stderr, "error: %s\n", err.message);
+        dbus_error_free(&err);
+        return EXIT_FAILURE;
+    }
+    load_mpris_players_owners(conn, cmd->table.players, cmd->table.player_count, &cmd->table.names);
+
+    sbuf output = {0};
+    sbuf previous = {0};
+    bool changed = true;
+    do {
+        DBusMessage *msg;
+        while (NULL != (msg = dbus_connection_pop_message(conn))) {
+            changed |= handle_mpris_signal(cmd, conn, msg);
+            dbus_message_unref(msg);
+        }
+        // the extrapolated position moves without any signal
+        changed |= (tpl->properties & mpris_prop_position) != 0;
+        table_resync_positions(&cmd->table, conn);
+        trace_flush(stderr);
+        if (!changed) { continue; }
+        changed = false;
+
+        render_players_info(cmd, tpl, &output);
+        if (NULL != previous.data && output.len == previous.len && memcmp(output.data, previous.data, output.len) == 0) {
+            continue;
+        }
+        if (output.len == 0) {
+            fputc('\n', stdout);
+        } else {
+            fwrite(output.data, 1, output.len, stdout);
+        }
+        fflush(stdout);
+
+        const sbuf tmp = previous;
+        previous = output;
+        output = tmp;
+    } while (dbus_connection_read_write(conn, next_position_tick(cmd, tpl)));
+
+    sbuf_free(&output);
+    sbuf_free(&previous);
+    return EXIT_SUCCESS;
+}
 
+/**
+ * Keeps the connection open and runs the hooks every time the watched fields of a player change.
+ * The players are kept up to date from the signals like for --follow, and their fields are compared
+ * with the values they had before after every batch of signals.
+ */
+int run_on_change(struct ctl *cmd, DBusConnection *conn, const info_template *tpl)
+{
+    DBusError err = {0};
+    dbus_error_init(&err);
+
+    add_mpris_signal_matches(conn, &err);
+    if (dbus_error_is_set(&err)) {
+        fprintf(stderr, "error: %s\n", err.message);
+        dbus_error_free(&err);
+        return EXIT_FAILURE;
+    }
+    struct hooks *hooks = &cmd->hooks;
+    if (!hook_make_fifo(hooks)) {
+        fprintf(stderr, "Unable to create the FIFO '%s': %s\n", hooks->fifo, strerror(errno));
+        return EXIT_FAILURE;
+    }
+    load_mpris_players_owners(conn, cmd->table.players, cmd->table.player_count, &cmd->table.names);
+    // a hook which exits without reading its input, or a FIFO reader going away, doesn't stop us
+    signal(SIGPIPE, SIG_IGN);
+
+    for (int i = 0; i < cmd->table.player_count; i++) {
+        hook_update_player(hooks, &cmd->table.players[i], true);
+    }
+
+    sbuf output = {0};
+    do {
+        bool changed = false;
+        DBusMessage *msg;
+        while (NULL != (msg = dbus_connection_pop_message(conn))) {
+            changed |= handle_mpris_signal(cmd, conn, msg);
+            dbus_message_unref(msg);
+        }
+        trace_flush(stderr);
+        if (changed) {
+            for (int i = 0; i < cmd->table.player_count; i++) {
+                hook_update_player(hooks, &cmd->table.players[i], false);
+            }
+            hook_forget_players(hooks, cmd->table.players, cmd->table.player_count);
+        }
+
+        const int64_t now = mpris_now();
+        hook_player *next = hook_next_player(hooks, now);
+        const int index = NULL == next ? -1 : find_player_by_name(cmd->table.players, cmd->table.player_count, next->name);
+        if (index < 0) { continue; }
+
+        sbuf_reset(&output);
+        // in the JSON mode every hook gets a single object
+        render_player_info(cmd, tpl, cmd->table.players[index].properties, true, &output);
+        while (output.len > 0 && output.data[output.len - 1] == '\n') {
+            output.data[--output.len] = 0;
+        }
+        hook_run(hooks, next, NULL == output.data ? "" : output.data, output.len, now);
+    } while (dbus_connection_read_write(conn, hook_next_wait(&cmd->hooks, mpris_now())));
+
+    sbuf_free(&output);
+    return EXIT_SUCCESS;
+}
+
+bool has_next_argument(const int argc, char** argv, const int i)
+{
+    return i+1 < argc && strncmp(argv[i+1], "--", 2) != 0 && !arg_is_command(argv[i+1]);
+}
+
+/**
+ * Parses the arguments of one command, starting at the position of the command name.
+ * Returns the position of the last argument consumed, or -1 if the arguments are invalid, after printing the reason.
+ */
+int parse_command_arguments(struct ctl_command *cmd, int argc, char** argv, int i)
+{
+    char *command = argv[i];
+    cmd->name = command;
+    cmd->ms = DEFAULT_SKEEP_MSEC;
+    if (strncmp(command, CMD_SEEK, strlen(CMD_SEEK)) == 0) {
+        cmd->command = c_seek;
+        if (has_next_argument(argc, argv, i)) {
+            parse_time_argument(argv[++i], &cmd->ms);
+        }
+    } else if (strncmp(command, CMD_INFO, strlen(CMD_INFO)) == 0) {
+        cmd->command = c_info;
+        if (i+1 < argc && strncmp(argv[i+1], "--", 2) != 0) {
+            // the format can be anything, even the name of a command
+            cmd->info_format = argv[++i];
+        }
+    } else if (strncmp(command, CMD_STATUS, strlen(CMD_STATUS)) == 0) {
+        cmd->command = c_status;
+        cmd->info_format = INFO_PLAYBACK_STATUS;
+    } else if (strncmp(command, CMD_LIST, strlen(CMD_LIST)) == 0) {
+        cmd->command = c_list;
+        cmd->info_format = INFO_PLAYER_NAME;
+    } else if (strncmp(command, CMD_PLAY_PAUSE, strlen(CMD_PLAY_PAUSE)) == 0) {
+        cmd->command = c_play_pause;
+    } else if (strncmp(command, CMD_PLAY, strlen(CMD_PLAY)) == 0) {
+        cmd->command = c_play;
+    } else if (strncmp(command, CMD_PAUSE, strlen(CMD_PAUSE)) == 0) {
+        cmd->command = c_pause;
+    } else if (strncmp(command, CMD_PREVIOUS, strlen(CMD_PREVIOUS)) == 0) {
+        cmd->command = c_previous;
+    } else if (strncmp(command, CMD_RAISE, strlen(CMD_RAISE)) == 0) {
+        cmd->command = c_raise;
+    } else if (strncmp(command, CMD_NEXT, strlen(CMD_NEXT)) == 0) {
+        cmd->command = c_next;
+    } else if (strncmp(command, CMD_STOP, strlen(CMD_STOP)) == 0) {
+        cmd->command = c_stop;
+    } else if (strncmp(command, CMD_DAEMON, strlen(CMD_DAEMON)) == 0) {
+        cmd->command = c_daemon;
+    } else if (strncmp(command, CMD_ON_CHANGE, strlen(CMD_ON_CHANGE)) == 0) {
+        cmd->command = c_on_change;
+        if (i+1 < argc && strncmp(argv[i+1], "--", 2) != 0) {
+            cmd->info_format = argv[++i];
+        }
+    } else if (strncmp(command, CMD_HELP, strlen(CMD_HELP)) == 0) {
+        cmd->command = c_help;
+    } else if (strncmp(command, CMD_SHUFFLE, strlen(CMD_SHUFFLE)) == 0) {
+        cmd->command = c_shuffle;
+        if (has_next_argument(argc, argv, i)) {
+            char *state = argv[++i];
+            if (parse_bool_argument(state, &cmd->on_arg) < 0) {
+                fprintf(stderr, "Invalid shuffle argument '%s'. Use one of '" BOOL_ON "'/'" BOOL_OFF "'.\n", state);
+                return -1;
+            }
+        }
+    } else if (strncmp(command, CMD_REPEAT, strlen(CMD_REPEAT)) == 0) {
+        cmd->command = c_repeat;
+        // the mode flags can come before the state, they are parsed with the other flags
+        while (i+1 < argc && (strcmp(argv[i+1], ARG_REPEAT_TRACK) == 0 || strcmp(argv[i+1], ARG_REPEAT_PLIST) == 0)) {
+            i++;
+        }
+        if (has_next_argument(argc, argv, i)) {
+            char *state = argv[++i];
+            if (parse_bool_argument(state, &cmd->on_arg) < 0) {
+                fprintf(stderr, "Invalid repeat argument '%s'. Use one of '" BOOL_ON "'/'" BOOL_OFF "'.\n", state);
+                return -1;
+            }
+        }
+    } else if (strncmp(command, CMD_VOLUME, strlen(CMD_VOLUME)) == 0) {
+        cmd->command = c_volume;
+        if (!has_next_argument(argc, argv, i)) {
+            cmd->command = c_info;
+            cmd->info_format = INFO_VOLUME;
+            return i;
+        }
+        char *state = argv[++i];
+        if (parse_volume_argument(state, &cmd->volume) < 0) {
+            fprintf(stderr, "Invalid volume argument '%s'. Use a float value.\n", state);
+            return -1;
+        }
+        if (volume_change_valid(cmd->volume) < 0) {
+            if (cmd->volume.type == volume_change_absolute) {
+                fprintf(stderr, "Invalid volume value '%s'. Use a value between %.2f%% andd %.2f%%.\n", state, MIN_VOLUME, MAX_VOLUME);
+            } else {
+                fprintf(stderr, "Invalid volume value '%s'. Use a value less than %.2f%%.\n", state, MAX_VOLUME);
+            }
+            return -1;
+        }
+    }
+    return i;
+}
+
+/**
+ * Parses the command line arguments into the command structure.
+ * Returns -1 if the arguments are invalid, after printing the reason.
+ */
+int parse_command(struct ctl *cmd, int argc, char** argv)
+{
     /**
-     * First we go through the arguments to determine the command
+     * First we go through the arguments to determine the commands, which are executed in order.
      * For particular commands we get the parameters that are relevant to it:
      *  * "seek" needs the amount of time units to skeep ahead or behind (if negative)
      *  * "info" needs the string format
@@ -523,88 +1049,590 @@ int main(int argc, char** argv)
      * MPRIS namespaces, or player names, together with the "active"/"inactive" special values.
      */
     for (int i = 1; i < argc; i++) {
-        if (arg_is_command(argv[i])) {
-            char *command = argv[i];
-            if (strncmp(command, CMD_SEEK, strlen(CMD_SEEK)) == 0) {
-                cmd.command = c_seek;
-                if (has_next_argument(argc, argv, i)) {
-                    parse_time_argument(argv[++i], &ms);
-                }
-            } else if (strncmp(command, CMD_INFO, strlen(CMD_INFO)) == 0) {
-                cmd.command = c_info;
-                if (has_next_argument(argc, argv, i)) {
-                    info_format = argv[i+1];
-                    i++;
-                }
-            } else if (strncmp(command, CMD_STATUS, strlen(CMD_STATUS)) == 0) {
-                cmd.command = c_status;
-                info_format = INFO_PLAYBACK_STATUS;
-            } else if (strncmp(command, CMD_LIST, strlen(CMD_LIST)) == 0) {
-                cmd.command = c_list;
-                info_format = INFO_PLAYER_NAME;
-            } else if (strncmp(command, CMD_PLAY_PAUSE, strlen(CMD_PLAY_PAUSE)) == 0) {
-                cmd.command = c_play_pause;
-            } else if (strncmp(command, CMD_PLAY, strlen(CMD_PLAY)) == 0) {
-                cmd.command = c_play;
-            } else if (strncmp(command, CMD_PAUSE, strlen(CMD_PAUSE)) == 0) {
-                cmd.command = c_pause;
-            } else if (strncmp(command, CMD_PREVIOUS, strlen(CMD_PREVIOUS)) == 0) {
-                cmd.command = c_previous;
-            } else if (strncmp(command, CMD_RAISE, strlen(CMD_RAISE)) == 0) {
-                cmd.command = c_raise;
-            } else if (strncmp(command, CMD_NEXT, strlen(CMD_NEXT)) == 0) {
-                cmd.command = c_next;
-            } else if (strncmp(command, CMD_STOP, strlen(CMD_STOP)) == 0) {
-                cmd.command = c_stop;
-            } else if (strncmp(command, CMD_SHUFFLE, strlen(CMD_SHUFFLE)) == 0) {
-                cmd.command = c_shuffle;
-                if (has_next_argument(argc, argv, i)) {
-                    char *state = argv[++i];
-                    if (parse_bool_argument(state, &on_arg) < 0) {
-                        fprintf(stderr, "Invalid shuffle argument '%s'. Use one of '" BOOL_ON "'/'" BOOL_OFF "'.\n", state);
-                        goto _exit;
-                    }
-                }
-            } else if (strncmp(command, CMD_REPEAT, strlen(CMD_REPEAT)) == 0) {
-                cmd.command = c_repeat;
-                if (has_next_argument(argc, argv, i)) {
-                    char *state = argv[++i];
-                    if (parse_bool_argument(state, &on_arg) < 0) {
-                        fprintf(stderr, "Invalid repeat argument '%s'. Use one of '" BOOL_ON "'/'" BOOL_OFF "'.\n", state);
-                        goto _exit;
-                    }
-                }
-            } else if (strncmp(command, CMD_VOLUME, strlen(CMD_VOLUME)) == 0) {
-                cmd.command = c_volume;
-                if (!has_next_argument(argc, argv, i)) {
-                    cmd.command = c_info;
-                    info_format = INFO_VOLUME;
-                    break;
-                }
-                char *state = argv[++i];
-                if (parse_volume_argument(state, &volume) < 0) {
-                    fprintf(stderr, "Invalid volume argument '%s'. Use a float value.\n", state);
-                    goto _exit;
+        if (strcmp(argv[i], ARG_PLAYER) == 0) {
+            // the name of the player can start like a command
+            i++;
+            continue;
+        }
+        if (strcmp(argv[i], ARG_EXEC) == 0 || strcmp(argv[i], ARG_FIFO) == 0) {
+            // and so can the command, or the path, of a hook
+            i++;
+            continue;
+        }
+        if (!arg_is_command(argv[i])) { continue; }
+
+        if (cmd->command_count == MAX_COMMANDS) {
+            fprintf(stderr, "Too many commands, at most %d can be chained.\n", MAX_COMMANDS);
+            return -1;
+        }
+        struct ctl_command *command = &cmd->commands[cmd->command_count++];
+        i = parse_command_arguments(command, argc, argv, i);
+        if (i < 0) {
+            return -1;
+        }
+        if ((command->command == c_info || command->command == c_on_change) && NULL == command->info_format) {
+            command->info_format = INFO_DEFAULT_STATUS;
+        }
+        info_template_compile(&command->tpl, command->info_format);
+    }
+
+    return parse_players_flags(cmd, argv, argc);
+}
+
+/**
+ * Returns the command deciding how the invocation runs, help if none was given.
+ */
+enum cmd get_main_command(const struct ctl *cmd)
+{
+    return cmd->command_count > 0 ? cmd->commands[0].command : c_help;
+}
+
+void free_command(struct ctl *cmd)
+{
+    for (int i = 0; i < MAX_COMMANDS; i++) {
+        info_template_free(&cmd->commands[i].tpl);
+    }
+    hooks_free(&cmd->hooks);
+    arena_free(&cmd->arena);
+}
+
+void free_players(struct ctl *cmd)
+{
+    table_free(&cmd->table);
+}
+
+/**
+ * Builds the message calling the player for one command.
+ * Returns NULL for the commands which don't call the players.
+ */
+DBusMessage* build_command_request(const struct ctl *cmd, const struct ctl_command *command, const mpris_player *player)
+{
+    if (command->command == c_seek) {
+        return seek_request(player->name, command->ms);
+    }
+    if (command->command == c_shuffle) {
+        bool shuffle_mode = false;
+        if (command->on_arg == b_unset) {
+            shuffle_mode = !player->properties->shuffle;
+        } else if (command->on_arg == b_on) {
+            shuffle_mode = true;
+        } else if (command->on_arg == b_off) {
+            shuffle_mode = false;
+        }
+        return shuffle_request(player->name, shuffle_mode);
+    }
+    if (command->command == c_repeat) {
+        const char* state;
+        if (command->on_arg == b_on) {
+            if (cmd->repeat_mode == ls_track) {
+                state = MPRIS_LOOPSTATUS_VALUE_TRACK;
+            } else {
+                state = MPRIS_LOOPSTATUS_VALUE_PLAYLIST;
+            }
+        } else if (command->on_arg == b_off) {
+            state = MPRIS_LOOPSTATUS_VALUE_NONE;
+        } else {
+            if (NULL == player->properties->loop_status ||
+                strncmp(player->properties->loop_status, MPRIS_LOOPSTATUS_VALUE_NONE, strlen(MPRIS_LOOPSTATUS_VALUE_NONE)) != 0) {
+                state = MPRIS_LOOPSTATUS_VALUE_NONE;
+            } else {
+                if (cmd->repeat_mode == ls_track) {
+                    state = MPRIS_LOOPSTATUS_VALUE_TRACK;
+                } else {
+                    state = MPRIS_LOOPSTATUS_VALUE_PLAYLIST;
                 }
-                if (volume_change_valid(volume) < 0) {
-                    if (volume.type == volume_change_absolute) {
-                        fprintf(stderr, "Invalid volume value '%s'. Use a value between %.2f%% andd %.2f%%.\n", state, MIN_VOLUME, MAX_VOLUME);
-                    } else {
-                        fprintf(stderr, "Invalid volume value '%s'. Use a value less than %.2f%%.\n", state, MAX_VOLUME);
-                    }
-                    goto _exit;
+            }
+        }
+        return loop_status_request(player->name, state);
+    }
+    if (command->command == c_volume) {
+        double abs_volume = command->volume.value / MAX_VOLUME;
+        if (command->volume.type == volume_change_relative) {
+            abs_volume += player->properties->volume;
+        }
+        return volume_request(player->name, abs_volume);
+    }
+
+    const char *method = get_dbus_method(command->command);
+    if (NULL == method) { return NULL; }
+
+    const char* interface = MPRIS_MEDIA_PLAYER_PLAYER_INTERFACE;
+    if (command->command == c_raise) {
+        interface = MPRIS_MEDIA_PLAYER_INTERFACE;
+    }
+    return dbus_message_new_method_call(player->name, MPRIS_PLAYER_PATH, interface, method);
+}
+
+/**
+ * Executes the commands for the selected players, the information output and the errors
+ * are appended to the respective buffers.
+ * The calls to the players for all the commands are sent before waiting for any reply, the
+ * messages sent to a player are delivered in order, so the commands are applied in sequence.
+ * A command succeeds if it succeeded for any of the players, with no_wait the calls don't get
+ * a reply, and succeed as soon as they are queued.
+ * Returns the exit status, which is a failure if any of the commands failed.
+ */
+int execute_command(struct ctl *cmd, DBusConnection *conn, sbuf *out, sbuf *err)
+{
+    if (NULL == get_dbus_method(get_main_command(cmd))) {
+        return cmd->status;
+    }
+    if (cmd->table.player_count == 0) {
+        sbuf_append_str(err, "No players found.\n");
+        return cmd->status;
+    }
+
+    DBusPendingCall **pending = calloc(cmd->command_count * cmd->table.player_count, sizeof(DBusPendingCall*));
+    if (NULL == pending) {
+        return cmd->status;
+    }
+
+    for (int c = 0; c < cmd->command_count; c++) {
+        struct ctl_command *command = &cmd->commands[c];
+        command->status = EXIT_FAILURE;
+
+        const bool json_array = cmd->output == info_output_json && is_info_command(command->command);
+        if (json_array) { sbuf_append_char(out, '['); }
+        for (int i = 0; i < cmd->table.player_count; i++) {
+            const mpris_player *player = &cmd->table.players[i];
+            if (player->skip) {
+                if (cmd->player_names_count > 0) continue;
+                // the quarantined players are only called when named, even to be started
+                if (player->quarantined) continue;
+                if (command->command != c_play && command->command != c_raise) continue;
+            }
+
+            if (is_info_command(command->command)) {
+                render_player_info(cmd, &command->tpl, player->properties, command->status != EXIT_SUCCESS, out);
+                command->status = EXIT_SUCCESS;
+                continue;
+            }
+            DBusMessage *msg = build_command_request(cmd, command, player);
+            if (NULL == msg) { continue; }
+
+            if (cmd->no_wait) {
+                // the command succeeds as soon as it's queued for sending
+                if (send_dbus_message_no_reply(conn, msg)) {
+                    command->status = EXIT_SUCCESS;
                 }
+            } else {
+                pending[c * cmd->table.player_count + i] = send_dbus_message(conn, msg);
+            }
+            dbus_message_unref(msg);
+        }
+        if (json_array) { sbuf_append(out, "]\n", 2); }
+    }
+    if (NULL != conn) {
+        dbus_connection_flush(conn);
+    }
+
+    cmd->status = EXIT_SUCCESS;
+    for (int c = 0; c < cmd->command_count; c++) {
+        struct ctl_command *command = &cmd->commands[c];
+        for (int i = 0; i < cmd->table.player_count; i++) {
+            DBusMessage *reply = wait_dbus_reply(pending[c * cmd->table.player_count + i]);
+            if (NULL == reply) { continue; }
+
+            if (check_dbus_reply(reply, cmd->table.players[i].name, err)) {
+                command->status = EXIT_SUCCESS;
+            }
+            dbus_message_unref(reply);
+            trace_reply_decoded();
+        }
+        if (command->status != EXIT_SUCCESS) {
+            cmd->status = EXIT_FAILURE;
+            if (cmd->command_count > 1) {
+                sbuf_append_str(err, "Command '");
+                sbuf_append_str(err, command->name);
+                sbuf_append_str(err, "' failed.\n");
+            }
+        }
+    }
+    free(pending);
+    return cmd->status;
+}
+
+volatile sig_atomic_t daemon_running = true;
+
+void stop_daemon(int signal)
+{
+    (void)signal;
+    daemon_running = false;
+}
+
+/**
+ * Updates the player table from the signals received so far.
+ * Returns true if any of the players changed.
+ */
+bool dispatch_mpris_signals(struct ctl *table, DBusConnection *conn)
+{
+    bool changed = false;
+    DBusMessage *msg;
+    while (NULL != (msg = dbus_connection_pop_message(conn))) {
+        changed |= handle_mpris_signal(table, conn, msg);
+        dbus_message_unref(msg);
+    }
+    trace_flush(stderr);
+    return changed;
+}
+
+/**
+ * Executes a command line against a player table which is kept up to date from the signals.
+ * Returns the exit status of the command.
+ */
+int execute_table_command(struct ctl *table, DBusConnection *conn, int argc, char **argv, sbuf *out, sbuf *err)
+{
+    struct ctl cmd = {0};
+    cmd.status = EXIT_FAILURE;
+    if (parse_command(&cmd, argc, argv) == 0) {
+        cmd.table.players = table->table.players;
+        cmd.table.player_count = table->table.player_count;
+
+        // the position is not signaled by the players, so it's the only property which can be stale
+        cmd.table.resync = MIN(cmd.table.resync, table->table.resync);
+        cmd.table.resynced = table->table.resynced;
+        table_resync_positions(&cmd.table, conn);
+        table->table.resynced = cmd.table.resynced;
+        for (int i = 0; i < cmd.table.player_count; i++) {
+            filter_player(&cmd, &cmd.table.players[i]);
+        }
+        execute_command(&cmd, conn, out, err);
+    }
+    free_command(&cmd);
+    trace_flush(stderr);
+    return cmd.status;
+}
+
+/**
+ * Loads all the players, with all their properties, and subscribes to the signals needed
+ * to keep them up to date.
+ */
+bool load_player_table(struct ctl *table, DBusConnection *conn)
+{
+    DBusError err = {0};
+    dbus_error_init(&err);
+    add_mpris_signal_matches(conn, &err);
+    if (dbus_error_is_set(&err)) {
+        fprintf(stderr, "error: %s\n", err.message);
+        dbus_error_free(&err);
+        return false;
+    }
+
+    table->table.properties = mpris_prop_all | mpris_prop_identity;
+    table->active_players = true;
+    table->inactive_players = true;
+    load_players(table, conn, true);
+    load_mpris_players_owners(conn, table->table.players, table->table.player_count, &table->table.names);
+    return true;
+}
+
+/**
+ * Executes a command received from a client against the player table maintained by the daemon.
+ */
+void serve_daemon_client(struct ctl *table, DBusConnection *conn, const int client)
+{
+    sbuf request = {0};
+    sbuf out = {0};
+    sbuf err = {0};
+
+    char *argv[DAEMON_MAX_ARGS+1] = {0};
+    const int argc = read_daemon_request(client, &request, argv);
+    if (argc < 0) { goto _free; }
+
+    const int status = execute_table_command(table, conn, argc, argv, &out, &err);
+    send_daemon_response(client, status, &out, &err);
+
+_free:
+    sbuf_free(&request);
+    sbuf_free(&out);
+    sbuf_free(&err);
+}
+
+/**
+ * Runs the resident daemon: the player table is loaded once and then kept up to date from the
+ * D-Bus signals, while the commands forwarded by the clients on the unix socket are executed against it.
+ * Every change of the table is also published to the shared memory snapshot.
+ */
+int run_daemon(struct ctl *table, DBusConnection *conn)
+{
+    char path[MAX_OUTPUT_LENGTH];
+    if (!get_daemon_socket_path(path, MAX_OUTPUT_LENGTH)) {
+        fprintf(stderr, "Unable to determine the socket path, XDG_RUNTIME_DIR is not set.\n");
+        return EXIT_FAILURE;
+    }
+    const int listen_fd = daemon_listen(path);
+    if (listen_fd < 0) {
+        fprintf(stderr, "Unable to listen on '%s': %s\n", path, strerror(errno));
+        return EXIT_FAILURE;
+    }
+
+    if (!load_player_table(table, conn)) {
+        close(listen_fd);
+        unlink(path);
+        return EXIT_FAILURE;
+    }
+
+    // the snapshot is an optimization, the daemon works without it
+    char snapshot_path[MAX_OUTPUT_LENGTH];
+    snapshot snap = { .fd = -1 };
+    if (get_snapshot_path(snapshot_path, MAX_OUTPUT_LENGTH) && snapshot_open_writer(&snap, snapshot_path)) {
+        snapshot_publish(&snap, table->table.players, table->table.player_count);
+    }
+
+    int dbus_fd = -1;
+    dbus_connection_get_unix_fd(conn, &dbus_fd);
+
+    struct sigaction action = {0};
+    action.sa_handler = stop_daemon;
+    sigaction(SIGINT, &action, NULL);
+    sigaction(SIGTERM, &action, NULL);
+    signal(SIGPIPE, SIG_IGN);
+
+    while (daemon_running) {
+        // process the messages libdbus has already read before waiting for new ones
+        if (dispatch_mpris_signals(table, conn)) {
+            snapshot_publish(&snap, table->table.players, table->table.player_count);
+        }
+        dbus_connection_flush(conn);
+
+        struct pollfd fds[2] = {
+            { .fd = dbus_fd, .events = POLLIN },
+            { .fd = listen_fd, .events = POLLIN },
+        };
+        if (poll(fds, 2, -1) < 0) {
+            if (errno == EINTR) { continue; }
+            break;
+        }
+        if (fds[0].revents & (POLLHUP | POLLERR)) {
+            break;
+        }
+        if (fds[0].revents & POLLIN) {
+            if (!dbus_connection_read_write(conn, 0)) { break; }
+        }
+        if (fds[1].revents & POLLIN) {
+            const int client = daemon_accept(listen_fd);
+            if (client >= 0) {
+                serve_daemon_client(table, conn, client);
+                close(client);
+                // the command may have loaded the positions again
+                snapshot_publish(&snap, table->table.players, table->table.player_count);
             }
         }
     }
-    if (cmd.command == c_info && NULL == info_format) {
-        info_format = INFO_DEFAULT_STATUS;
+
+    snapshot_close_writer(&snap, snapshot_path);
+    close(listen_fd);
+    unlink(path);
+    return EXIT_SUCCESS;
+}
+
+/**
+ * Executes a line read from the standard input, and writes its output followed by the separator.
+ */
+void execute_stdin_line(struct ctl *table, DBusConnection *conn, char *name, char *line)
+{
+    sbuf out = {0};
+    sbuf err = {0};
+
+    char *argv[DAEMON_MAX_ARGS+1] = {name};
+    const int argc = split_command_line(line, argv + 1, DAEMON_MAX_ARGS - 1) + 1;
+
+    int status = EXIT_FAILURE;
+    if (argc > 1) {
+        status = execute_table_command(table, conn, argc, argv, &out, &err);
+    }
+    fwrite(err.data, 1, err.len, stderr);
+    fflush(stderr);
+    fwrite(out.data, 1, out.len, stdout);
+    fprintf(stdout, "%c%d\n", RESPONSE_SEPARATOR, status);
+    fflush(stdout);
+
+    sbuf_free(&out);
+    sbuf_free(&err);
+}
+
+/**
+ * Runs as a co-process: the commands are read from the standard input, one per line, using the
+ * same syntax as the command line, and executed against a player table which is kept up to date
+ * from the signals, over a single connection.
+ */
+int run_stdin_commands(struct ctl *table, DBusConnection *conn, char *name)
+{
+    if (!load_player_table(table, conn)) {
+        return EXIT_FAILURE;
+    }
+
+    int dbus_fd = -1;
+    dbus_connection_get_unix_fd(conn, &dbus_fd);
+
+    sbuf input = {0};
+    bool input_open = true;
+    while (input_open) {
+        dispatch_mpris_signals(table, conn);
+        dbus_connection_flush(conn);
+
+        struct pollfd fds[2] = {
+            { .fd = dbus_fd, .events = POLLIN },
+            { .fd = STDIN_FILENO, .events = POLLIN },
+        };
+        if (poll(fds, 2, -1) < 0) {
+            if (errno == EINTR) { continue; }
+            break;
+        }
+        if (fds[0].revents & (POLLHUP | POLLERR)) {
+            break;
+        }
+        if (fds[0].revents & POLLIN) {
+            if (!dbus_connection_read_write(conn, 0)) { break; }
+            dispatch_mpris_signals(table, conn);
+        }
+        if (!(fds[1].revents & (POLLIN | POLLHUP | POLLERR))) { continue; }
+
+        char chunk[MAX_OUTPUT_LENGTH];
+        const ssize_t loaded = read(STDIN_FILENO, chunk, sizeof(chunk));
+        if (loaded < 0 && errno == EINTR) { continue; }
+        if (loaded <= 0) {
+            // the last line doesn't need to be terminated
+            input_open = false;
+            if (input.len > 0) {
+                sbuf_append_char(&input, '\n');
+            }
+        } else {
+            sbuf_append(&input, chunk, loaded);
+        }
+
+        size_t start = 0;
+        char *end = NULL;
+        while (start < input.len && NULL != (end = memchr(input.data + start, '\n', input.len - start))) {
+            *end = 0;
+            // the lines read together see the changes made by the previous ones, like the ones read separately
+            if (!dbus_connection_read_write(conn, 0)) { input_open = false; }
+            dispatch_mpris_signals(table, conn);
+            execute_stdin_line(table, conn, name, input.data + start);
+            start = end - input.data + 1;
+        }
+        memmove(input.data, input.data + start, input.len - start);
+        input.len -= start;
+    }
+    sbuf_free(&input);
+    return EXIT_SUCCESS;
+}
+
+/**
+ * Executes the information commands against the snapshot published by the daemon, without
+ * connecting to D-Bus or to the daemon.
+ * Returns false if the command can't be served from the snapshot.
+ */
+bool execute_from_snapshot(struct ctl *cmd)
+{
+    if (!has_only_info_commands(cmd)) { return false; }
+    // only the known metadata fields are published
+    if (cmd->table.properties & mpris_prop_metadata_keys) { return false; }
+
+    char path[MAX_OUTPUT_LENGTH];
+    if (!get_snapshot_path(path, MAX_OUTPUT_LENGTH)) { return false; }
+
+    const int count = snapshot_load(path, &cmd->table.players, &cmd->table.player_cap, &cmd->table.names);
+    if (count < 0) { return false; }
+
+    cmd->table.player_count = count;
+    // the positions are extrapolated like the daemon does, but only the daemon can load them again
+    if (table_has_stale_position(&cmd->table, mpris_now())) {
+        for (int i = 0; i < cmd->table.player_count; i++) {
+            mpris_player_free(&cmd->table.players[i]);
+        }
+        cmd->table.player_count = 0;
+        return false;
+    }
+    for (int i = 0; i < cmd->table.player_count; i++) {
+        filter_player(cmd, &cmd->table.players[i]);
+    }
+
+    sbuf out = {0};
+    sbuf errors = {0};
+    execute_command(cmd, NULL, &out, &errors);
+    fwrite(out.data, 1, out.len, stdout);
+    fwrite(errors.data, 1, errors.len, stderr);
+    sbuf_free(&out);
+    sbuf_free(&errors);
+    return true;
+}
+
+/**
+ * Forwards the command to a running daemon, if there is one.
+ * Returns false if no daemon is listening, or it didn't execute the command in time, in which case
+ * the command should be executed directly.
+ */
+bool forward_to_daemon(int argc, char **argv, int *status)
+{
+    char path[MAX_OUTPUT_LENGTH];
+    if (!get_daemon_socket_path(path, MAX_OUTPUT_LENGTH)) { return false; }
+
+    const int fd = daemon_connect(path);
+    if (fd < 0) { return false; }
+
+    // a daemon which doesn't answer, as it's stuck or busy with another client, is bypassed
+    int exit_status = EXIT_FAILURE;
+    if (!send_daemon_request(fd, argc, argv) || !read_daemon_status(fd, &exit_status)) {
+        close(fd);
+        return false;
+    }
+
+    sbuf out = {0};
+    sbuf err = {0};
+    *status = exit_status;
+    if (read_daemon_output(fd, &out, &err)) {
+        fwrite(out.data, 1, out.len, stdout);
+        fwrite(err.data, 1, err.len, stderr);
+    } else {
+        fprintf(stderr, "Invalid response from the daemon on '%s'.\n", path);
     }
+    close(fd);
+    sbuf_free(&out);
+    sbuf_free(&err);
+    return true;
+}
 
-    if (cmd.command == c_help) {
+int main(int argc, char** argv)
+{
+    struct ctl cmd = {0};
+    cmd.status = EXIT_FAILURE;
+
+    char* name = argv[0];
+    char **args = NULL;
+    if (argc == 0) {
         goto _help;
     }
 
+    // getopt_long permutes the arguments, the daemon needs to receive them in the original order
+    args = calloc(argc, sizeof(char*));
+    if (NULL == args) {
+        goto _exit;
+    }
+    memcpy(args, argv, argc * sizeof(char*));
+
+    if (parse_command(&cmd, argc, args) < 0) {
+        goto _free_command;
+    }
+    const enum cmd main_command = get_main_command(&cmd);
+    if (cmd.clear_quarantine && !health_clear()) {
+        fprintf(stderr, "Unable to clear the record of the players.\n");
+        goto _free_command;
+    }
+    if (main_command == c_help && cmd.clear_quarantine) {
+        cmd.status = EXIT_SUCCESS;
+        goto _free_command;
+    }
+    if (main_command == c_help && !cmd.read_stdin) {
+        goto _help;
+    }
+    // the calls are traced only when they are made by this process
+    if (main_command != c_daemon && main_command != c_on_change && !cmd.follow && !cmd.read_stdin && cmd.trace == trace_off) {
+        if (execute_from_snapshot(&cmd) || forward_to_daemon(argc, argv, &cmd.status)) {
+            goto _free_command;
+        }
+    }
+
     // initialise the errors
     DBusError err = {0};
     dbus_error_init(&err);
@@ -616,104 +1644,59 @@ int main(int argc, char** argv)
         dbus_error_free(&err);
     }
     if (NULL == conn) {
-        goto _exit;
+        goto _free_command;
     }
-    load_players_flags(&cmd, conn, argv, argc, &repeat_mode);
-    if (dbus_error_is_set(&err)) {
-        fprintf(stderr, "error: %s\n", err.message);
-        dbus_error_free(&err);
+    trace_start(cmd.trace);
+
+    char health_path[MAX_OUTPUT_LENGTH];
+    const bool health = get_health_path(health_path, MAX_OUTPUT_LENGTH);
+    if (health) {
+        health_load(health_path);
     }
 
-    char *dbus_method = (char*)get_dbus_method(cmd.command);
-    if (NULL == dbus_method) {
-        goto _exit;
+    if (cmd.read_stdin) {
+        cmd.status = run_stdin_commands(&cmd, conn, name);
+        goto _free;
     }
-    if (cmd.player_count == 0) {
-        fprintf(stderr, "No players found.\n");
-        goto _exit;
+    if (main_command == c_daemon) {
+        cmd.status = run_daemon(&cmd, conn);
+        goto _free;
     }
 
-    for (int i = 0; i < cmd.player_count; i++) {
-        mpris_player player = cmd.players[i];
-        if (player.skip) {
-            if (cmd.player_names[0][0] != 0) continue;
-            if (cmd.command != c_play && cmd.command != c_raise) continue;
-        }
-
-        if (cmd.command == c_info || cmd.command == c_status || cmd.command == c_list) {
-            print_mpris_info(&player.properties, info_format);
-            cmd.status = EXIT_SUCCESS;
-        } else if (cmd.command == c_seek) {
-            if (seek(conn, player, ms) > 0) {
-                cmd.status = EXIT_SUCCESS;
-            }
-        } else if (cmd.command == c_shuffle) {
-            if (on_arg == b_unset) {
-                shuffle_mode = !player.properties.shuffle;
-            } else if (on_arg == b_on) {
-                shuffle_mode = true;
-            } else if (on_arg == b_off) {
-                shuffle_mode = false;
-            }
-            if (shuffle(conn, player, &shuffle_mode) > 0) {
-                cmd.status = EXIT_SUCCESS;
-            }
-        } else if (cmd.command == c_repeat) {
-            const char* state;
-            if (on_arg == b_on) {
-                if (repeat_mode == ls_track) {
-                    state = MPRIS_LOOPSTATUS_VALUE_TRACK;
-                } else {
-                    state = MPRIS_LOOPSTATUS_VALUE_PLAYLIST;
-                }
-            } else if (on_arg == b_off) {
-                state = MPRIS_LOOPSTATUS_VALUE_NONE;
-            } else {
-                if (strncmp(player.properties.loop_status, MPRIS_LOOPSTATUS_VALUE_NONE, strlen(MPRIS_LOOPSTATUS_VALUE_NONE)) != 0) {
-                    state = MPRIS_LOOPSTATUS_VALUE_NONE;
-                } else {
-                    if (repeat_mode == ls_track) {
-                        state = MPRIS_LOOPSTATUS_VALUE_TRACK;
-                    } else {
-                        state = MPRIS_LOOPSTATUS_VALUE_PLAYLIST;
-                    }
-                }
-            }
-            if (set_loopstatus(conn, player, state) > 0) {
-                cmd.status = EXIT_SUCCESS;
-            }
-        } else if (cmd.command == c_volume) {
-            double abs_volume = volume.value / MAX_VOLUME;
-            if (volume.type == volume_change_relative) {
-                abs_volume += player.properties.volume;
-            }
-            if (set_volume(conn, player, abs_volume) > 0) {
-                cmd.status = EXIT_SUCCESS;
-            }
-        } else {
-            const char* interface = MPRIS_MEDIA_PLAYER_PLAYER_INTERFACE;
-            if (cmd.command == c_raise) {
-                interface = MPRIS_MEDIA_PLAYER_INTERFACE;
-            }
-            DBusMessage *msg = call_dbus_method(conn, player.name, MPRIS_PLAYER_PATH, interface, dbus_method);
-            if (NULL != msg) {
-                cmd.status = EXIT_SUCCESS;
-            }
-        }
-        if (dbus_error_is_set(&err)) {
-            fprintf(stderr, "error: %s\n", err.message);
-            dbus_error_free(&err);
-        }
+    const bool follow = cmd.follow && cmd.command_count == 1 && is_info_command(main_command);
+    load_players(&cmd, conn, follow || main_command == c_on_change);
+    if (follow) {
+        cmd.status = follow_mpris_info(&cmd, conn, &cmd.commands[0].tpl);
+        goto _free;
+    }
+    if (main_command == c_on_change) {
+        cmd.status = run_on_change(&cmd, conn, &cmd.commands[0].tpl);
+        goto _free;
     }
 
-    if (NULL != conn) {
-        dbus_connection_close(conn);
-        dbus_connection_unref(conn);
+    sbuf out = {0};
+    sbuf errors = {0};
+    execute_command(&cmd, conn, &out, &errors);
+    fwrite(out.data, 1, out.len, stdout);
+    fwrite(errors.data, 1, errors.len, stderr);
+    sbuf_free(&out);
+    sbuf_free(&errors);
+
+_free:
+    trace_report(stderr);
+    if (health) {
+        health_save(health_path);
     }
+    health_free();
+    dbus_connection_close(conn);
+    dbus_connection_unref(conn);
+_free_command:
+    free_players(&cmd);
+    free_command(&cmd);
+    free(args);
 _exit:
     return cmd.status;
 _help:
     print_help(name);
-    goto _exit;
+    goto _free_command;
 }
-
@@ -0,0 +1,178 @@
+/**
+ * @author Marius Orcsik <marius@habarnam.ro>
+ */
+
+#ifndef MPRIS_CTL_H
+#define MPRIS_CTL_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * The public interface of libmpris-ctl, the player layer of mpris-ctl as a library.
+ *
+ * A context holds a private connection to the session bus and the table of the MPRIS players on it,
+ * which is kept up to date from the signals of the players, as long as mpris_ctl_dispatch() is called
+ * when the file descriptor of the context is readable. The information of the players is read through
+ * snapshots, which are copies owned by the caller, so they stay valid while the table changes.
+ * The commands are sent without waiting for the players, their replies are collected by the dispatch.
+ *
+ * The context isn't thread safe, all the calls for a context have to be made from the same thread.
+ *
+ * The API version is increased when anything is added. The structures are only extended at their
+ * end, and they are only handed out as pointers, so the programs built for an older version keep working.
+ */
+#define MPRIS_CTL_API_VERSION 1
+
+#if defined(__GNUC__)
+#define MPRIS_CTL_API __attribute__((visibility("default")))
+#else
+#define MPRIS_CTL_API
+#endif
+
+typedef struct mpris_ctl mpris_ctl;
+typedef struct mpris_ctl_snapshot mpris_ctl_snapshot;
+
+enum mpris_ctl_command {
+    mpris_ctl_play,
+    mpris_ctl_pause,
+    mpris_ctl_stop,
+    mpris_ctl_play_pause,
+    mpris_ctl_next,
+    mpris_ctl_previous,
+    mpris_ctl_raise,
+    // the value is the offset in milliseconds, negative to seek backwards
+    mpris_ctl_seek,
+    // the value is the volume, between 0 and 1
+    mpris_ctl_volume,
+    // the value is 0 to turn the shuffle off, anything else to turn it on
+    mpris_ctl_shuffle,
+    // the value is one of the mpris_ctl_loop modes
+    mpris_ctl_loop,
+};
+
+enum mpris_ctl_loop {
+    mpris_ctl_loop_none,
+    mpris_ctl_loop_track,
+    mpris_ctl_loop_playlist,
+};
+
+/**
+ * The information of a player, as it was when the snapshot was taken.
+ * The strings are NULL when the player doesn't report them, and the lists, like the artists,
+ * are joined by ", ". The times are in microseconds.
+ */
+typedef struct mpris_ctl_player {
+    // the suffix of the bus name, eg: "spotify"
+    const char *name;
+    const char *bus_name;
+    const char *identity;
+    const char *playback_status;
+    const char *loop_status;
+    bool shuffle;
+    double volume;
+    // the position extrapolated to the moment the snapshot was taken
+    uint64_t position;
+    double rate;
+    bool can_control;
+    bool can_go_next;
+    bool can_go_previous;
+    bool can_play;
+    bool can_pause;
+    bool can_seek;
+    const char *track_id;
+    const char *title;
+    const char *artist;
+    const char *album;
+    const char *album_artist;
+    const char *composer;
+    const char *genre;
+    const char *comment;
+    const char *content_created;
+    const char *url;
+    const char *art_url;
+    uint64_t length;
+    unsigned track_number;
+    unsigned disc_number;
+    unsigned bitrate;
+} mpris_ctl_player;
+
+/**
+ * Called by the dispatch when a player answered a command, or didn't answer it in time.
+ * The status is 0 when the command succeeded, and the error is the message of the player otherwise.
+ * The strings are only valid during the call.
+ */
+typedef void (*mpris_ctl_callback)(mpris_ctl *ctl, const char *player, int status, const char *error, void *data);
+
+/**
+ * Connects to the session bus, subscribes to the signals of the players and loads all of them.
+ * Returns NULL if the bus can't be reached.
+ */
+MPRIS_CTL_API mpris_ctl *mpris_ctl_open(void);
+
+/**
+ * Closes the connection, the commands still waiting for a reply are dropped without calling their callbacks.
+ */
+MPRIS_CTL_API void mpris_ctl_close(mpris_ctl *ctl);
+
+/**
+ * Lists the players on the bus again, and loads all their information.
+ * It's only needed when the table might be out of date, as when the dispatch wasn't called for a while.
+ * Returns the number of players, or -1 on error.
+ */
+MPRIS_CTL_API int mpris_ctl_refresh(mpris_ctl *ctl);
+
+/**
+ * Returns the number of players in the table, and their names, eg: "spotify", without any call on the bus.
+ * The names are valid until the next dispatch.
+ */
+MPRIS_CTL_API int mpris_ctl_player_count(const mpris_ctl *ctl);
+MPRIS_CTL_API const char *mpris_ctl_player_name(const mpris_ctl *ctl, int index);
+
+/**
+ * Copies the information of all the players, it has to be released with mpris_ctl_snapshot_free().
+ * Returns NULL if it can't be allocated.
+ */
+MPRIS_CTL_API mpris_ctl_snapshot *mpris_ctl_snapshot_take(mpris_ctl *ctl);
+MPRIS_CTL_API int mpris_ctl_snapshot_count(const mpris_ctl_snapshot *snapshot);
+MPRIS_CTL_API const mpris_ctl_player *mpris_ctl_snapshot_player(const mpris_ctl_snapshot *snapshot, int index);
+MPRIS_CTL_API void mpris_ctl_snapshot_free(mpris_ctl_snapshot *snapshot);
+
+/**
+ * Sends a command to the player with the given name, or to all the players when it's NULL.
+ * The callback, which can be NULL, is called from the dispatch once for every player.
+ * Returns the number of players the command was sent to, or -1 on error.
+ */
+MPRIS_CTL_API int mpris_ctl_send(mpris_ctl *ctl, const char *player, enum mpris_ctl_command command, double value,
+    mpris_ctl_callback callback, void *data);
+
+/**
+ * Returns the file descriptor to poll for reading, to know when mpris_ctl_dispatch() has to be called.
+ */
+MPRIS_CTL_API int mpris_ctl_get_fd(const mpris_ctl *ctl);
+
+/**
+ * Returns the time in milliseconds until mpris_ctl_dispatch() has to be called even if the file
+ * descriptor isn't readable, to expire the commands and the requests which weren't answered, or to
+ * load again the positions of the playing players. Returns -1 when there's nothing to wait for.
+ */
+MPRIS_CTL_API int mpris_ctl_get_timeout(const mpris_ctl *ctl);
+
+/**
+ * Reads what was received without blocking, updates the players from their signals, and calls
+ * the callbacks of the commands which were answered or timed out. The properties of the players which
+ * appeared on the bus, or which were invalidated without a value, are only requested: a new player is
+ * in the table without its information until a later dispatch reads the replies.
+ * Returns 1 if any of the players changed, 0 if none did, or -1 if the connection was closed.
+ */
+MPRIS_CTL_API int mpris_ctl_dispatch(mpris_ctl *ctl);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,122 @@
+/**
+ * @author Marius Orcsik <marius@habarnam.ro>
+ */
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define ARENA_CHUNK_SIZE 4096
+#define ARENA_ALIGNMENT  (2 * sizeof(void*))
+
+/**
+ * Bump allocator for the strings which live as long as the invocation, or until the next reset.
+ * The memory is allocated in chunks which are released all at once, the pointers returned
+ * stay valid until the arena is reset, rewound past them, or freed.
+ */
+typedef struct arena_chunk {
+    struct arena_chunk *prev;
+    size_t cap;
+    size_t len;
+    char data[];
+} arena_chunk;
+
+typedef struct arena {
+    arena_chunk *head;
+    // the total capacity of the chunks
+    size_t size;
+} arena;
+
+typedef struct arena_mark {
+    arena_chunk *chunk;
+    size_t len;
+} arena_mark;
+
+bool arena_grow(arena *a, const size_t len)
+{
+    const size_t cap = MAX(len, ARENA_CHUNK_SIZE);
+    arena_chunk *chunk = malloc(sizeof(arena_chunk) + cap);
+    if (NULL == chunk) { return false; }
+
+    chunk->prev = a->head;
+    chunk->cap = cap;
+    chunk->len = 0;
+    a->head = chunk;
+    a->size += cap;
+    return true;
+}
+
+void* arena_alloc(arena *a, const size_t len)
+{
+    if (NULL != a->head) {
+        const size_t start = (a->head->len + ARENA_ALIGNMENT - 1) & ~(ARENA_ALIGNMENT - 1);
+        if (start + len <= a->head->cap) {
+            a->head->len = start + len;
+            return a->head->data + start;
+        }
+    }
+    if (!arena_grow(a, len)) { return NULL; }
+
+    a->head->len = len;
+    return a->head->data;
+}
+
+char* arena_strndup(arena *a, const char *str, const size_t len)
+{
+    char *result = arena_alloc(a, len + 1);
+    if (NULL == result) { return NULL; }
+
+    memcpy(result, str, len);
+    result[len] = 0;
+    return result;
+}
+
+char* arena_strdup(arena *a, const char *str)
+{
+    if (NULL == str) { return NULL; }
+    return arena_strndup(a, str, strlen(str));
+}
+
+arena_mark arena_get_mark(const arena *a)
+{
+    return (arena_mark){ .chunk = a->head, .len = NULL == a->head ? 0 : a->head->len };
+}
+
+/**
+ * Releases everything allocated after the mark was taken.
+ */
+void arena_rewind(arena *a, const arena_mark mark)
+{
+    while (NULL != a->head && a->head != mark.chunk) {
+        arena_chunk *prev = a->head->prev;
+        a->size -= a->head->cap;
+        free(a->head);
+        a->head = prev;
+    }
+    if (NULL != a->head) {
+        a->head->len = mark.len;
+    }
+}
+
+/**
+ * Releases everything allocated, keeping the most recent chunk for reuse.
+ */
+void arena_reset(arena *a)
+{
+    if (NULL == a->head) { return; }
+
+    while (NULL != a->head->prev) {
+        arena_chunk *prev = a->head->prev;
+        a->size -= prev->cap;
+        a->head->prev = prev->prev;
+        free(prev);
+    }
+    a->head->len = 0;
+}
+
+void arena_free(arena *a)
+{
+    arena_rewind(a, (arena_mark){0});
+    a->size = 0;
+}
@@ -0,0 +1,243 @@
+/**
+ * @author Marius Orcsik <marius@habarnam.ro>
+ */
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/un.h>
+
+#define DAEMON_SOCKET_NAME     "mpris-ctl.sock"
+#define DAEMON_MAX_ARGS        64
+#define DAEMON_MAX_MESSAGE     (1 << 20)
+// How long a client waits for the daemon to answer before giving up
+#define DAEMON_CLIENT_TIMEOUT  2 //s
+// How long the daemon waits for a client to send its request, or to read the response
+#define DAEMON_SERVE_TIMEOUT   250 //ms
+
+/**
+ * The protocol between the clients and the daemon is very simple:
+ *  * the client sends the length of the request, followed by its command line arguments
+ *    separated by NUL characters.
+ *  * the daemon answers with the exit status of the command, then with the length and
+ *    content of its standard output, and the length and content of its standard error.
+ * All the numbers are sent in host byte order, as both sides are on the same machine.
+ */
+
+bool get_daemon_socket_path(char *path, const size_t max_len)
+{
+    const char *runtime_dir = getenv("XDG_RUNTIME_DIR");
+    if (NULL == runtime_dir || strlen(runtime_dir) == 0) { return false; }
+
+    const int len = snprintf(path, max_len, "%s/%s", runtime_dir, DAEMON_SOCKET_NAME);
+    return len > 0 && (size_t)len < max_len;
+}
+
+bool write_full(const int fd, const void *data, size_t len)
+{
+    const char *cur = data;
+    while (len > 0) {
+        const ssize_t written = write(fd, cur, len);
+        if (written < 0 && errno == EINTR) { continue; }
+        if (written <= 0) { return false; }
+        cur += written;
+        len -= written;
+    }
+    return true;
+}
+
+bool read_full(const int fd, void *data, size_t len)
+{
+    char *cur = data;
+    while (len > 0) {
+        const ssize_t loaded = read(fd, cur, len);
+        if (loaded < 0 && errno == EINTR) { continue; }
+        if (loaded <= 0) { return false; }
+        cur += loaded;
+        len -= loaded;
+    }
+    return true;
+}
+
+bool write_chunk(const int fd, const char *data, const size_t len)
+{
+    const uint32_t chunk_len = len;
+    if (!write_full(fd, &chunk_len, sizeof(chunk_len))) { return false; }
+    return len == 0 || write_full(fd, data, len);
+}
+
+bool read_chunk(const int fd, sbuf *buf)
+{
+    uint32_t chunk_len = 0;
+    if (!read_full(fd, &chunk_len, sizeof(chunk_len))) { return false; }
+    if (chunk_len > DAEMON_MAX_MESSAGE) { return false; }
+
+    sbuf_reset(buf);
+    if (!sbuf_grow(buf, chunk_len)) { return false; }
+    if (!read_full(fd, buf->data, chunk_len)) { return false; }
+    buf->len = chunk_len;
+    buf->data[buf->len] = 0;
+    return true;
+}
+
+int daemon_connect(const char *path)
+{
+    struct sockaddr_un addr = {0};
+    addr.sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(addr.sun_path)) { return -1; }
+    memcpy(addr.sun_path, path, strlen(path) + 1);
+
+    const int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0) { return -1; }
+    if (connect(fd, (struct sockaddr*)&addr, sizeof(addr)) < 0) {
+        close(fd);
+        return -1;
+    }
+    const struct timeval timeout = { .tv_sec = DAEMON_CLIENT_TIMEOUT };
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    return fd;
+}
+
+/**
+ * Creates the listening socket of the daemon.
+ * A stale socket left behind by a daemon that didn't exit cleanly is removed,
+ * but we refuse to start if another daemon is answering on it.
+ */
+int daemon_listen(const char *path)
+{
+    struct sockaddr_un addr = {0};
+    addr.sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(addr.sun_path)) { return -1; }
+    memcpy(addr.sun_path, path, strlen(path) + 1);
+
+    const int running = daemon_connect(path);
+    if (running >= 0) {
+        close(running);
+        errno = EADDRINUSE;
+        return -1;
+    }
+    unlink(path);
+
+    const int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0) { return -1; }
+    if (bind(fd, (struct sockaddr*)&addr, sizeof(addr)) < 0 || listen(fd, 16) < 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+/**
+ * Accepts a client of the daemon. It's served while the daemon doesn't process anything else,
+ * so a client which doesn't send its request, or doesn't read the response, is given up on quickly.
+ * Returns -1 on error.
+ */
+int daemon_accept(const int listen_fd)
+{
+    const int fd = accept(listen_fd, NULL, NULL);
+    if (fd < 0) { return -1; }
+
+    const struct timeval timeout = { .tv_usec = DAEMON_SERVE_TIMEOUT * 1000 };
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+    return fd;
+}
+
+bool send_daemon_request(const int fd, const int argc, char **argv)
+{
+    sbuf request = {0};
+    for (int i = 0; i < argc; i++) {
+        sbuf_append(&request, argv[i], strlen(argv[i]) + 1);
+    }
+    const bool status = write_chunk(fd, request.data, request.len);
+    sbuf_free(&request);
+    return status;
+}
+
+/**
+ * Reads a request from a client and splits it back into command line arguments.
+ * The arguments point inside the request buffer.
+ * Returns the number of arguments, or -1 on error.
+ */
+int read_daemon_request(const int fd, sbuf *request, char *argv[DAEMON_MAX_ARGS])
+{
+    if (!read_chunk(fd, request)) { return -1; }
+
+    int argc = 0;
+    size_t pos = 0;
+    while (pos < request->len && argc < DAEMON_MAX_ARGS) {
+        argv[argc++] = request->data + pos;
+        pos += strlen(request->data + pos) + 1;
+    }
+    return argc;
+}
+
+/**
+ * Splits a command line in place into arguments separated by white space.
+ * Single or double quotes group an argument containing white space, and are removed.
+ * Returns the number of arguments.
+ */
+int split_command_line(char *line, char **argv, const int max_args)
+{
+    int argc = 0;
+    char *cur = line;
+    while (argc < max_args) {
+        while (*cur == ' ' || *cur == '\t' || *cur == '\r') { cur++; }
+        if (*cur == 0) { break; }
+
+        argv[argc++] = cur;
+        char *dest = cur;
+        char quote = 0;
+        while (*cur != 0) {
+            if (quote == 0 && (*cur == ' ' || *cur == '\t' || *cur == '\r')) {
+                cur++;
+                break;
+            }
+            if (quote == 0 && (*cur == '"' || *cur == '\'')) {
+                quote = *cur++;
+                continue;
+            }
+            if (quote != 0 && *cur == quote) {
+                quote = 0;
+                cur++;
+                continue;
+            }
+            *dest++ = *cur++;
+        }
+        *dest = 0;
+    }
+    return argc;
+}
+
+bool send_daemon_response(const int fd, const int status, const sbuf *out, const sbuf *err)
+{
+    const int32_t exit_status = status;
+    if (!write_full(fd, &exit_status, sizeof(exit_status))) { return false; }
+    if (!write_chunk(fd, out->data, out->len)) { return false; }
+    return write_chunk(fd, err->data, err->len);
+}
+
+/**
+ * Reads the exit status of the command executed by the daemon, which is only sent once the command was executed.
+ */
+bool read_daemon_status(const int fd, int *status)
+{
+    int32_t exit_status = 0;
+    if (!read_full(fd, &exit_status, sizeof(exit_status))) { return false; }
+    *status = exit_status;
+    return true;
+}
+
+/**
+ * Reads the output of the command executed by the daemon, which follows its exit status.
+ */
+bool read_daemon_output(const int fd, sbuf *out, sbuf *err)
+{
+    return read_chunk(fd, out) && read_chunk(fd, err);
+}
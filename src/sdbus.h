@@ -2,7 +2,9 @@
  * @author Marius Orcsik <marius@habarnam.ro>
  */
 
+#include <stddef.h>
 #include <stdio.h>
+#include <time.h>
 #include <dbus/dbus.h>
 
 #define MPRIS_MEDIA_PLAYER_PLAYER_INTERFACE "org.mpris.MediaPlayer2.Player"
@@ -10,6 +12,8 @@
 
 #define LOCAL_NAME                 "org.mpris.mprisctl"
 #define MPRIS_PLAYER_NAMESPACE     "org.mpris.MediaPlayer2"
+// The suffix of the bus names of the players running multiple instances, followed by the process id
+#define MPRIS_INSTANCE_SUFFIX      ".instance"
 #define MPRIS_PLAYER_PATH          "/org/mpris/MediaPlayer2"
 #define MPRIS_METHOD_NEXT          "Next"
 #define MPRIS_METHOD_PREVIOUS      "Previous"
@@ -29,6 +33,7 @@
 #define MPRIS_PNAME_CANSEEK        "CanSeek"
 #define MPRIS_PNAME_SHUFFLE        "Shuffle"
 #define MPRIS_PNAME_POSITION       "Position"
+#define MPRIS_PNAME_RATE           "Rate"
 #define MPRIS_PNAME_VOLUME         "Volume"
 #define MPRIS_PNAME_LOOPSTATUS     "LoopStatus"
 #define MPRIS_PNAME_METADATA       "Metadata"
@@ -42,6 +47,22 @@
 #define DBUS_METHOD_GET_ALL        "GetAll"
 #define DBUS_METHOD_GET            "Get"
 #define DBUS_METHOD_SET            "Set"
+#define DBUS_METHOD_GET_NAME_OWNER "GetNameOwner"
+
+#define DBUS_SIGNAL_NAME_OWNER_CHANGED   "NameOwnerChanged"
+#define DBUS_SIGNAL_PROPERTIES_CHANGED   "PropertiesChanged"
+#define MPRIS_SIGNAL_SEEKED              "Seeked"
+
+#define MPRIS_PROPERTIES_CHANGED_MATCH "type='signal',interface='" DBUS_INTERFACE_PROPERTIES "'," \
+    "member='" DBUS_SIGNAL_PROPERTIES_CHANGED "',path='" MPRIS_PLAYER_PATH "'"
+#define MPRIS_NAME_OWNER_CHANGED_MATCH "type='signal',sender='" DBUS_SERVICE_DBUS "',interface='" DBUS_INTERFACE_DBUS "'," \
+    "member='" DBUS_SIGNAL_NAME_OWNER_CHANGED "',arg0namespace='" MPRIS_PLAYER_NAMESPACE "'"
+#define MPRIS_SEEKED_MATCH "type='signal',interface='" MPRIS_MEDIA_PLAYER_PLAYER_INTERFACE "'," \
+    "member='" MPRIS_SIGNAL_SEEKED "',path='" MPRIS_PLAYER_PATH "'"
+
+// The players don't signal the position while playing, so it is extrapolated from the last one loaded,
+//   and loaded again when it was extrapolated for longer than this
+#define MPRIS_POSITION_RESYNC      30 // seconds
 
 #define MPRIS_METADATA_BITRATE      "bitrate"
 #define MPRIS_METADATA_ART_URL      "mpris:artUrl"
@@ -51,6 +72,10 @@
 #define MPRIS_METADATA_ALBUM_ARTIST "xesam:albumArtist"
 #define MPRIS_METADATA_ARTIST       "xesam:artist"
 #define MPRIS_METADATA_COMMENT      "xesam:comment"
+#define MPRIS_METADATA_COMPOSER     "xesam:composer"
+#define MPRIS_METADATA_CONTENT_CREATED "xesam:contentCreated"
+#define MPRIS_METADATA_DISC_NUMBER  "xesam:discNumber"
+#define MPRIS_METADATA_GENRE        "xesam:genre"
 #define MPRIS_METADATA_TITLE        "xesam:title"
 #define MPRIS_METADATA_TRACK_NUMBER "xesam:trackNumber"
 #define MPRIS_METADATA_URL          "xesam:url"
@@ -68,30 +93,136 @@
 //   certain players which don't seem to reply to MPRIS methods
 #define DBUS_CONNECTION_TIMEOUT    100 //ms
 
-#define MAX_PLAYERS 20
+// The initial capacity of the player table, it grows as needed
+#define MIN_PLAYERS 16
+
+// When more than this number of properties is needed from a player
+//   we load them all with a single GetAll call instead of individual Get calls
+#define MPRIS_PROPERTIES_GET_THRESHOLD 3
+
+enum mpris_property {
+    mpris_prop_none            = 0,
+    mpris_prop_playback_status = 1 << 0,
+    mpris_prop_loop_status     = 1 << 1,
+    mpris_prop_shuffle         = 1 << 2,
+    mpris_prop_volume          = 1 << 3,
+    mpris_prop_position        = 1 << 4,
+    mpris_prop_metadata        = 1 << 5,
+    mpris_prop_capabilities    = 1 << 6,
+    mpris_prop_identity        = 1 << 7,
+    // the metadata keys which aren't decoded into fields, it's loaded with the metadata
+    mpris_prop_metadata_keys   = 1 << 8,
+
+    mpris_prop_all             = (1 << 7) - 1,
+};
+
+struct mpris_property_name {
+    enum mpris_property property;
+    const char *name;
+};
+
+const struct mpris_property_name mpris_property_names[] = {
+    {mpris_prop_playback_status, MPRIS_PNAME_PLAYBACKSTATUS},
+    {mpris_prop_loop_status, MPRIS_PNAME_LOOPSTATUS},
+    {mpris_prop_shuffle, MPRIS_PNAME_SHUFFLE},
+    {mpris_prop_volume, MPRIS_PNAME_VOLUME},
+    {mpris_prop_position, MPRIS_PNAME_POSITION},
+    {mpris_prop_position, MPRIS_PNAME_RATE},
+    {mpris_prop_metadata, MPRIS_PNAME_METADATA},
+    {mpris_prop_capabilities, MPRIS_PNAME_CANCONTROL},
+    {mpris_prop_capabilities, MPRIS_PNAME_CANGONEXT},
+    {mpris_prop_capabilities, MPRIS_PNAME_CANGOPREVIOUS},
+    {mpris_prop_capabilities, MPRIS_PNAME_CANPLAY},
+    {mpris_prop_capabilities, MPRIS_PNAME_CANPAUSE},
+    {mpris_prop_capabilities, MPRIS_PNAME_CANSEEK},
+};
+
+#define MPRIS_PROPERTY_NAMES_COUNT (int)(sizeof(mpris_property_names) / sizeof(mpris_property_names[0]))
+
+/**
+ * The reply messages the string properties are borrowed from.
+ * The metadata is always replaced as a whole, so all its strings come from the same message.
+ */
+enum mpris_source {
+    mpris_source_playback_status,
+    mpris_source_loop_status,
+    mpris_source_metadata,
+    mpris_source_identity,
+
+    mpris_source_count
+};
+
+/**
+ * The metadata fields which are decoded into the mpris_metadata structure.
+ */
+enum mpris_metadata_key {
+    mpris_meta_bitrate,
+    mpris_meta_art_url,
+    mpris_meta_length,
+    mpris_meta_track_id,
+    mpris_meta_album,
+    mpris_meta_album_artist,
+    mpris_meta_artist,
+    mpris_meta_comment,
+    mpris_meta_composer,
+    mpris_meta_content_created,
+    mpris_meta_disc_number,
+    mpris_meta_genre,
+    mpris_meta_title,
+    mpris_meta_track_number,
+    mpris_meta_url,
+
+    mpris_meta_count
+};
+
+#define MPRIS_METADATA_ALL ((1u << mpris_meta_count) - 1)
+
+typedef struct mpris_metadata_entry {
+    // the key and the value point inside the message the metadata was loaded from
+    const char *key;
+    DBusMessageIter value;
+} mpris_metadata_entry;
 
+/**
+ * The metadata is loaded as an index of its keys, and the values are only decoded when they are used,
+ * as some players send a lot of it. The known fields are decoded by mpris_metadata_decode().
+ * The strings are borrowed from the message the metadata was loaded from and are NULL when missing.
+ * Only the array values with more than one element are copied, as they need to be joined.
+ */
 typedef struct mpris_metadata {
     uint64_t length; // mpris specific
     unsigned short track_number;
     unsigned short bitrate;
     unsigned short disc_number;
-    char album_artist[MAX_OUTPUT_LENGTH];
-    char composer[MAX_OUTPUT_LENGTH];
-    char genre[MAX_OUTPUT_LENGTH];
-    char artist[MAX_OUTPUT_LENGTH];
-    char comment[MAX_OUTPUT_LENGTH];
-    char track_id[MAX_OUTPUT_LENGTH];
-    char album[MAX_OUTPUT_LENGTH];
-    char content_created[MAX_OUTPUT_LENGTH];
-    char title[MAX_OUTPUT_LENGTH];
-    char url[MAX_OUTPUT_LENGTH];
-    char art_url[MAX_OUTPUT_LENGTH]; //mpris specific
-
+    const char *album_artist;
+    const char *composer;
+    const char *genre;
+    const char *artist;
+    const char *comment;
+    const char *track_id;
+    const char *album;
+    const char *content_created;
+    const char *title;
+    const char *url;
+    const char *art_url; //mpris specific
+    // the joined array values, owned by the metadata
+    arena joined;
+    mpris_metadata_entry *entries;
+    int entry_count;
+    int entry_cap;
+    // the position in the index of each known field
+    int fields[mpris_meta_count];
+    // the mask of the known fields which are in the index but weren't decoded yet
+    unsigned pending;
 } mpris_metadata;
 
 typedef struct mpris_properties {
     double volume;
+    // the position when it was loaded, at the monotonic time in µs of position_time, 0 if it wasn't
     uint64_t position;
+    int64_t position_time;
+    // the playback rate, 0 when the player doesn't report it
+    double rate;
     bool can_control;
     bool can_go_next;
     bool can_go_previous;
@@ -99,32 +230,151 @@ typedef struct mpris_properties {
     bool can_pause;
     bool can_seek;
     bool shuffle;
-    char player_name[MAX_OUTPUT_LENGTH];
-    char player_identity[MAX_OUTPUT_LENGTH];
-    char loop_status[MAX_OUTPUT_LENGTH];
-    char playback_status[MAX_OUTPUT_LENGTH];
+    // the suffix of the bus name of the player, eg: "spotify"
+    const char *player_name;
+    const char *player_identity;
+    const char *loop_status;
+    const char *playback_status;
     mpris_metadata metadata;
+    // the messages the strings are borrowed from, each one is kept referenced until it's replaced
+    DBusMessage *sources[mpris_source_count];
 } mpris_properties;
 
+enum mpris_playback {
+    mpris_playback_unknown,
+    mpris_playback_playing,
+    mpris_playback_paused,
+    mpris_playback_stopped,
+};
+
+/**
+ * The player table only holds what is needed to select the players, so it stays compact when
+ * there are many of them. The properties are allocated only for the selected players.
+ */
 typedef struct mpris_player {
-    char *identity;
-    char name[MAX_OUTPUT_LENGTH];
-    mpris_properties properties;
+    // the bus names are allocated in the arena of the player table
+    const char *name;
+    // the unique connection name of the player, eg: ":1.42", used to match signals
+    const char *unique_name;
+    enum mpris_playback status;
+    // loaded with the status when the command needs it, as the relative volume changes do
+    double volume;
     bool skip;
+    // the player didn't answer in the last invocations, it is only called when named explicitly
+    bool quarantined;
+    // the identity recorded by a previous invocation, it is used instead of requesting it again
+    const char *identity;
+    mpris_properties *properties;
 } mpris_player;
 
+/**
+ * Makes room in the player table for at least count players.
+ */
+bool reserve_players(mpris_player **players, int *cap, const int count)
+{
+    if (count <= *cap) { return true; }
+
+    int new_cap = MAX(*cap * 2, MIN_PLAYERS);
+    while (new_cap < count) {
+        new_cap *= 2;
+    }
+    mpris_player *result = realloc(*players, new_cap * sizeof(mpris_player));
+    if (NULL == result) { return false; }
+
+    memset(result + *cap, 0, (new_cap - *cap) * sizeof(mpris_player));
+    *players = result;
+    *cap = new_cap;
+    return true;
+}
+
+enum mpris_playback parse_playback_status(const char *status)
+{
+    if (NULL == status) { return mpris_playback_unknown; }
+    if (strcmp(status, MPRIS_METADATA_VALUE_PLAYING) == 0) { return mpris_playback_playing; }
+    if (strcmp(status, MPRIS_METADATA_VALUE_PAUSED) == 0) { return mpris_playback_paused; }
+    if (strcmp(status, MPRIS_METADATA_VALUE_STOPPED) == 0) { return mpris_playback_stopped; }
+    return mpris_playback_unknown;
+}
+
+// The monotonic time in µs, the positions are extrapolated from it
+int64_t mpris_now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000L + ts.tv_nsec / 1000;
+}
+
+void update_player_status(mpris_player *player)
+{
+    if (NULL == player->properties) { return; }
+    // the status loaded by the pre-pass is kept when the command doesn't need the property
+    if (NULL == player->properties->playback_status) { return; }
+    player->status = parse_playback_status(player->properties->playback_status);
+}
+
 void mpris_metadata_init(mpris_metadata* metadata)
 {
     metadata->track_number = 0;
     metadata->bitrate = 0;
     metadata->disc_number = 0;
     metadata->length = 0;
-    memcpy(metadata->album_artist, "unknown", 8);
-    memcpy(metadata->composer, "unknown", 8);
-    memcpy(metadata->genre, "unknown", 8);
-    memcpy(metadata->artist, "unknown", 8);
-    memcpy(metadata->album, "unknown", 8);
-    memcpy(metadata->title, "unknown", 8);
+    metadata->album_artist = "unknown";
+    metadata->composer = "unknown";
+    metadata->genre = "unknown";
+    metadata->artist = "unknown";
+    metadata->album = "unknown";
+    metadata->title = "unknown";
+}
+
+void mpris_metadata_free(mpris_metadata *metadata)
+{
+    arena_free(&metadata->joined);
+    free(metadata->entries);
+    memset(metadata, 0, sizeof(mpris_metadata));
+}
+
+/**
+ * Keeps the message referenced as the source of the strings of a property,
+ * releasing the message the previous value was borrowed from.
+ */
+void retain_property_source(mpris_properties *properties, const enum mpris_source source, DBusMessage *msg)
+{
+    dbus_message_ref(msg);
+    if (NULL != properties->sources[source]) {
+        dbus_message_unref(properties->sources[source]);
+    }
+    properties->sources[source] = msg;
+}
+
+void mpris_properties_free(mpris_properties *properties)
+{
+    if (NULL == properties) { return; }
+
+    mpris_metadata_free(&properties->metadata);
+    for (int i = 0; i < mpris_source_count; i++) {
+        if (NULL != properties->sources[i]) {
+            dbus_message_unref(properties->sources[i]);
+        }
+    }
+    memset(properties, 0, sizeof(mpris_properties));
+}
+
+/**
+ * Allocates the properties of a player which was selected.
+ */
+bool mpris_player_alloc_properties(mpris_player *player)
+{
+    if (NULL == player->properties) {
+        player->properties = calloc(1, sizeof(mpris_properties));
+    }
+    return NULL != player->properties;
+}
+
+void mpris_player_free(mpris_player *player)
+{
+    mpris_properties_free(player->properties);
+    free(player->properties);
+    player->properties = NULL;
 }
 
 enum volume_change_type {
@@ -137,46 +387,72 @@ struct volume_change {
     enum volume_change_type type;
 };
 
-DBusMessage* call_dbus_method(DBusConnection* conn, const char* destination, const char* path, const char* interface, char* method)
+DBusPendingCall* send_dbus_message(DBusConnection* conn, DBusMessage* msg)
 {
     if (NULL == conn) { return NULL; }
-    if (NULL == destination) { return NULL; }
-
-    DBusPendingCall* pending;
-
-    // create a new method call and check for errors
-    DBusMessage* msg = dbus_message_new_method_call(destination, path, interface, method);
     if (NULL == msg) { return NULL; }
 
-    // send message and get a handle for a reply
-    if (!dbus_connection_send_with_reply (conn, msg, &pending, DBUS_CONNECTION_TIMEOUT)) {
-        goto _unref_message_err;
+    DBusPendingCall* pending = NULL;
+    // send message and get a handle for a reply, the caller is responsible for flushing the connection
+    // the timeout is adapted to how fast the player usually answers
+    const int timeout = health_timeout(dbus_message_get_destination(msg), DBUS_CONNECTION_TIMEOUT);
+    if (!dbus_connection_send_with_reply (conn, msg, &pending, timeout)) {
+        return NULL;
     }
-    if (NULL == pending) {
-        goto _unref_message_err;
-    }
-    dbus_connection_flush(conn);
+    trace_sent(msg, pending);
+    health_sent(msg, pending);
+    return pending;
+}
 
-    // free message
-    dbus_message_unref(msg);
+/**
+ * Sends the message without asking for a reply, the player doesn't even send one.
+ * The caller is responsible for flushing the connection.
+ */
+bool send_dbus_message_no_reply(DBusConnection* conn, DBusMessage* msg)
+{
+    if (NULL == conn) { return false; }
+    if (NULL == msg) { return false; }
+
+    dbus_message_set_no_reply(msg, TRUE);
+    return dbus_connection_send(conn, msg, NULL);
+}
+
+DBusMessage* wait_dbus_reply(DBusPendingCall* pending)
+{
+    if (NULL == pending) { return NULL; }
 
-    // block until we receive a reply
+    // block until we receive a reply, the timeout is counted from the moment the message was sent
     dbus_pending_call_block(pending);
 
-    DBusMessage* reply;
     // get the reply message
-    reply = dbus_pending_call_steal_reply(pending);
+    DBusMessage* reply = dbus_pending_call_steal_reply(pending);
+    trace_received(pending, reply);
+    health_received(pending, reply);
 
     // free the pending message handle
     dbus_pending_call_unref(pending);
 
     return reply;
+}
 
-_unref_message_err:
-    {
-        dbus_message_unref(msg);
-    }
-    return NULL;
+DBusMessage* call_dbus_method(DBusConnection* conn, const char* destination, const char* path, const char* interface, char* method)
+{
+    if (NULL == conn) { return NULL; }
+    if (NULL == destination) { return NULL; }
+
+    // create a new method call and check for errors
+    DBusMessage* msg = dbus_message_new_method_call(destination, path, interface, method);
+    if (NULL == msg) { return NULL; }
+
+    DBusPendingCall* pending = send_dbus_message(conn, msg);
+    // free message
+    dbus_message_unref(msg);
+    if (NULL == pending) { return NULL; }
+    dbus_connection_flush(conn);
+
+    DBusMessage* reply = wait_dbus_reply(pending);
+    trace_reply_decoded();
+    return reply;
 }
 
 double extract_double_var(DBusMessageIter *iter, DBusError *error)
@@ -197,42 +473,55 @@ double extract_double_var(DBusMessageIter *iter, DBusError *error)
     return 0;
 }
 
-void extract_string_var(char result[MAX_OUTPUT_LENGTH], DBusMessageIter *iter, DBusError *error)
+/**
+ * Returns the string value of the variant, borrowed from the message the iterator belongs to,
+ * so it's valid only as long as the message is referenced.
+ *
+ * The arrays with more than one element can't be borrowed: when a joined buffer is passed, their
+ * values are appended to it, separated by ", " and NUL terminated, and NULL is returned.
+ * The caller can find the value at the length the buffer had before the call.
+ * Without a joined buffer only the first element is returned.
+ */
+const char* extract_string_var(DBusMessageIter *iter, sbuf *joined, DBusError *error)
 {
     if (DBUS_TYPE_VARIANT != dbus_message_iter_get_arg_type(iter)) {
         dbus_set_error_const(error, "iter_should_be_variant", "This message iterator must be have variant type");
-        return;
+        return NULL;
     }
-    memset(result, 0, MAX_OUTPUT_LENGTH);
 
+    const char *val = NULL;
     DBusMessageIter variantIter = {0};
     dbus_message_iter_recurse(iter, &variantIter);
     if (DBUS_TYPE_OBJECT_PATH == dbus_message_iter_get_arg_type(&variantIter)) {
-        char *val = NULL;
         dbus_message_iter_get_basic(&variantIter, &val);
-        memcpy(result, val, strlen(val));
     } else if (DBUS_TYPE_STRING == dbus_message_iter_get_arg_type(&variantIter)) {
-        char *val = NULL;
         dbus_message_iter_get_basic(&variantIter, &val);
-        memcpy(result, val, strlen(val));
     } else if (DBUS_TYPE_ARRAY == dbus_message_iter_get_arg_type(&variantIter)) {
         DBusMessageIter arrayIter;
         dbus_message_iter_recurse(&variantIter, &arrayIter);
-        while (true) {
-            // todo(marius): load all elements of the array
-            if (DBUS_TYPE_STRING == dbus_message_iter_get_arg_type(&arrayIter)) {
-                char *val = NULL;
-                dbus_message_iter_get_basic(&arrayIter, &val);
-                strncat(result, val, MAX_OUTPUT_LENGTH - strlen(result) - 1);
-            }
-            if (!dbus_message_iter_has_next(&arrayIter)) {
-                break;
-            } else {
-                strncat(result, ", ", 3);
+
+        bool multiple = false;
+        while (DBUS_TYPE_STRING == dbus_message_iter_get_arg_type(&arrayIter)) {
+            const char *next = NULL;
+            dbus_message_iter_get_basic(&arrayIter, &next);
+            if (NULL == val) {
+                val = next;
+            } else if (NULL != joined) {
+                if (!multiple) {
+                    sbuf_append_str(joined, val);
+                    multiple = true;
+                }
+                sbuf_append(joined, ", ", 2);
+                sbuf_append_str(joined, next);
             }
             dbus_message_iter_next(&arrayIter);
         }
+        if (multiple) {
+            sbuf_append(joined, "", 1);
+            return NULL;
+        }
     }
+    return val;
 }
 
 int32_t extract_int32_var(DBusMessageIter *iter, DBusError *error)
@@ -296,168 +585,356 @@ bool extract_boolean_var(DBusMessageIter *iter, DBusError *error)
     return false;
 }
 
-void load_metadata(mpris_metadata *track, DBusMessageIter *iter)
+/**
+ * The types of the values of the properties and metadata keys, with the type of the field they are stored in.
+ */
+enum mpris_field_type {
+    // a string, or an array of strings which are joined, stored as a const char*
+    mpris_field_string,
+    // an int32, stored as an unsigned short
+    mpris_field_short,
+    // an int64, or uint64, stored as an uint64_t
+    mpris_field_uint64,
+    // the position of the player, stored as an uint64_t with the time it was loaded at
+    mpris_field_position,
+    mpris_field_double,
+    mpris_field_boolean,
+    // the metadata dictionary of the player
+    mpris_field_metadata,
+};
+
+/**
+ * Describes how the value of a key is decoded and where it is stored.
+ */
+typedef struct mpris_field {
+    const char *key;
+    enum mpris_field_type type;
+    // the offset of the field in the mpris_properties, or the mpris_metadata, structure
+    size_t offset;
+    // the message the strings of the properties are borrowed from
+    enum mpris_source source;
+} mpris_field;
+
+// The position of each field in the table is its key in enum mpris_metadata_key
+const mpris_field mpris_metadata_fields[] = {
+    [mpris_meta_bitrate] = {MPRIS_METADATA_BITRATE, mpris_field_short, offsetof(mpris_metadata, bitrate), 0},
+    [mpris_meta_art_url] = {MPRIS_METADATA_ART_URL, mpris_field_string, offsetof(mpris_metadata, art_url), 0},
+    [mpris_meta_length] = {MPRIS_METADATA_LENGTH, mpris_field_uint64, offsetof(mpris_metadata, length), 0},
+    [mpris_meta_track_id] = {MPRIS_METADATA_TRACKID, mpris_field_string, offsetof(mpris_metadata, track_id), 0},
+    [mpris_meta_album] = {MPRIS_METADATA_ALBUM, mpris_field_string, offsetof(mpris_metadata, album), 0},
+    [mpris_meta_album_artist] = {MPRIS_METADATA_ALBUM_ARTIST, mpris_field_string, offsetof(mpris_metadata, album_artist), 0},
+    [mpris_meta_artist] = {MPRIS_METADATA_ARTIST, mpris_field_string, offsetof(mpris_metadata, artist), 0},
+    [mpris_meta_comment] = {MPRIS_METADATA_COMMENT, mpris_field_string, offsetof(mpris_metadata, comment), 0},
+    [mpris_meta_composer] = {MPRIS_METADATA_COMPOSER, mpris_field_string, offsetof(mpris_metadata, composer), 0},
+    [mpris_meta_content_created] = {MPRIS_METADATA_CONTENT_CREATED, mpris_field_string, offsetof(mpris_metadata, content_created), 0},
+    [mpris_meta_disc_number] = {MPRIS_METADATA_DISC_NUMBER, mpris_field_short, offsetof(mpris_metadata, disc_number), 0},
+    [mpris_meta_genre] = {MPRIS_METADATA_GENRE, mpris_field_string, offsetof(mpris_metadata, genre), 0},
+    [mpris_meta_title] = {MPRIS_METADATA_TITLE, mpris_field_string, offsetof(mpris_metadata, title), 0},
+    [mpris_meta_track_number] = {MPRIS_METADATA_TRACK_NUMBER, mpris_field_short, offsetof(mpris_metadata, track_number), 0},
+    [mpris_meta_url] = {MPRIS_METADATA_URL, mpris_field_string, offsetof(mpris_metadata, url), 0},
+};
+
+const mpris_field mpris_properties_fields[] = {
+    {MPRIS_PNAME_CANCONTROL, mpris_field_boolean, offsetof(mpris_properties, can_control), 0},
+    {MPRIS_PNAME_CANGONEXT, mpris_field_boolean, offsetof(mpris_properties, can_go_next), 0},
+    {MPRIS_PNAME_CANGOPREVIOUS, mpris_field_boolean, offsetof(mpris_properties, can_go_previous), 0},
+    {MPRIS_PNAME_CANPAUSE, mpris_field_boolean, offsetof(mpris_properties, can_pause), 0},
+    {MPRIS_PNAME_CANPLAY, mpris_field_boolean, offsetof(mpris_properties, can_play), 0},
+    {MPRIS_PNAME_CANSEEK, mpris_field_boolean, offsetof(mpris_properties, can_seek), 0},
+    {MPRIS_PNAME_LOOPSTATUS, mpris_field_string, offsetof(mpris_properties, loop_status), mpris_source_loop_status},
+    {MPRIS_PNAME_METADATA, mpris_field_metadata, offsetof(mpris_properties, metadata), mpris_source_metadata},
+    {MPRIS_PNAME_PLAYBACKSTATUS, mpris_field_string, offsetof(mpris_properties, playback_status), mpris_source_playback_status},
+    {MPRIS_PNAME_POSITION, mpris_field_position, offsetof(mpris_properties, position), 0},
+    {MPRIS_PNAME_RATE, mpris_field_double, offsetof(mpris_properties, rate), 0},
+    {MPRIS_PNAME_SHUFFLE, mpris_field_boolean, offsetof(mpris_properties, shuffle), 0},
+    {MPRIS_PNAME_VOLUME, mpris_field_double, offsetof(mpris_properties, volume), 0},
+};
+
+// The number of slots of the hash tables of the keys, a power of two
+#define MPRIS_FIELD_SLOTS 64
+// The slot of a key is taken from the high bits of its hash, which are better mixed than the low ones
+#define MPRIS_FIELD_SLOT(hash) (((hash) >> 24) & (MPRIS_FIELD_SLOTS - 1))
+
+/**
+ * Perfect hash tables from the keys to their descriptions: every key has a slot of its own, so it's
+ * found with one probe, and compared only once in full. They are constant, so they are safe to share
+ * between threads. The slots were computed from hash_field_key(), a new key needs a free one, which
+ * the check of bench/microbench verifies.
+ */
+const mpris_field *const mpris_metadata_slots[MPRIS_FIELD_SLOTS] = {
+    [7] = &mpris_metadata_fields[mpris_meta_album],
+    [22] = &mpris_metadata_fields[mpris_meta_track_number],
+    [25] = &mpris_metadata_fields[mpris_meta_length],
+    [33] = &mpris_metadata_fields[mpris_meta_album_artist],
+    [42] = &mpris_metadata_fields[mpris_meta_disc_number],
+    [43] = &mpris_metadata_fields[mpris_meta_track_id],
+    [48] = &mpris_metadata_fields[mpris_meta_art_url],
+    [50] = &mpris_metadata_fields[mpris_meta_bitrate],
+    [51] = &mpris_metadata_fields[mpris_meta_genre],
+    [53] = &mpris_metadata_fields[mpris_meta_comment],
+    [54] = &mpris_metadata_fields[mpris_meta_artist],
+    [56] = &mpris_metadata_fields[mpris_meta_title],
+    [57] = &mpris_metadata_fields[mpris_meta_content_created],
+    [58] = &mpris_metadata_fields[mpris_meta_composer],
+    [59] = &mpris_metadata_fields[mpris_meta_url],
+};
+
+const mpris_field *const mpris_properties_slots[MPRIS_FIELD_SLOTS] = {
+    [12] = &mpris_properties_fields[2], // CanGoPrevious
+    [18] = &mpris_properties_fields[11], // Shuffle
+    [19] = &mpris_properties_fields[8], // PlaybackStatus
+    [24] = &mpris_properties_fields[3], // CanPause
+    [26] = &mpris_properties_fields[1], // CanGoNext
+    [28] = &mpris_properties_fields[7], // Metadata
+    [34] = &mpris_properties_fields[9], // Position
+    [36] = &mpris_properties_fields[0], // CanControl
+    [37] = &mpris_properties_fields[5], // CanSeek
+    [38] = &mpris_properties_fields[6], // LoopStatus
+    [46] = &mpris_properties_fields[10], // Rate
+    [52] = &mpris_properties_fields[12], // Volume
+    [55] = &mpris_properties_fields[4], // CanPlay
+};
+
+// FNV-1a
+uint32_t hash_field_key(const char *key)
 {
-    DBusError err = {0};
-    dbus_error_init(&err);
+    uint32_t hash = 2166136261u;
+    for (const unsigned char *c = (const unsigned char*)key; *c != 0; c++) {
+        hash = (hash ^ *c) * 16777619u;
+    }
+    return hash;
+}
 
-    if (DBUS_TYPE_VARIANT != dbus_message_iter_get_arg_type(iter)) {
-        dbus_set_error_const(&err, "iter_should_be_variant", "This message iterator must be have variant type");
-        return;
+const mpris_field *find_field(const mpris_field *const slots[MPRIS_FIELD_SLOTS], const char *key)
+{
+    if (NULL == key) { return NULL; }
+
+    const mpris_field *field = slots[MPRIS_FIELD_SLOT(hash_field_key(key))];
+    if (NULL == field || strcmp(field->key, key) != 0) { return NULL; }
+    return field;
+}
+
+/**
+ * Stores the value of a key which isn't a string, or the metadata, in its field.
+ */
+void load_field_value(void *base, const mpris_field *field, DBusMessageIter *iter, DBusError *err)
+{
+    char *value = (char*)base + field->offset;
+    switch (field->type) {
+        case mpris_field_short:
+            *(unsigned short*)value = extract_int32_var(iter, err);
+            break;
+        case mpris_field_uint64:
+        case mpris_field_position:
+            *(uint64_t*)value = extract_int64_var(iter, err);
+            break;
+        case mpris_field_double:
+            *(double*)value = extract_double_var(iter, err);
+            break;
+        case mpris_field_boolean:
+            *(bool*)value = extract_boolean_var(iter, err);
+            break;
+        default:
+            break;
     }
+}
+
+/**
+ * Indexes the keys of the metadata from the variant the iterator points to, without decoding the values.
+ * The index points inside the message, which the caller has to keep referenced.
+ */
+void load_metadata(mpris_metadata *track, DBusMessageIter *iter)
+{
+    if (DBUS_TYPE_VARIANT != dbus_message_iter_get_arg_type(iter)) { return; }
 
     DBusMessageIter variantIter;
     dbus_message_iter_recurse(iter, &variantIter);
-    if (DBUS_TYPE_ARRAY != dbus_message_iter_get_arg_type(&variantIter)) {
-        dbus_set_error_const(&err, "variant_should_be_array", "This variant reply message must have array content");
-        return;
-    }
+    if (DBUS_TYPE_ARRAY != dbus_message_iter_get_arg_type(&variantIter)) { return; }
+
     DBusMessageIter arrayIter;
     dbus_message_iter_recurse(&variantIter, &arrayIter);
-    while (true) {
-        char* key = NULL;
-        if (DBUS_TYPE_DICT_ENTRY == dbus_message_iter_get_arg_type(&arrayIter)) {
-            DBusMessageIter dictIter;
-            dbus_message_iter_recurse(&arrayIter, &dictIter);
-            if (DBUS_TYPE_STRING != dbus_message_iter_get_arg_type(&dictIter)) {
-                dbus_set_error_const(&err, "missing_key", "This message iterator doesn't have key");
-            }
-            dbus_message_iter_get_basic(&dictIter, &key);
+    while (DBUS_TYPE_DICT_ENTRY == dbus_message_iter_get_arg_type(&arrayIter)) {
+        DBusMessageIter dictIter;
+        dbus_message_iter_recurse(&arrayIter, &dictIter);
+        dbus_message_iter_next(&arrayIter);
 
-            if (!dbus_message_iter_has_next(&dictIter)) {
-                continue;
-            }
-            dbus_message_iter_next(&dictIter);
+        const char* key = NULL;
+        if (DBUS_TYPE_STRING != dbus_message_iter_get_arg_type(&dictIter)) { continue; }
+        dbus_message_iter_get_basic(&dictIter, &key);
+        if (!dbus_message_iter_next(&dictIter)) { continue; }
+
+        if (track->entry_count == track->entry_cap) {
+            const int cap = MAX(track->entry_cap * 2, 16);
+            mpris_metadata_entry *entries = realloc(track->entries, cap * sizeof(mpris_metadata_entry));
+            if (NULL == entries) { return; }
+            track->entries = entries;
+            track->entry_cap = cap;
+        }
+        track->entries[track->entry_count] = (mpris_metadata_entry){ .key = key, .value = dictIter };
 
-            if (!strncmp(key, MPRIS_METADATA_BITRATE, strlen(MPRIS_METADATA_BITRATE))) {
-                track->bitrate = extract_int32_var(&dictIter, &err);
-            }
-            if (!strncmp(key, MPRIS_METADATA_ART_URL, strlen(MPRIS_METADATA_ART_URL))) {
-                extract_string_var(track->art_url, &dictIter, &err);
-            }
-            if (!strncmp(key, MPRIS_METADATA_LENGTH, strlen(MPRIS_METADATA_LENGTH))) {
-                track->length = extract_int64_var(&dictIter, &err);
-            }
-            if (!strncmp(key, MPRIS_METADATA_TRACKID, strlen(MPRIS_METADATA_TRACKID))) {
-                extract_string_var(track->track_id, &dictIter, &err);
-            }
-            if (!strncmp(key, MPRIS_METADATA_ALBUM_ARTIST, strlen(MPRIS_METADATA_ALBUM_ARTIST))) {
-                extract_string_var(track->album_artist, &dictIter, &err);
-            } else if (!strncmp(key, MPRIS_METADATA_ALBUM, strlen(MPRIS_METADATA_ALBUM))) {
-                extract_string_var(track->album, &dictIter, &err);
-            }
-            if (!strncmp(key, MPRIS_METADATA_ARTIST, strlen(MPRIS_METADATA_ARTIST))) {
-                extract_string_var(track->artist, &dictIter, &err);
-            }
-            if (!strncmp(key, MPRIS_METADATA_COMMENT, strlen(MPRIS_METADATA_COMMENT))) {
-                extract_string_var(track->comment, &dictIter, &err);
-            }
-            if (!strncmp(key, MPRIS_METADATA_TITLE, strlen(MPRIS_METADATA_TITLE))) {
-                extract_string_var(track->title, &dictIter, &err);
-            }
-            if (!strncmp(key, MPRIS_METADATA_TRACK_NUMBER, strlen(MPRIS_METADATA_TRACK_NUMBER))) {
-                track->track_number = extract_int32_var(&dictIter, &err);
-            }
-            if (!strncmp(key, MPRIS_METADATA_URL, strlen(MPRIS_METADATA_URL))) {
-                extract_string_var(track->url, &dictIter, &err);
-            }
-            if (dbus_error_is_set(&err)) {
-                fprintf(stderr, "error: %s, %s\n", key, err.message);
-                dbus_error_free(&err);
+        const mpris_field *field = find_field(mpris_metadata_slots, key);
+        if (NULL != field) {
+            const int known = field - mpris_metadata_fields;
+            track->fields[known] = track->entry_count;
+            track->pending |= 1u << known;
+        }
+        track->entry_count++;
+    }
+}
+
+/**
+ * Decodes the known fields in the keys mask which weren't decoded yet.
+ */
+void mpris_metadata_decode(mpris_metadata *track, const unsigned keys)
+{
+    const unsigned pending = track->pending & keys;
+    if (pending == 0) { return; }
+
+    DBusError err = {0};
+    dbus_error_init(&err);
+
+    sbuf joined = {0};
+    for (int i = 0; i < mpris_meta_count; i++) {
+        if (!(pending & (1u << i))) { continue; }
+
+        const mpris_field *field = &mpris_metadata_fields[i];
+        // the iterator is copied, so the index can be decoded again
+        DBusMessageIter value = track->entries[track->fields[i]].value;
+        if (field->type == mpris_field_string) {
+            const char **str = (const char**)((char*)track + field->offset);
+            sbuf_reset(&joined);
+            *str = extract_string_var(&value, &joined, &err);
+            if (NULL == *str && joined.len > 0) {
+                *str = arena_strdup(&track->joined, joined.data);
             }
+        } else {
+            load_field_value(track, field, &value, &err);
         }
-        if (!dbus_message_iter_has_next(&arrayIter)) {
-            break;
+        if (dbus_error_is_set(&err)) {
+            fprintf(stderr, "error: %s, %s\n", field->key, err.message);
+            dbus_error_free(&err);
         }
-        dbus_message_iter_next(&arrayIter);
     }
+    track->pending &= ~pending;
+    sbuf_free(&joined);
 }
 
-void get_player_identity(char *identity, DBusConnection *conn, const char* destination)
+/**
+ * Returns the position of the player at the monotonic time now, extrapolated from the last one loaded
+ * while it is playing. It doesn't go past the end of the track, as the players signal the next one.
+ */
+uint64_t mpris_properties_position(mpris_properties *properties, const int64_t now)
 {
-    if (NULL == conn) { return; }
-    if (NULL == destination) { return; }
-    if (NULL == identity) { return; }
-    if (strncmp(MPRIS_PLAYER_NAMESPACE, destination, strlen(MPRIS_PLAYER_NAMESPACE)) != 0) { return; }
+    if (properties->position_time == 0 || now <= properties->position_time) { return properties->position; }
+    if (parse_playback_status(properties->playback_status) != mpris_playback_playing) { return properties->position; }
+
+    // the players which don't report the rate play at the normal one
+    const double rate = properties->rate > 0 ? properties->rate : 1.0;
+    const uint64_t position = properties->position + (uint64_t)((now - properties->position_time) * rate);
+
+    mpris_metadata_decode(&properties->metadata, 1u << mpris_meta_length);
+    const uint64_t length = properties->metadata.length;
+    return length > 0 && position > length ? length : position;
+}
+
+/**
+ * Returns the variant holding the value of any key of the metadata, or NULL if it's missing.
+ */
+const DBusMessageIter *mpris_metadata_find(const mpris_metadata *track, const char *key)
+{
+    for (int i = 0; i < track->entry_count; i++) {
+        if (strcmp(track->entries[i].key, key) == 0) {
+            return &track->entries[i].value;
+        }
+    }
+    return NULL;
+}
+
+DBusMessage* player_property_request(const char* destination, const char* interface, const char* property)
+{
+    if (NULL == destination) { return NULL; }
+    if (strncmp(MPRIS_PLAYER_NAMESPACE, destination, strlen(MPRIS_PLAYER_NAMESPACE)) != 0) { return NULL; }
 
-    DBusPendingCall* pending;
     DBusMessageIter params;
 
-    const char *interface = DBUS_INTERFACE_PROPERTIES;
     const char *method = DBUS_METHOD_GET;
     const char *path = MPRIS_PLAYER_PATH;
-    const char *arg_interface = MPRIS_PLAYER_NAMESPACE;
-    const char *arg_identity = MPRIS_ARG_PLAYER_IDENTITY;
-
-    DBusError err = {0};
-    dbus_error_init(&err);
 
     // create a new method call and check for errors
-    DBusMessage* msg = dbus_message_new_method_call(destination, path, interface, method);
-    if (NULL == msg) { return; }
+    DBusMessage* msg = dbus_message_new_method_call(destination, path, DBUS_INTERFACE_PROPERTIES, method);
+    if (NULL == msg) { return NULL; }
 
     // append interface we want to get the property from
     dbus_message_iter_init_append(msg, &params);
-    if (!dbus_message_iter_append_basic(&params, DBUS_TYPE_STRING, &arg_interface)) {
+    if (!dbus_message_iter_append_basic(&params, DBUS_TYPE_STRING, &interface)) {
         goto _unref_message_err;
     }
 
     dbus_message_iter_init_append(msg, &params);
-    if (!dbus_message_iter_append_basic(&params, DBUS_TYPE_STRING, &arg_identity)) {
+    if (!dbus_message_iter_append_basic(&params, DBUS_TYPE_STRING, &property)) {
         goto _unref_message_err;
     }
+    return msg;
 
-    // send message and get a handle for a reply
-    if (!dbus_connection_send_with_reply (conn, msg, &pending, DBUS_CONNECTION_TIMEOUT)) {
-        goto _unref_message_err;
-    }
-    if (NULL == pending) {
-        goto _unref_message_err;
-    }
-    dbus_connection_flush(conn);
+_unref_message_err:
+    // free message
+    dbus_message_unref(msg);
+    return NULL;
+}
 
-    // block until we receive a reply
-    dbus_pending_call_block(pending);
+DBusMessage* player_identity_request(const char* destination)
+{
+    return player_property_request(destination, MPRIS_PLAYER_NAMESPACE, MPRIS_ARG_PLAYER_IDENTITY);
+}
 
-    DBusMessage* reply;
-    // get the reply message
-    reply = dbus_pending_call_steal_reply(pending);
-    if (NULL == reply) { goto _unref_pending_err; }
+void load_player_identity(mpris_properties *properties, DBusMessage* reply)
+{
+    if (NULL == properties) { return; }
+    if (NULL == reply) { return; }
+    if (dbus_message_get_type(reply) == DBUS_MESSAGE_TYPE_ERROR) { return; }
+
+    DBusError err = {0};
+    dbus_error_init(&err);
 
     DBusMessageIter rootIter;
     if (dbus_message_iter_init(reply, &rootIter)) {
-        extract_string_var(identity, &rootIter, &err);
+        properties->player_identity = extract_string_var(&rootIter, NULL, &err);
+        retain_property_source(properties, mpris_source_identity, reply);
     }
     if (dbus_error_is_set(&err)) {
         fprintf(stderr, "error: %s\n", err.message);
         dbus_error_free(&err);
     }
+}
 
-    dbus_message_unref(reply);
-_unref_pending_err:
-    if (dbus_error_is_set(&err)) {
-        fprintf(stderr, "error: %s\n", err.message);
-        dbus_error_free(&err);
-    }
+void get_player_identity(mpris_properties *properties, DBusConnection *conn, const char* destination)
+{
+    if (NULL == conn) { return; }
+    if (NULL == properties) { return; }
 
-    // free the pending message handle
-    dbus_pending_call_unref(pending);
-_unref_message_err:
+    DBusMessage* msg = player_identity_request(destination);
+    if (NULL == msg) { return; }
+
+    DBusPendingCall* pending = send_dbus_message(conn, msg);
     // free message
     dbus_message_unref(msg);
+    if (NULL == pending) { return; }
+    dbus_connection_flush(conn);
+
+    DBusMessage* reply = wait_dbus_reply(pending);
+    if (NULL == reply) { return; }
+
+    load_player_identity(properties, reply);
+    dbus_message_unref(reply);
+    trace_reply_decoded();
 }
 
-void load_mpris_properties(DBusConnection* conn, const char* destination, mpris_properties *properties)
+DBusMessage* mpris_properties_request(const char* destination)
 {
-    if (NULL == conn) { return; }
-    if (NULL == destination) { return; }
+    if (NULL == destination) { return NULL; }
 
-    DBusPendingCall* pending;
     DBusMessageIter params;
 
-    DBusError err = {0};
-    dbus_error_init(&err);
-
     const char* interface = DBUS_INTERFACE_PROPERTIES;
     const char* method = DBUS_METHOD_GET_ALL;
     const char* path = MPRIS_PLAYER_PATH;
@@ -465,403 +942,421 @@ void load_mpris_properties(DBusConnection* conn, const char* destination, mpris_
 
     // create a new method call and check for errors
     DBusMessage* msg = dbus_message_new_method_call(destination, path, interface, method);
-    if (NULL == msg) { return; }
+    if (NULL == msg) { return NULL; }
 
     // append interface we want to get the property from
     dbus_message_iter_init_append(msg, &params);
     if (!dbus_message_iter_append_basic(&params, DBUS_TYPE_STRING, &arg_interface)) {
-        goto _unref_message_err;
+        dbus_message_unref(msg);
+        return NULL;
     }
+    return msg;
+}
 
-    // send message and get a handle for a reply
-    if (!dbus_connection_send_with_reply (conn, msg, &pending, DBUS_CONNECTION_TIMEOUT)) {
-        goto _unref_message_err;
-    }
-    if (NULL == pending) {
-        goto _unref_message_err;
-    }
-    dbus_connection_flush(conn);
-    // block until we receive a reply
-    dbus_pending_call_block(pending);
+void load_string_property(mpris_properties *properties, const char **field, const enum mpris_source source, DBusMessageIter *iter, DBusMessage *msg, DBusError *err)
+{
+    *field = extract_string_var(iter, NULL, err);
+    retain_property_source(properties, source, msg);
+}
 
-    DBusMessage* reply;
-    // get the reply message
-    reply = dbus_pending_call_steal_reply(pending);
-    if (NULL == reply) {
-        goto _unref_pending_err;
+/**
+ * Loads a property from the iterator, the strings are borrowed from the message it belongs to.
+ */
+void load_property(mpris_properties *properties, const char* key, DBusMessageIter *iter, DBusMessage *msg, DBusError *err)
+{
+    const mpris_field *field = find_field(mpris_properties_slots, key);
+    if (NULL == field) { return; }
+
+    switch (field->type) {
+        case mpris_field_string:
+            load_string_property(properties, (const char**)((char*)properties + field->offset), field->source, iter, msg, err);
+            break;
+        case mpris_field_metadata:
+            // the metadata is always sent as a whole, clear the fields of the previous track
+            mpris_metadata_free(&properties->metadata);
+            load_metadata(&properties->metadata, iter);
+            retain_property_source(properties, field->source, msg);
+            break;
+        case mpris_field_position:
+            load_field_value(properties, field, iter, err);
+            properties->position_time = mpris_now();
+            break;
+        default:
+            load_field_value(properties, field, iter, err);
+            break;
     }
+}
+
+void load_properties(mpris_properties *properties, DBusMessage* reply)
+{
+    if (NULL == properties) { return; }
+    if (NULL == reply) { return; }
+    if (dbus_message_get_type(reply) == DBUS_MESSAGE_TYPE_ERROR) { return; }
+
+    DBusError err = {0};
+    dbus_error_init(&err);
+
     DBusMessageIter rootIter;
     if (dbus_message_iter_init(reply, &rootIter) && DBUS_TYPE_ARRAY == dbus_message_iter_get_arg_type(&rootIter)) {
         DBusMessageIter arrayElementIter;
 
         dbus_message_iter_recurse(&rootIter, &arrayElementIter);
-        while (true) {
-            char* key;
-            if (DBUS_TYPE_DICT_ENTRY == dbus_message_iter_get_arg_type(&arrayElementIter)) {
-                DBusMessageIter dictIter;
-                dbus_message_iter_recurse(&arrayElementIter, &dictIter);
-                if (DBUS_TYPE_STRING != dbus_message_iter_get_arg_type(&dictIter)) {
-                    dbus_set_error_const(&err, "missing_key", "This message iterator doesn't have key");
-                }
-                dbus_message_iter_get_basic(&dictIter, &key);
+        while (DBUS_TYPE_DICT_ENTRY == dbus_message_iter_get_arg_type(&arrayElementIter)) {
+            DBusMessageIter dictIter;
+            dbus_message_iter_recurse(&arrayElementIter, &dictIter);
+            dbus_message_iter_next(&arrayElementIter);
 
-                if (!dbus_message_iter_has_next(&dictIter)) {
-                    continue;
-                }
-                dbus_message_iter_next(&dictIter);
+            const char* key = NULL;
+            if (DBUS_TYPE_STRING != dbus_message_iter_get_arg_type(&dictIter)) { continue; }
+            dbus_message_iter_get_basic(&dictIter, &key);
+            if (!dbus_message_iter_next(&dictIter)) { continue; }
 
-                if (!strncmp(key, MPRIS_PNAME_CANCONTROL, strlen(MPRIS_PNAME_CANCONTROL))) {
-                    properties->can_control = extract_boolean_var(&dictIter, &err);
-                }
-                if (!strncmp(key, MPRIS_PNAME_CANGONEXT, strlen(MPRIS_PNAME_CANGONEXT))) {
-                    properties->can_go_next = extract_boolean_var(&dictIter, &err);
-                }
-                if (!strncmp(key, MPRIS_PNAME_CANGOPREVIOUS, strlen(MPRIS_PNAME_CANGOPREVIOUS))) {
-                    properties->can_go_previous = extract_boolean_var(&dictIter, &err);
-                }
-                if (!strncmp(key, MPRIS_PNAME_CANPAUSE, strlen(MPRIS_PNAME_CANPAUSE))) {
-                    properties->can_pause = extract_boolean_var(&dictIter, &err);
-                }
-                if (!strncmp(key, MPRIS_PNAME_CANPLAY, strlen(MPRIS_PNAME_CANPLAY))) {
-                    properties->can_play = extract_boolean_var(&dictIter, &err);
-                }
-                if (!strncmp(key, MPRIS_PNAME_CANSEEK, strlen(MPRIS_PNAME_CANSEEK))) {
-                    properties->can_seek = extract_boolean_var(&dictIter, &err);
-                }
-                if (!strncmp(key, MPRIS_PNAME_LOOPSTATUS, strlen(MPRIS_PNAME_LOOPSTATUS))) {
-                    extract_string_var(properties->loop_status, &dictIter, &err);
-                }
-                if (!strncmp(key, MPRIS_PNAME_METADATA, strlen(MPRIS_PNAME_METADATA))) {
-                    load_metadata(&properties->metadata, &dictIter);
-                }
-                if (!strncmp(key, MPRIS_PNAME_PLAYBACKSTATUS, strlen(MPRIS_PNAME_PLAYBACKSTATUS))) {
-                    extract_string_var(properties->playback_status, &dictIter, &err);
-                }
-                if (!strncmp(key, MPRIS_PNAME_POSITION, strlen(MPRIS_PNAME_POSITION))) {
-                    properties->position= extract_int64_var(&dictIter, &err);
-                }
-                if (!strncmp(key, MPRIS_PNAME_SHUFFLE, strlen(MPRIS_PNAME_SHUFFLE))) {
-                    properties->shuffle = extract_boolean_var(&dictIter, &err);
-                }
-                if (!strncmp(key, MPRIS_PNAME_VOLUME, strlen(MPRIS_PNAME_VOLUME))) {
-                    properties->volume = extract_double_var(&dictIter, &err);
-                }
-                if (dbus_error_is_set(&err)) {
-                    fprintf(stderr, "error: %s\n", err.message);
-                    dbus_error_free(&err);
-                }
-            }
-            if (!dbus_message_iter_has_next(&arrayElementIter)) {
-                break;
+            load_property(properties, key, &dictIter, reply, &err);
+            if (dbus_error_is_set(&err)) {
+                fprintf(stderr, "error: %s\n", err.message);
+                dbus_error_free(&err);
             }
-            dbus_message_iter_next(&arrayElementIter);
         }
     }
-    dbus_message_unref(reply);
-    // free the pending message handle
-    dbus_pending_call_unref(pending);
-    // free message
-    dbus_message_unref(msg);
-
-    const size_t mprisIntfLen = strlen(MPRIS_MEDIA_PLAYER_INTERFACE) + 1; // to include the .
-    const size_t fullDBusNameLen = strlen(destination);
-
-    if (fullDBusNameLen > mprisIntfLen) {
-        memcpy(properties->player_name, &destination[mprisIntfLen], fullDBusNameLen-mprisIntfLen);
-    }
-    get_player_identity(properties->player_identity, conn, destination);
-    return;
-
-_unref_pending_err:
-    {
-        dbus_pending_call_unref(pending);
-        goto _unref_message_err;
-    }
-_unref_message_err:
-    {
-        dbus_message_unref(msg);
-    }
-    return;
 }
 
-int seek(DBusConnection* conn, const mpris_player player, const int ms)
+void load_property_from_reply(mpris_properties *properties, const char* key, DBusMessage* reply)
 {
-    if (NULL == conn) { return 0; }
-    int status = 0;
-
-
-    DBusPendingCall* pending;
-    DBusMessageIter args;
+    if (NULL == properties) { return; }
+    if (NULL == reply) { return; }
+    if (dbus_message_get_type(reply) == DBUS_MESSAGE_TYPE_ERROR) { return; }
 
     DBusError err = {0};
     dbus_error_init(&err);
 
-    // create a new method call and check for errors
-    DBusMessage* msg = dbus_message_new_method_call(player.name, MPRIS_PLAYER_PATH, MPRIS_MEDIA_PLAYER_PLAYER_INTERFACE, MPRIS_METHOD_SEEK);
-    if (NULL == msg) { return status; }
-
-    const int64_t usec = ms * 1000;
-    dbus_message_iter_init_append(msg, &args);
-    if (!dbus_message_iter_append_basic(&args, DBUS_TYPE_INT64, &usec)) {
-        status = -1;
-        goto _unref_message_err;
-    }
-
-    // send message and get a handle for a reply
-    if (!dbus_connection_send_with_reply (conn, msg, &pending, DBUS_CONNECTION_TIMEOUT) || NULL == pending) {
-        status = -1;
-        goto _unref_message_err;
-    }
-    dbus_connection_flush(conn);
-
-    // block until we receive a reply
-    dbus_pending_call_block(pending);
-
-    DBusMessage* reply = NULL;
-    // get the reply message
-    reply = dbus_pending_call_steal_reply(pending);
-    if (NULL == reply) {
-        status = -1;
-        goto _unref_pending_err;
+    DBusMessageIter rootIter;
+    if (dbus_message_iter_init(reply, &rootIter)) {
+        load_property(properties, key, &rootIter, reply, &err);
     }
-
-    dbus_message_unref(reply);
     if (dbus_error_is_set(&err)) {
-        fprintf(stderr, "error: %s\n", err.message);
+        fprintf(stderr, "error: %s, %s\n", key, err.message);
         dbus_error_free(&err);
-        status = -1;
     }
+}
 
-_unref_pending_err:
-    // free the pending message handle
-    dbus_pending_call_unref(pending);
-_unref_message_err:
-    // free message
-    dbus_message_unref(msg);
+/**
+ * Returns the name of the player, which is the suffix of its bus name after the MPRIS namespace.
+ */
+const char* get_player_name(const char* destination)
+{
+    const size_t mprisIntfLen = strlen(MPRIS_MEDIA_PLAYER_INTERFACE) + 1; // to include the .
+    const size_t fullDBusNameLen = strlen(destination);
 
-    return status;
+    if (fullDBusNameLen > mprisIntfLen) {
+        return &destination[mprisIntfLen];
+    }
+    return "";
 }
 
-int shuffle(DBusConnection* conn, const mpris_player player, const bool *state)
+void load_player_name(mpris_properties *properties, const char* destination)
 {
-    if (NULL == conn) { return 0; }
-    int status = 0;
+    // the name is a suffix of the destination, which lives as long as the player
+    properties->player_name = get_player_name(destination);
+}
 
-    DBusError err = {0};
-    dbus_error_init(&err);
+void load_mpris_properties(DBusConnection* conn, const char* destination, mpris_properties *properties)
+{
+    if (NULL == conn) { return; }
+    if (NULL == destination) { return; }
 
-    DBusPendingCall* pending;
-    DBusMessageIter args;
+    DBusMessage* msg = mpris_properties_request(destination);
+    if (NULL == msg) { return; }
 
-    char* arg_interface = MPRIS_MEDIA_PLAYER_PLAYER_INTERFACE;
-    char* arg_shuffle = MPRIS_PNAME_SHUFFLE;
+    DBusPendingCall* pending = send_dbus_message(conn, msg);
+    // free message
+    dbus_message_unref(msg);
+    if (NULL == pending) { return; }
+    dbus_connection_flush(conn);
 
-    // create a new method call and check for errors
-    DBusMessage* msg = dbus_message_new_method_call(player.name, MPRIS_PLAYER_PATH, DBUS_INTERFACE_PROPERTIES, DBUS_METHOD_SET);
-    if (NULL == msg) { return status; }
+    DBusMessage* reply = wait_dbus_reply(pending);
+    if (NULL == reply) { return; }
 
-    dbus_message_iter_init_append(msg, &args);
+    load_properties(properties, reply);
+    dbus_message_unref(reply);
+    trace_reply_decoded();
 
-    if (!dbus_message_iter_append_basic(&args, DBUS_TYPE_STRING, &arg_interface)) {
-        goto _unref_message_err;
-    }
+    load_player_name(properties, destination);
+    get_player_identity(properties, conn, destination);
+}
 
-    if (!dbus_message_iter_append_basic(&args, DBUS_TYPE_STRING, &arg_shuffle)) {
-        goto _unref_message_err;
+int count_properties(const unsigned properties)
+{
+    int count = 0;
+    for (int i = 0; i < MPRIS_PROPERTY_NAMES_COUNT; i++) {
+        if (properties & mpris_property_names[i].property) {
+            count++;
+        }
     }
+    return count;
+}
 
-    DBusMessageIter variant = {0};
-    if (!dbus_message_iter_open_container(&args, DBUS_TYPE_VARIANT, DBUS_TYPE_BOOLEAN_AS_STRING, &variant)) {
-        goto _unref_message_err;
-    }
-    if (!dbus_message_iter_append_basic(&variant, DBUS_TYPE_BOOLEAN, state)) {
-        goto _unref_message_err;
-    }
-    if (!dbus_message_iter_close_container(&args, &variant)) {
-        goto _unref_message_err;
-    }
+// The requests loading the properties of a player: one for each property, one for GetAll and one for the identity
+#define MPRIS_REQUEST_SLOTS    (MPRIS_PROPERTY_NAMES_COUNT + 2)
+#define MPRIS_REQUEST_GET_ALL  MPRIS_PROPERTY_NAMES_COUNT
+#define MPRIS_REQUEST_IDENTITY (MPRIS_PROPERTY_NAMES_COUNT + 1)
 
-    // send message and get a handle for a reply
-    if (!dbus_connection_send_with_reply (conn, msg, &pending, DBUS_CONNECTION_TIMEOUT) || NULL == pending) {
-        goto _unref_message_err;
+/**
+ * Builds the requests loading the properties flagged in the mask for a player, using individual
+ * Get calls when there are few of them, or one GetAll call otherwise. The identity is requested
+ * only when it wasn't recorded. The slots of the requests which aren't needed are left NULL.
+ */
+void mpris_player_requests(const mpris_player *player, const unsigned properties, DBusMessage *requests[MPRIS_REQUEST_SLOTS])
+{
+    if (count_properties(properties) > MPRIS_PROPERTIES_GET_THRESHOLD) {
+        requests[MPRIS_REQUEST_GET_ALL] = mpris_properties_request(player->name);
+    } else {
+        for (int j = 0; j < MPRIS_PROPERTY_NAMES_COUNT; j++) {
+            if (!(properties & mpris_property_names[j].property)) { continue; }
+            requests[j] = player_property_request(player->name, MPRIS_MEDIA_PLAYER_PLAYER_INTERFACE, mpris_property_names[j].name);
+        }
     }
-    dbus_connection_flush(conn);
-
-    // block until we receive a reply
-    dbus_pending_call_block(pending);
-
-    DBusMessage* reply = NULL;
-    // get the reply message
-    reply = dbus_pending_call_steal_reply(pending);
-    if (NULL == reply) {
-        goto _unref_pending_err;
+    if ((properties & mpris_prop_identity) && NULL == player->identity) {
+        requests[MPRIS_REQUEST_IDENTITY] = player_identity_request(player->name);
     }
+}
 
-    dbus_message_unref(reply);
-
-_unref_pending_err:
-    if (dbus_error_is_set(&err)) {
-        fprintf(stderr, "error: %s\n", err.message);
-        dbus_error_free(&err);
-        status = -1;
+/**
+ * Loads the reply to the request in the slot into the properties of the player.
+ */
+void load_mpris_player_reply(mpris_player *player, const int slot, DBusMessage *reply)
+{
+    if (slot == MPRIS_REQUEST_GET_ALL) {
+        load_properties(player->properties, reply);
+    } else if (slot == MPRIS_REQUEST_IDENTITY) {
+        load_player_identity(player->properties, reply);
+    } else if (slot >= 0 && slot < MPRIS_PROPERTY_NAMES_COUNT) {
+        load_property_from_reply(player->properties, mpris_property_names[slot].name, reply);
     }
-
-    // free the pending message handle
-    dbus_pending_call_unref(pending);
-_unref_message_err:
-    // free message
-    dbus_message_unref(msg);
-
-    return status;
 }
 
-int set_loopstatus(DBusConnection* conn, const mpris_player player, const char* loop_state)
+/**
+ * Completes the properties of a player after its replies were loaded: the identity recorded for it
+ * is used, and its status follows the loaded playback status.
+ */
+void mpris_player_loaded(mpris_player *player)
 {
-    if (NULL == conn) { return 0; }
-    int status = 0;
-
-    DBusError err = {0};
-    dbus_error_init(&err);
-
-    DBusPendingCall* pending;
-    DBusMessageIter args;
-
-    char* arg_interface = MPRIS_MEDIA_PLAYER_PLAYER_INTERFACE;
-    char* arg_loopstatus = MPRIS_PNAME_LOOPSTATUS;
-
-    // create a new method call and check for errors
-    DBusMessage* msg = dbus_message_new_method_call(player.name, MPRIS_PLAYER_PATH, DBUS_INTERFACE_PROPERTIES, DBUS_METHOD_SET);
-    if (NULL == msg) { return status; }
-
-    dbus_message_iter_init_append(msg, &args);
-
-    if (!dbus_message_iter_append_basic(&args, DBUS_TYPE_STRING, &arg_interface)) {
-        goto _unref_message_err;
+    if (NULL != player->properties && NULL != player->identity) {
+        player->properties->player_identity = player->identity;
     }
+    update_player_status(player);
+}
 
-    if (!dbus_message_iter_append_basic(&args, DBUS_TYPE_STRING, &arg_loopstatus)) {
-        goto _unref_message_err;
-    }
+/**
+ * Loads the requested properties of all the players at once:
+ * all the requests are sent on the connection with a single flush and only afterwards
+ * we wait for the replies, so the total latency is bounded by the slowest player
+ * instead of being the sum of all the round trips.
+ *
+ * The players without allocated properties are skipped.
+ */
+void load_mpris_players_properties(DBusConnection* conn, mpris_player *players, const int player_count, const unsigned properties)
+{
+    if (NULL == conn) { return; }
+    if (NULL == players) { return; }
+    if (player_count <= 0) { return; }
 
-    DBusMessageIter variant = {0};
-    if (!dbus_message_iter_open_container(&args, DBUS_TYPE_VARIANT, DBUS_TYPE_STRING_AS_STRING, &variant)) {
-        goto _unref_message_err;
-    }
-    if (!dbus_message_iter_append_basic(&variant, DBUS_TYPE_STRING, &loop_state)) {
-        goto _unref_message_err;
+    for (int i = 0; i < player_count; i++) {
+        if (NULL == players[i].properties) { continue; }
+        load_player_name(players[i].properties, players[i].name);
     }
-    if (!dbus_message_iter_close_container(&args, &variant)) {
-        goto _unref_message_err;
+    if (count_properties(properties) == 0 && !(properties & mpris_prop_identity)) {
+        return;
     }
 
-    // send message and get a handle for a reply
-    if (!dbus_connection_send_with_reply (conn, msg, &pending, DBUS_CONNECTION_TIMEOUT) || NULL == pending) {
-        goto _unref_message_err;
-    }
-    dbus_connection_flush(conn);
+    // with many players the pending calls don't fit on the stack
+    DBusPendingCall* (*pending)[MPRIS_REQUEST_SLOTS] = calloc(player_count, sizeof(*pending));
+    if (NULL == pending) { return; }
 
-    // block until we receive a reply
-    dbus_pending_call_block(pending);
+    for (int i = 0; i < player_count; i++) {
+        mpris_player *player = &players[i];
+        if (NULL == player->properties) { continue; }
 
-    DBusMessage* reply = NULL;
-    // get the reply message
-    reply = dbus_pending_call_steal_reply(pending);
-    if (NULL == reply) {
-        goto _unref_pending_err;
+        DBusMessage *requests[MPRIS_REQUEST_SLOTS] = {0};
+        mpris_player_requests(player, properties, requests);
+        for (int j = 0; j < MPRIS_REQUEST_SLOTS; j++) {
+            if (NULL == requests[j]) { continue; }
+            pending[i][j] = send_dbus_message(conn, requests[j]);
+            dbus_message_unref(requests[j]);
+        }
     }
+    dbus_connection_flush(conn);
 
-    dbus_message_unref(reply);
+    for (int i = 0; i < player_count; i++) {
+        mpris_player *player = &players[i];
 
-_unref_pending_err:
-    if (dbus_error_is_set(&err)) {
-        fprintf(stderr, "error: %s\n", err.message);
-        dbus_error_free(&err);
-        status = -1;
-    }
+        for (int j = 0; j < MPRIS_REQUEST_SLOTS; j++) {
+            if (NULL == pending[i][j]) { continue; }
 
-    // free the pending message handle
-    dbus_pending_call_unref(pending);
-_unref_message_err:
-    // free message
-    dbus_message_unref(msg);
+            DBusMessage* reply = wait_dbus_reply(pending[i][j]);
+            if (NULL == reply) { continue; }
 
-    return status;
+            load_mpris_player_reply(player, j, reply);
+            dbus_message_unref(reply);
+            trace_reply_decoded();
+        }
+        mpris_player_loaded(player);
+    }
+    free(pending);
 }
 
-int set_volume(DBusConnection* conn, const mpris_player player, const double volume)
+/**
+ * Loads only the playback status of all the players, which is what they are selected by,
+ * with all the requests pipelined. When the volume is flagged in the mask, it's loaded in the
+ * same round trip. The properties of the players are left untouched.
+ */
+void load_mpris_players_status(DBusConnection* conn, mpris_player *players, const int player_count, const unsigned properties)
 {
-    if (NULL == conn) { return 0; }
-    int status = 0;
+    if (NULL == conn) { return; }
+    if (NULL == players) { return; }
+    if (player_count <= 0) { return; }
+
+    // the status of every player, followed by its volume
+    DBusPendingCall* (*pending)[2] = calloc(player_count, sizeof(*pending));
+    if (NULL == pending) { return; }
+
+    const char *names[2] = {MPRIS_PNAME_PLAYBACKSTATUS, (properties & mpris_prop_volume) ? MPRIS_PNAME_VOLUME : NULL};
+    for (int i = 0; i < player_count; i++) {
+        if (players[i].quarantined) { continue; }
+        for (int j = 0; j < 2 && NULL != names[j]; j++) {
+            DBusMessage* msg = player_property_request(players[i].name, MPRIS_MEDIA_PLAYER_PLAYER_INTERFACE, names[j]);
+            if (NULL == msg) { continue; }
+            pending[i][j] = send_dbus_message(conn, msg);
+            dbus_message_unref(msg);
+        }
+    }
+    dbus_connection_flush(conn);
 
     DBusError err = {0};
     dbus_error_init(&err);
+    for (int i = 0; i < player_count; i++) {
+        for (int j = 0; j < 2; j++) {
+            DBusMessage* reply = wait_dbus_reply(pending[i][j]);
+            if (NULL == reply) { continue; }
+
+            DBusMessageIter rootIter;
+            if (dbus_message_get_type(reply) != DBUS_MESSAGE_TYPE_ERROR && dbus_message_iter_init(reply, &rootIter)) {
+                if (j == 0) {
+                    players[i].status = parse_playback_status(extract_string_var(&rootIter, NULL, &err));
+                } else {
+                    players[i].volume = extract_double_var(&rootIter, &err);
+                }
+            }
+            if (dbus_error_is_set(&err)) {
+                fprintf(stderr, "error: %s\n", err.message);
+                dbus_error_free(&err);
+            }
+            dbus_message_unref(reply);
+            trace_reply_decoded();
+        }
+    }
+    free(pending);
+}
+
+DBusMessage* seek_request(const char* destination, const int ms)
+{
+    if (NULL == destination) { return NULL; }
+
+    DBusMessage* msg = dbus_message_new_method_call(destination, MPRIS_PLAYER_PATH, MPRIS_MEDIA_PLAYER_PLAYER_INTERFACE, MPRIS_METHOD_SEEK);
+    if (NULL == msg) { return NULL; }
 
-    DBusPendingCall* pending;
     DBusMessageIter args;
+    const int64_t usec = (int64_t)ms * 1000;
+    dbus_message_iter_init_append(msg, &args);
+    if (!dbus_message_iter_append_basic(&args, DBUS_TYPE_INT64, &usec)) {
+        dbus_message_unref(msg);
+        return NULL;
+    }
+    return msg;
+}
 
-    const char* arg_interface = MPRIS_MEDIA_PLAYER_PLAYER_INTERFACE;
-    const char* arg_volume = MPRIS_PNAME_VOLUME;
+/**
+ * Builds the message setting a property of the player interface, the value is of the basic D-Bus type.
+ */
+DBusMessage* player_property_set_request(const char* destination, const char* property, const int type, const void *value)
+{
+    if (NULL == destination) { return NULL; }
 
-    // create a new method call and check for errors
-    DBusMessage* msg = dbus_message_new_method_call(player.name, MPRIS_PLAYER_PATH, DBUS_INTERFACE_PROPERTIES, DBUS_METHOD_SET);
-    if (NULL == msg) { return status; }
+    DBusMessage* msg = dbus_message_new_method_call(destination, MPRIS_PLAYER_PATH, DBUS_INTERFACE_PROPERTIES, DBUS_METHOD_SET);
+    if (NULL == msg) { return NULL; }
 
-    dbus_message_iter_init_append(msg, &args);
+    const char* interface = MPRIS_MEDIA_PLAYER_PLAYER_INTERFACE;
+    const char signature[2] = { (char)type, 0 };
 
-    if (!dbus_message_iter_append_basic(&args, DBUS_TYPE_STRING, &arg_interface)) {
+    DBusMessageIter args;
+    dbus_message_iter_init_append(msg, &args);
+    if (!dbus_message_iter_append_basic(&args, DBUS_TYPE_STRING, &interface)) {
         goto _unref_message_err;
     }
-
-    if (!dbus_message_iter_append_basic(&args, DBUS_TYPE_STRING, &arg_volume)) {
+    if (!dbus_message_iter_append_basic(&args, DBUS_TYPE_STRING, &property)) {
         goto _unref_message_err;
     }
 
     DBusMessageIter variant = {0};
-    if (!dbus_message_iter_open_container(&args, DBUS_TYPE_VARIANT, DBUS_TYPE_DOUBLE_AS_STRING, &variant)) {
+    if (!dbus_message_iter_open_container(&args, DBUS_TYPE_VARIANT, signature, &variant)) {
         goto _unref_message_err;
     }
-    if (!dbus_message_iter_append_basic(&variant, DBUS_TYPE_DOUBLE, &volume)) {
+    if (!dbus_message_iter_append_basic(&variant, type, value)) {
+        dbus_message_iter_abandon_container(&args, &variant);
         goto _unref_message_err;
     }
     if (!dbus_message_iter_close_container(&args, &variant)) {
         goto _unref_message_err;
     }
+    return msg;
 
-    // send message and get a handle for a reply
-    if (!dbus_connection_send_with_reply (conn, msg, &pending, DBUS_CONNECTION_TIMEOUT) || NULL == pending) {
-        goto _unref_message_err;
-    }
-    dbus_connection_flush(conn);
-
-    // block until we receive a reply
-    dbus_pending_call_block(pending);
+_unref_message_err:
+    dbus_message_unref(msg);
+    return NULL;
+}
 
-    DBusMessage* reply = NULL;
-    // get the reply message
-    reply = dbus_pending_call_steal_reply(pending);
-    if (NULL == reply) {
-        goto _unref_pending_err;
-    }
+DBusMessage* shuffle_request(const char* destination, const bool state)
+{
+    // libdbus reads the booleans as dbus_bool_t, which is wider than bool
+    const dbus_bool_t value = state;
+    return player_property_set_request(destination, MPRIS_PNAME_SHUFFLE, DBUS_TYPE_BOOLEAN, &value);
+}
 
-    dbus_message_unref(reply);
+DBusMessage* loop_status_request(const char* destination, const char* loop_state)
+{
+    return player_property_set_request(destination, MPRIS_PNAME_LOOPSTATUS, DBUS_TYPE_STRING, &loop_state);
+}
 
-_unref_pending_err:
-    if (dbus_error_is_set(&err)) {
-        fprintf(stderr, "error: %s\n", err.message);
-        dbus_error_free(&err);
-        status = -1;
-    }
+DBusMessage* volume_request(const char* destination, const double volume)
+{
+    return player_property_set_request(destination, MPRIS_PNAME_VOLUME, DBUS_TYPE_DOUBLE, &volume);
+}
 
-    // free the pending message handle
-    dbus_pending_call_unref(pending);
-_unref_message_err:
-    // free message
-    dbus_message_unref(msg);
+/**
+ * Checks the reply of a method call, appending the error returned by the player, if any, to the buffer.
+ * Returns true if the call succeeded.
+ */
+bool check_dbus_reply(DBusMessage* reply, const char* destination, sbuf *errors)
+{
+    if (NULL == reply) { return false; }
+    if (dbus_message_get_type(reply) != DBUS_MESSAGE_TYPE_ERROR) { return true; }
 
-    return status;
+    DBusError err = {0};
+    dbus_error_init(&err);
+    dbus_set_error_from_message(&err, reply);
+    sbuf_append_str(errors, "error: ");
+    sbuf_append_str(errors, get_player_name(destination));
+    sbuf_append_str(errors, ": ");
+    sbuf_append_str(errors, NULL != err.message ? err.message : err.name);
+    sbuf_append_char(errors, '\n');
+    dbus_error_free(&err);
+    return false;
 }
 
-int load_mpris_players(DBusConnection* conn, mpris_player *players)
+/**
+ * Loads the bus names of the MPRIS players, growing the player table as needed.
+ * The names are allocated in the arena.
+ */
+int load_mpris_players(DBusConnection* conn, mpris_player **players, int *cap, arena *names)
 {
     if (NULL == conn) { return 0; }
     if (NULL == players) { return 0; }
@@ -871,40 +1366,37 @@ int load_mpris_players(DBusConnection* conn, mpris_player *players)
     const char* path = DBUS_PATH;
     const char* interface = DBUS_INTERFACE_DBUS;
 
-    DBusPendingCall* pending;
     int cnt = 0;
 
     // create a new method call and check for errors
     DBusMessage* msg = dbus_message_new_method_call(bus, path, interface, method);
     if (NULL == msg) { return cnt; }
 
-    // send message and get a handle for a reply
-    if (!dbus_connection_send_with_reply (conn, msg, &pending, DBUS_CONNECTION_TIMEOUT) ||
-        NULL == pending) {
-        goto _unref_message_err;
-    }
+    DBusPendingCall* pending = send_dbus_message(conn, msg);
+    // free message
+    dbus_message_unref(msg);
+    if (NULL == pending) { return cnt; }
     dbus_connection_flush(conn);
 
-    // block until we receive a reply
-    dbus_pending_call_block(pending);
-
-    DBusMessage* reply = NULL;
-    // get the reply message
-    reply = dbus_pending_call_steal_reply(pending);
-    if (NULL == reply) { goto _unref_pending_err; }
+    DBusMessage* reply = wait_dbus_reply(pending);
+    if (NULL == reply) { return cnt; }
 
     DBusMessageIter rootIter;
     if (dbus_message_iter_init(reply, &rootIter) && DBUS_TYPE_ARRAY == dbus_message_iter_get_arg_type(&rootIter)) {
         DBusMessageIter arrayElementIter;
 
         dbus_message_iter_recurse(&rootIter, &arrayElementIter);
-        while (cnt < MAX_PLAYERS) {
+        while (true) {
             if (DBUS_TYPE_STRING == dbus_message_iter_get_arg_type(&arrayElementIter)) {
                 char *str = NULL;
                 dbus_message_iter_get_basic(&arrayElementIter, &str);
-                if (!strncmp(str, MPRIS_PLAYER_NAMESPACE, strlen(MPRIS_PLAYER_NAMESPACE))) {
-                    memcpy(players[cnt].name, str, strlen(str)+1);
-                    cnt++;
+                if (!strncmp(str, MPRIS_PLAYER_NAMESPACE, strlen(MPRIS_PLAYER_NAMESPACE)) && reserve_players(players, cap, cnt + 1)) {
+                    mpris_player *player = &(*players)[cnt];
+                    memset(player, 0, sizeof(mpris_player));
+                    player->name = arena_strdup(names, str);
+                    if (NULL != player->name) {
+                        cnt++;
+                    }
                 }
             }
             if (!dbus_message_iter_has_next(&arrayElementIter)) {
@@ -914,11 +1406,278 @@ int load_mpris_players(DBusConnection* conn, mpris_player *players)
         }
     }
     dbus_message_unref(reply);
-_unref_pending_err:
-    // free the pending message handle
-    dbus_pending_call_unref(pending);
-_unref_message_err:
-    // free message
-    dbus_message_unref(msg);
+    trace_reply_decoded();
     return cnt;
 }
+
+DBusMessage* name_owner_request(const char* name)
+{
+    if (NULL == name) { return NULL; }
+
+    DBusMessage* msg = dbus_message_new_method_call(DBUS_SERVICE_DBUS, DBUS_PATH, DBUS_INTERFACE_DBUS, DBUS_METHOD_GET_NAME_OWNER);
+    if (NULL == msg) { return NULL; }
+
+    if (!dbus_message_append_args(msg, DBUS_TYPE_STRING, &name, DBUS_TYPE_INVALID)) {
+        dbus_message_unref(msg);
+        return NULL;
+    }
+    return msg;
+}
+
+/**
+ * Loads the unique connection names for the players which don't have one yet, with all the requests pipelined.
+ * The names are allocated in the arena.
+ */
+void load_mpris_players_owners(DBusConnection* conn, mpris_player *players, const int player_count, arena *names)
+{
+    if (NULL == conn) { return; }
+    if (NULL == players) { return; }
+    if (player_count <= 0) { return; }
+
+    DBusPendingCall** pending = calloc(player_count, sizeof(DBusPendingCall*));
+    if (NULL == pending) { return; }
+
+    for (int i = 0; i < player_count; i++) {
+        if (NULL != players[i].unique_name) { continue; }
+        DBusMessage* msg = name_owner_request(players[i].name);
+        if (NULL != msg) {
+            pending[i] = send_dbus_message(conn, msg);
+            dbus_message_unref(msg);
+        }
+    }
+    dbus_connection_flush(conn);
+
+    for (int i = 0; i < player_count; i++) {
+        DBusMessage* reply = wait_dbus_reply(pending[i]);
+        if (NULL == reply) { continue; }
+
+        const char* owner = NULL;
+        if (dbus_message_get_type(reply) != DBUS_MESSAGE_TYPE_ERROR &&
+            dbus_message_get_args(reply, NULL, DBUS_TYPE_STRING, &owner, DBUS_TYPE_INVALID)) {
+            players[i].unique_name = arena_strdup(names, owner);
+        }
+        dbus_message_unref(reply);
+        trace_reply_decoded();
+    }
+    free(pending);
+}
+
+/**
+ * Subscribes the connection to the signals needed to keep the players up to date:
+ * PropertiesChanged for the MPRIS object, and NameOwnerChanged for the MPRIS bus names.
+ */
+void add_mpris_signal_matches(DBusConnection* conn, DBusError *err)
+{
+    if (NULL == conn) { return; }
+
+    dbus_bus_add_match(conn, MPRIS_PROPERTIES_CHANGED_MATCH, err);
+    if (dbus_error_is_set(err)) { return; }
+    dbus_bus_add_match(conn, MPRIS_NAME_OWNER_CHANGED_MATCH, err);
+    if (dbus_error_is_set(err)) { return; }
+    dbus_bus_add_match(conn, MPRIS_SEEKED_MATCH, err);
+}
+
+int find_player_by_owner(const mpris_player *players, const int player_count, const char *owner)
+{
+    if (NULL == owner) { return -1; }
+    for (int i = 0; i < player_count; i++) {
+        if (NULL != players[i].unique_name && strcmp(players[i].unique_name, owner) == 0) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+int find_player_by_name(const mpris_player *players, const int player_count, const char *name)
+{
+    if (NULL == name) { return -1; }
+    for (int i = 0; i < player_count; i++) {
+        if (strcmp(players[i].name, name) == 0) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+/**
+ * Loads the players with the given names, without listing all the names on the bus: the owner of
+ * each one is requested directly, with all the requests pipelined. The names can be given with or
+ * without the MPRIS prefix. The player names and their unique names are allocated in the arena.
+ * Returns the number of players loaded, or -1 if any of the names has no owner, which is
+ * the case for the players with an instance suffix, that can only be found by listing the bus.
+ */
+int load_mpris_players_by_name(DBusConnection* conn, const char **player_names, const int name_count, mpris_player **players, int *cap, arena *names)
+{
+    if (NULL == conn) { return -1; }
+    if (NULL == players) { return -1; }
+    if (name_count <= 0) { return -1; }
+
+    DBusPendingCall** pending = calloc(name_count, sizeof(DBusPendingCall*));
+    if (NULL == pending) { return -1; }
+
+    const char** bus_names = arena_alloc(names, name_count * sizeof(char*));
+    if (NULL == bus_names) { goto _free_pending; }
+
+    const size_t prefix_len = strlen(MPRIS_PLAYER_NAMESPACE);
+    for (int i = 0; i < name_count; i++) {
+        const char *name = player_names[i];
+        if (strncmp(name, MPRIS_PLAYER_NAMESPACE ".", prefix_len + 1) == 0) {
+            bus_names[i] = arena_strdup(names, name);
+        } else {
+            char *bus_name = arena_alloc(names, prefix_len + strlen(name) + 2);
+            if (NULL != bus_name) {
+                sprintf(bus_name, "%s.%s", MPRIS_PLAYER_NAMESPACE, name);
+            }
+            bus_names[i] = bus_name;
+        }
+        if (NULL == bus_names[i] || !dbus_validate_bus_name(bus_names[i], NULL)) {
+            continue;
+        }
+        DBusMessage* msg = name_owner_request(bus_names[i]);
+        if (NULL != msg) {
+            pending[i] = send_dbus_message(conn, msg);
+            dbus_message_unref(msg);
+        }
+    }
+    dbus_connection_flush(conn);
+
+    int cnt = 0;
+    for (int i = 0; i < name_count; i++) {
+        DBusMessage* reply = wait_dbus_reply(pending[i]);
+        if (NULL == reply) {
+            cnt = -1;
+            continue;
+        }
+
+        const char* owner = NULL;
+        // the error replies have a string argument too, the message
+        if (dbus_message_get_type(reply) == DBUS_MESSAGE_TYPE_ERROR ||
+            !dbus_message_get_args(reply, NULL, DBUS_TYPE_STRING, &owner, DBUS_TYPE_INVALID)) {
+            cnt = -1;
+        } else if (cnt >= 0 && find_player_by_name(*players, cnt, bus_names[i]) < 0 && reserve_players(players, cap, cnt + 1)) {
+            mpris_player *player = &(*players)[cnt];
+            memset(player, 0, sizeof(mpris_player));
+            player->name = bus_names[i];
+            player->unique_name = arena_strdup(names, owner);
+            cnt++;
+        }
+        dbus_message_unref(reply);
+        trace_reply_decoded();
+    }
+
+_free_pending:
+    free(pending);
+    return NULL == bus_names ? -1 : cnt;
+}
+
+bool is_name_owner_changed(DBusMessage *msg, const char **name, const char **old_owner, const char **new_owner)
+{
+    if (!dbus_message_is_signal(msg, DBUS_INTERFACE_DBUS, DBUS_SIGNAL_NAME_OWNER_CHANGED)) {
+        return false;
+    }
+    return dbus_message_get_args(msg, NULL, DBUS_TYPE_STRING, name, DBUS_TYPE_STRING, old_owner,
+        DBUS_TYPE_STRING, new_owner, DBUS_TYPE_INVALID);
+}
+
+/**
+ * Applies the payload of a PropertiesChanged signal to the player properties.
+ * Returns the mask of the properties that were invalidated without a value, which need to be
+ * loaded explicitly, or mpris_prop_none.
+ */
+unsigned load_properties_changed(mpris_properties *properties, DBusMessage *msg)
+{
+    unsigned invalidated = mpris_prop_none;
+    if (NULL == properties) { return invalidated; }
+    if (!dbus_message_is_signal(msg, DBUS_INTERFACE_PROPERTIES, DBUS_SIGNAL_PROPERTIES_CHANGED)) {
+        return invalidated;
+    }
+
+    DBusError err = {0};
+    dbus_error_init(&err);
+
+    DBusMessageIter rootIter;
+    if (!dbus_message_iter_init(msg, &rootIter) || DBUS_TYPE_STRING != dbus_message_iter_get_arg_type(&rootIter)) {
+        return invalidated;
+    }
+    const char *interface = NULL;
+    dbus_message_iter_get_basic(&rootIter, &interface);
+    const bool player_interface = strcmp(interface, MPRIS_MEDIA_PLAYER_PLAYER_INTERFACE) == 0;
+    const bool root_interface = strcmp(interface, MPRIS_MEDIA_PLAYER_INTERFACE) == 0;
+    if (!player_interface && !root_interface) {
+        return invalidated;
+    }
+
+    if (!dbus_message_iter_next(&rootIter) || DBUS_TYPE_ARRAY != dbus_message_iter_get_arg_type(&rootIter)) {
+        return invalidated;
+    }
+    // the position isn't signaled when the playback status, or the track, changes, so it is loaded again
+    bool position_moved = false;
+    bool position_loaded = false;
+
+    DBusMessageIter arrayIter;
+    dbus_message_iter_recurse(&rootIter, &arrayIter);
+    while (DBUS_TYPE_DICT_ENTRY == dbus_message_iter_get_arg_type(&arrayIter)) {
+        DBusMessageIter dictIter;
+        dbus_message_iter_recurse(&arrayIter, &dictIter);
+
+        const char *key = NULL;
+        if (DBUS_TYPE_STRING == dbus_message_iter_get_arg_type(&dictIter)) {
+            dbus_message_iter_get_basic(&dictIter, &key);
+        }
+        if (NULL != key && dbus_message_iter_next(&dictIter)) {
+            if (player_interface) {
+                position_moved |= strcmp(key, MPRIS_PNAME_PLAYBACKSTATUS) == 0 || strcmp(key, MPRIS_PNAME_METADATA) == 0 ||
+                    strcmp(key, MPRIS_PNAME_RATE) == 0;
+                position_loaded |= strcmp(key, MPRIS_PNAME_POSITION) == 0;
+                load_property(properties, key, &dictIter, msg, &err);
+            } else if (strcmp(key, MPRIS_ARG_PLAYER_IDENTITY) == 0) {
+                load_string_property(properties, &properties->player_identity, mpris_source_identity, &dictIter, msg, &err);
+            }
+        }
+        if (dbus_error_is_set(&err)) {
+            fprintf(stderr, "error: %s, %s\n", key, err.message);
+            dbus_error_free(&err);
+        }
+        dbus_message_iter_next(&arrayIter);
+    }
+    if (position_moved && !position_loaded) {
+        invalidated |= mpris_prop_position;
+    }
+
+    if (!dbus_message_iter_next(&rootIter) || DBUS_TYPE_ARRAY != dbus_message_iter_get_arg_type(&rootIter)) {
+        return invalidated;
+    }
+    dbus_message_iter_recurse(&rootIter, &arrayIter);
+    while (DBUS_TYPE_STRING == dbus_message_iter_get_arg_type(&arrayIter)) {
+        const char *key = NULL;
+        dbus_message_iter_get_basic(&arrayIter, &key);
+        if (root_interface && strcmp(key, MPRIS_ARG_PLAYER_IDENTITY) == 0) {
+            invalidated |= mpris_prop_identity;
+        }
+        for (int i = 0; player_interface && i < MPRIS_PROPERTY_NAMES_COUNT; i++) {
+            if (strcmp(key, mpris_property_names[i].name) == 0) {
+                invalidated |= mpris_property_names[i].property;
+            }
+        }
+        dbus_message_iter_next(&arrayIter);
+    }
+    return invalidated;
+}
+
+/**
+ * Applies the position of a Seeked signal to the player properties.
+ * Returns false if the message isn't a Seeked signal.
+ */
+bool load_seeked(mpris_properties *properties, DBusMessage *msg)
+{
+    if (!dbus_message_is_signal(msg, MPRIS_MEDIA_PLAYER_PLAYER_INTERFACE, MPRIS_SIGNAL_SEEKED)) {
+        return false;
+    }
+    dbus_int64_t position = 0;
+    if (!dbus_message_get_args(msg, NULL, DBUS_TYPE_INT64, &position, DBUS_TYPE_INVALID)) {
+        return false;
+    }
+    properties->position = position > 0 ? (uint64_t)position : 0;
+    properties->position_time = mpris_now();
+    return true;
+}
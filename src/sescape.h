@@ -0,0 +1,288 @@
+/**
+ * @author Marius Orcsik <marius@habarnam.ro>
+ */
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#define ESCAPE_NONE   "none"
+#define ESCAPE_JSON   "json"
+#define ESCAPE_SHELL  "shell"
+#define ESCAPE_PANGO  "pango"
+#define ESCAPE_XML    "xml"
+#define ESCAPE_CSV    "csv"
+
+/**
+ * The escaping applied to the values substituted in the output, so they can be embedded in another
+ * language without breaking it:
+ *  * json: the content of a JSON string, the quotes around it are left to the format
+ *  * shell: a single quoted word, which the shell reads back as the value
+ *  * pango, xml: the text of an element, or of an attribute, with the markup characters as entities
+ *  * csv: a field, quoted only when it contains a separator, a quote, or a new line
+ */
+enum escape_mode {
+    escape_none,
+    escape_json,
+    escape_shell,
+    escape_xml,
+    escape_csv,
+};
+
+const struct escape_mode_name {
+    const char *name;
+    enum escape_mode mode;
+} escape_mode_names[] = {
+    {ESCAPE_NONE, escape_none},
+    {ESCAPE_JSON, escape_json},
+    {ESCAPE_SHELL, escape_shell},
+    {ESCAPE_PANGO, escape_xml},
+    {ESCAPE_XML, escape_xml},
+    {ESCAPE_CSV, escape_csv},
+};
+
+/**
+ * The classes of the bytes, each mode has its own bit, set for the bytes it has to replace,
+ * or in the case of csv, for the bytes which require the field to be quoted.
+ */
+enum escape_class {
+    ec_json  = 1 << escape_json,
+    ec_shell = 1 << escape_shell,
+    ec_xml   = 1 << escape_xml,
+    ec_csv   = 1 << escape_csv,
+};
+
+// the control characters, only the white space among them is allowed in XML
+#define EC_CONTROL (ec_json | ec_xml)
+
+const unsigned char escape_classes[256] = {
+    [0x00] = EC_CONTROL, [0x01] = EC_CONTROL, [0x02] = EC_CONTROL, [0x03] = EC_CONTROL,
+    [0x04] = EC_CONTROL, [0x05] = EC_CONTROL, [0x06] = EC_CONTROL, [0x07] = EC_CONTROL,
+    [0x08] = EC_CONTROL, ['\t'] = ec_json, ['\n'] = ec_json | ec_csv, [0x0b] = EC_CONTROL,
+    [0x0c] = EC_CONTROL, ['\r'] = ec_json | ec_csv, [0x0e] = EC_CONTROL, [0x0f] = EC_CONTROL,
+    [0x10] = EC_CONTROL, [0x11] = EC_CONTROL, [0x12] = EC_CONTROL, [0x13] = EC_CONTROL,
+    [0x14] = EC_CONTROL, [0x15] = EC_CONTROL, [0x16] = EC_CONTROL, [0x17] = EC_CONTROL,
+    [0x18] = EC_CONTROL, [0x19] = EC_CONTROL, [0x1a] = EC_CONTROL, [0x1b] = EC_CONTROL,
+    [0x1c] = EC_CONTROL, [0x1d] = EC_CONTROL, [0x1e] = EC_CONTROL, [0x1f] = EC_CONTROL,
+    ['"'] = ec_json | ec_xml | ec_csv,
+    ['\\'] = ec_json,
+    ['\''] = ec_shell | ec_xml,
+    ['&'] = ec_xml,
+    ['<'] = ec_xml,
+    ['>'] = ec_xml,
+    [','] = ec_csv,
+};
+
+bool parse_escape_mode(const char *name, enum escape_mode *mode)
+{
+    for (size_t i = 0; i < sizeof(escape_mode_names) / sizeof(escape_mode_names[0]); i++) {
+        if (strcmp(name, escape_mode_names[i].name) == 0) {
+            *mode = escape_mode_names[i].mode;
+            return true;
+        }
+    }
+    return false;
+}
+
+#ifdef __SSE2__
+// The bytes the blocks are compared with in every mode, besides the control characters
+#define ESCAPE_NEEDLES 5
+
+/**
+ * The vectors the blocks of a value are compared with in a mode, loaded once for the value.
+ * The modes with fewer bytes repeat their first one, so every block is checked without branches.
+ * The bytes found are candidates, the table decides, as the white space is allowed in XML.
+ */
+typedef struct escape_needles {
+    __m128i bytes[ESCAPE_NEEDLES];
+    // all ones when the control characters are candidates
+    __m128i control;
+} escape_needles;
+
+const char *escape_mode_needles[] = {
+    [escape_none] = "",
+    [escape_json] = "\"\\",
+    [escape_shell] = "'",
+    [escape_xml] = "\"'&<>",
+    [escape_csv] = "\",\n\r",
+};
+
+void escape_load_needles(escape_needles *needles, const enum escape_mode mode)
+{
+    const char *bytes = escape_mode_needles[mode];
+    const size_t count = strlen(bytes);
+    for (size_t n = 0; n < ESCAPE_NEEDLES; n++) {
+        needles->bytes[n] = _mm_set1_epi8(n < count ? bytes[n] : bytes[0]);
+    }
+    needles->control = _mm_set1_epi8(mode == escape_json || mode == escape_xml ? -1 : 0);
+}
+
+/**
+ * Returns the mask of the bytes of the block which are candidates for escaping.
+ */
+static inline int escape_block_mask(const __m128i block, const escape_needles *needles)
+{
+    // the bytes lower than the space, compared as unsigned
+    const __m128i space = _mm_set1_epi8(0x1f);
+    const __m128i control = _mm_and_si128(needles->control, _mm_cmpeq_epi8(_mm_max_epu8(block, space), space));
+    const __m128i quotes = _mm_or_si128(_mm_cmpeq_epi8(block, needles->bytes[0]), _mm_cmpeq_epi8(block, needles->bytes[1]));
+    const __m128i others = _mm_or_si128(_mm_cmpeq_epi8(block, needles->bytes[2]),
+        _mm_or_si128(_mm_cmpeq_epi8(block, needles->bytes[3]), _mm_cmpeq_epi8(block, needles->bytes[4])));
+    return _mm_movemask_epi8(_mm_or_si128(control, _mm_or_si128(quotes, others)));
+}
+#endif
+
+/**
+ * Returns the length of the prefix of the string which doesn't need to be escaped in the mode.
+ * With SSE2 the string is checked 16 bytes at a time, and the table is only used for the bytes
+ * of a block which are candidates. It's still several times slower than copying the string: for a
+ * value of 3.5KB without special characters bench/microbench measures about 0.7µs with -O2,
+ * against 0.1µs for the copy, and about 8µs with the release flags, which don't optimize.
+ */
+size_t escape_scan(const char *str, const size_t len, const enum escape_mode mode)
+{
+    const unsigned char class = 1 << mode;
+    size_t i = 0;
+#ifdef __SSE2__
+    escape_needles needles;
+    escape_load_needles(&needles, mode);
+    for (; i + 16 <= len; i += 16) {
+        int mask = escape_block_mask(_mm_loadu_si128((const __m128i*)(str + i)), &needles);
+        for (; mask != 0; mask &= mask - 1) {
+            const size_t at = i + __builtin_ctz(mask);
+            if (escape_classes[(unsigned char)str[at]] & class) { return at; }
+        }
+    }
+#endif
+    for (; i < len; i++) {
+        if (escape_classes[(unsigned char)str[i]] & class) { return i; }
+    }
+    return len;
+}
+
+/**
+ * Appends the replacement of a byte which needs to be escaped in the mode.
+ */
+void escape_append_byte(sbuf *output, const unsigned char c, const enum escape_mode mode)
+{
+    switch (mode) {
+        case escape_json:
+            switch (c) {
+                case '"':
+                    sbuf_append(output, "\\\"", 2);
+                    return;
+                case '\\':
+                    sbuf_append(output, "\\\\", 2);
+                    return;
+                case '\n':
+                    sbuf_append(output, "\\n", 2);
+                    return;
+                case '\t':
+                    sbuf_append(output, "\\t", 2);
+                    return;
+                case '\r':
+                    sbuf_append(output, "\\r", 2);
+                    return;
+                default: {
+                    char escaped[8];
+                    snprintf(escaped, sizeof(escaped), "\\u%04x", c);
+                    sbuf_append(output, escaped, 6);
+                    return;
+                }
+            }
+        case escape_shell:
+            // the quoted word is closed, followed by an escaped apostrophe, and opened again
+            sbuf_append(output, "'\\''", 4);
+            return;
+        case escape_xml:
+            switch (c) {
+                case '"':
+                    sbuf_append(output, "&quot;", 6);
+                    return;
+                case '\'':
+                    sbuf_append(output, "&apos;", 6);
+                    return;
+                case '&':
+                    sbuf_append(output, "&amp;", 5);
+                    return;
+                case '<':
+                    sbuf_append(output, "&lt;", 4);
+                    return;
+                case '>':
+                    sbuf_append(output, "&gt;", 4);
+                    return;
+                default:
+                    // the other control characters can't be represented, they are dropped
+                    return;
+            }
+        case escape_csv:
+            // inside a quoted field only the quotes are doubled
+            if (c == '"') {
+                sbuf_append(output, "\"\"", 2);
+            } else {
+                sbuf_append_char(output, c);
+            }
+            return;
+        default:
+            sbuf_append_char(output, c);
+            return;
+    }
+}
+
+/**
+ * Appends the value escaped for the mode, in a single pass: the runs of bytes which don't need
+ * escaping are copied at once, when the next byte to replace is found, or at the end.
+ * A missing value is appended as an empty one.
+ */
+void escape_append(sbuf *output, const char *str, const enum escape_mode mode)
+{
+    if (NULL == str) { str = ""; }
+    if (mode == escape_none) {
+        sbuf_append_str(output, str);
+        return;
+    }
+
+    const size_t len = strlen(str);
+    size_t i = 0;
+    // a csv field is quoted only when it needs to, which is known before anything is appended
+    if (mode == escape_csv) {
+        i = escape_scan(str, len, mode);
+        if (i == len) {
+            sbuf_append(output, str, len);
+            return;
+        }
+    }
+    if (mode == escape_shell) { sbuf_append_char(output, '\''); }
+    if (mode == escape_csv) { sbuf_append_char(output, '"'); }
+
+    const unsigned char class = 1 << mode;
+    size_t start = 0;
+#ifdef __SSE2__
+    escape_needles needles;
+    escape_load_needles(&needles, mode);
+    for (i &= ~(size_t)15; i + 16 <= len; i += 16) {
+        int mask = escape_block_mask(_mm_loadu_si128((const __m128i*)(str + i)), &needles);
+        for (; mask != 0; mask &= mask - 1) {
+            const size_t at = i + __builtin_ctz(mask);
+            if (!(escape_classes[(unsigned char)str[at]] & class)) { continue; }
+            sbuf_append(output, str + start, at - start);
+            escape_append_byte(output, str[at], mode);
+            start = at + 1;
+        }
+    }
+#endif
+    for (; i < len; i++) {
+        if (!(escape_classes[(unsigned char)str[i]] & class)) { continue; }
+        sbuf_append(output, str + start, i - start);
+        escape_append_byte(output, str[i], mode);
+        start = i + 1;
+    }
+    sbuf_append(output, str + start, len - start);
+
+    if (mode == escape_shell) { sbuf_append_char(output, '\''); }
+    if (mode == escape_csv) { sbuf_append_char(output, '"'); }
+}
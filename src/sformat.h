@@ -0,0 +1,548 @@
+/**
+ * @author Marius Orcsik <marius@habarnam.ro>
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <inttypes.h>
+#include <math.h>
+#include <dbus/dbus.h>
+
+#define INFO_DEFAULT_STATUS "%track_name - %album_name - %artist_name"
+#define INFO_FULL_STATUS    "Player name:\t" INFO_PLAYER_IDENTITY "\n" \
+"Play status:\t" INFO_PLAYBACK_STATUS "\n" \
+"Track:\t\t" INFO_TRACK_NAME "\n" \
+"Artist:\t\t" INFO_ARTIST_NAME "\n" \
+"Album:\t\t" INFO_ALBUM_NAME "\n" \
+"Album Artist:\t" INFO_ALBUM_ARTIST "\n" \
+"Art URL:\t" INFO_ART_URL "\n" \
+"Track:\t\t" INFO_TRACK_NUMBER "\n" \
+"Length:\t\t" INFO_TRACK_LENGTH "\n" \
+"Volume:\t\t" INFO_VOLUME "\n" \
+"Loop status:\t" INFO_LOOP_STATUS "\n" \
+"Shuffle:\t" INFO_SHUFFLE_MODE "\n" \
+"Position:\t" INFO_POSITION "\n" \
+"Bitrate:\t" INFO_BITRATE "\n" \
+"Comment:\t" INFO_COMMENT \
+""
+
+#define INFO_PLAYER_IDENTITY "%player_identity"
+#define INFO_PLAYER_NAME     "%player_name"
+#define INFO_TRACK_NAME      "%track_name"
+#define INFO_TRACK_NUMBER    "%track_number"
+#define INFO_TRACK_LENGTH    "%track_length"
+#define INFO_ARTIST_NAME     "%artist_name"
+#define INFO_ALBUM_NAME      "%album_name"
+#define INFO_ALBUM_ARTIST    "%album_artist"
+#define INFO_ART_URL         "%art_url"
+#define INFO_BITRATE         "%bitrate"
+#define INFO_COMMENT         "%comment"
+
+#define INFO_PLAYBACK_STATUS "%play_status"
+#define INFO_SHUFFLE_MODE    "%shuffle"
+#define INFO_VOLUME          "%volume"
+#define INFO_LOOP_STATUS     "%loop_status"
+#define INFO_POSITION        "%position"
+#define INFO_PROGRESS        "%progress"
+#define INFO_REMAINING       "%remaining"
+// followed by the name of any metadata key, eg: "%meta:xesam:genre"
+#define INFO_META            "%meta:"
+
+#define INFO_FULL            "%full"
+
+#define TRUE_LABEL      "true"
+#define FALSE_LABEL     "false"
+
+#define MAX_VOLUME      100.0f
+#define MIN_VOLUME        0.0f
+
+
+#define INFO_ESCAPE_NEWLINE  "\\n"
+#define INFO_ESCAPE_TAB      "\\t"
+
+// The characters the metadata keys are made of, the key ends at the first one which isn't
+#define INFO_META_KEY_CHARS  "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789:_.-"
+
+// The key of the name of the player in the JSON objects, the other keys are the names of the MPRIS properties
+#define INFO_JSON_PLAYER     "player"
+
+/**
+ * The information is printed with the format of the command, or as JSON: a single array holding
+ * an object for every player, or an object for every player on its own line (NDJSON).
+ */
+enum info_output {
+    info_output_text,
+    info_output_json,
+    info_output_ndjson,
+};
+
+enum info_type {
+    info_literal,
+    info_player_identity,
+    info_player_name,
+    info_track_name,
+    info_track_number,
+    info_track_length,
+    info_artist_name,
+    info_album_name,
+    info_album_artist,
+    info_art_url,
+    info_bitrate,
+    info_comment,
+    info_playback_status,
+    info_shuffle_mode,
+    info_volume,
+    info_loop_status,
+    info_position,
+    info_progress,
+    info_remaining,
+    info_meta,
+};
+
+struct info_specifier {
+    const char *label;
+    enum info_type type;
+    unsigned properties;
+    // the mask of the metadata fields the specifier reads
+    unsigned metadata;
+};
+
+const struct info_specifier info_specifiers[] = {
+    {INFO_PLAYER_IDENTITY, info_player_identity, mpris_prop_identity, 0},
+    {INFO_PLAYER_NAME, info_player_name, mpris_prop_none, 0},
+    {INFO_TRACK_NAME, info_track_name, mpris_prop_metadata, 1u << mpris_meta_title},
+    {INFO_TRACK_NUMBER, info_track_number, mpris_prop_metadata, 1u << mpris_meta_track_number},
+    {INFO_TRACK_LENGTH, info_track_length, mpris_prop_metadata, 1u << mpris_meta_length},
+    {INFO_ARTIST_NAME, info_artist_name, mpris_prop_metadata, 1u << mpris_meta_artist},
+    {INFO_ALBUM_NAME, info_album_name, mpris_prop_metadata, 1u << mpris_meta_album},
+    {INFO_ALBUM_ARTIST, info_album_artist, mpris_prop_metadata, 1u << mpris_meta_album_artist},
+    {INFO_ART_URL, info_art_url, mpris_prop_metadata, 1u << mpris_meta_art_url},
+    {INFO_BITRATE, info_bitrate, mpris_prop_metadata, 1u << mpris_meta_bitrate},
+    {INFO_COMMENT, info_comment, mpris_prop_metadata, 1u << mpris_meta_comment},
+    {INFO_PLAYBACK_STATUS, info_playback_status, mpris_prop_playback_status, 0},
+    {INFO_SHUFFLE_MODE, info_shuffle_mode, mpris_prop_shuffle, 0},
+    {INFO_VOLUME, info_volume, mpris_prop_volume, 0},
+    {INFO_LOOP_STATUS, info_loop_status, mpris_prop_loop_status, 0},
+    {INFO_POSITION, info_position, mpris_prop_position, 0},
+    {INFO_PROGRESS, info_progress, mpris_prop_position | mpris_prop_metadata, 1u << mpris_meta_length},
+    {INFO_REMAINING, info_remaining, mpris_prop_position | mpris_prop_metadata, 1u << mpris_meta_length},
+};
+
+typedef struct info_segment {
+    enum info_type type;
+    // for literal segments, the position of the text in the template's literals buffer,
+    // for metadata keys, the position of the NUL terminated key
+    size_t offset;
+    size_t length;
+} info_segment;
+
+/**
+ * A format string compiled into a list of literal and specifier segments.
+ * It can be rendered any number of times, for any number of players.
+ */
+typedef struct info_template {
+    sbuf literals;
+    info_segment *segments;
+    int segment_count;
+    int segment_cap;
+    // the mask of MPRIS properties needed to render the template
+    unsigned properties;
+    // the mask of the metadata fields which are decoded before rendering
+    unsigned metadata;
+    // the escaping of the substituted values, the literal text is copied as is
+    enum escape_mode escape;
+} info_template;
+
+void format_nanosecond_interval(char *destination, const size_t max_len, const int64_t time_nanoseconds)
+{
+    int32_t time_seconds = time_nanoseconds / 1000000;
+    const short time_minutes = time_seconds / 60;
+    const short time_hours = time_minutes / 60;
+    const short time_days = time_hours / 24;
+    if (time_minutes > 0) {
+        if (time_hours > 0) {
+            if (time_days > 0) {
+                snprintf(destination, max_len, "%dd %dh %dm %ds", time_days, time_hours, time_minutes, time_seconds % 60);
+                return;
+            }
+            snprintf(destination, max_len, "%dh %dm %ds", time_hours, time_minutes, time_seconds % 60);
+            return;
+        }
+        snprintf(destination, max_len, "%dm %ds", time_minutes, time_seconds % 60);
+        return;
+    }
+
+    snprintf(destination, max_len, "%ds", time_seconds);
+}
+
+info_segment *info_template_push(info_template *tpl, const enum info_type type)
+{
+    if (tpl->segment_count == tpl->segment_cap) {
+        const int cap = MAX(tpl->segment_cap * 2, 8);
+        info_segment *segments = realloc(tpl->segments, cap * sizeof(info_segment));
+        if (NULL == segments) { return NULL; }
+        tpl->segments = segments;
+        tpl->segment_cap = cap;
+    }
+    info_segment *seg = &tpl->segments[tpl->segment_count++];
+    seg->type = type;
+    seg->offset = tpl->literals.len;
+    seg->length = 0;
+    return seg;
+}
+
+void info_template_push_literal(info_template *tpl, const char *str, const size_t len)
+{
+    info_segment *last = tpl->segment_count > 0 ? &tpl->segments[tpl->segment_count-1] : NULL;
+    if (NULL == last || last->type != info_literal) {
+        last = info_template_push(tpl, info_literal);
+        if (NULL == last) { return; }
+    }
+    sbuf_append(&tpl->literals, str, len);
+    last->length += len;
+}
+
+void info_template_parse(info_template *tpl, const char *format)
+{
+    const char *cur = format;
+    while (*cur != 0) {
+        // copy the literal text up to the next escape sequence or specifier in one go
+        const size_t literal_len = strcspn(cur, "%\\");
+        if (literal_len > 0) {
+            info_template_push_literal(tpl, cur, literal_len);
+            cur += literal_len;
+            continue;
+        }
+        if (strncmp(cur, INFO_ESCAPE_NEWLINE, 2) == 0) {
+            info_template_push_literal(tpl, "\n", 1);
+            cur += 2;
+            continue;
+        }
+        if (strncmp(cur, INFO_ESCAPE_TAB, 2) == 0) {
+            info_template_push_literal(tpl, "\t", 1);
+            cur += 2;
+            continue;
+        }
+        if (strncmp(cur, INFO_FULL, strlen(INFO_FULL)) == 0) {
+            info_template_parse(tpl, INFO_FULL_STATUS);
+            cur += strlen(INFO_FULL);
+            continue;
+        }
+        if (strncmp(cur, INFO_META, strlen(INFO_META)) == 0) {
+            const char *key = cur + strlen(INFO_META);
+            const size_t key_len = strspn(key, INFO_META_KEY_CHARS);
+            if (key_len > 0) {
+                info_segment *seg = info_template_push(tpl, info_meta);
+                if (NULL == seg) { return; }
+                sbuf_append(&tpl->literals, key, key_len);
+                sbuf_append(&tpl->literals, "", 1);
+                seg->length = key_len;
+                tpl->properties |= mpris_prop_metadata | mpris_prop_metadata_keys;
+                cur = key + key_len;
+                continue;
+            }
+        }
+        bool matched = false;
+        for (int i = 0; i < (int)array_size(info_specifiers); i++) {
+            const struct info_specifier *spec = &info_specifiers[i];
+            const size_t label_len = strlen(spec->label);
+            if (strncmp(cur, spec->label, label_len) == 0) {
+                info_template_push(tpl, spec->type);
+                tpl->properties |= spec->properties;
+                tpl->metadata |= spec->metadata;
+                cur += label_len;
+                matched = true;
+                break;
+            }
+        }
+        if (!matched) {
+            info_template_push_literal(tpl, cur, 1);
+            cur++;
+        }
+    }
+}
+
+void info_template_compile(info_template *tpl, const char *format)
+{
+    tpl->literals = (sbuf){0};
+    tpl->segments = NULL;
+    tpl->segment_count = 0;
+    tpl->segment_cap = 0;
+    tpl->properties = mpris_prop_none;
+    tpl->metadata = 0;
+    tpl->escape = escape_none;
+    if (NULL == format) { return; }
+
+    info_template_parse(tpl, format);
+}
+
+void info_template_free(info_template *tpl)
+{
+    sbuf_free(&tpl->literals);
+    free(tpl->segments);
+    tpl->segments = NULL;
+    tpl->segment_count = 0;
+    tpl->segment_cap = 0;
+}
+
+/**
+ * Appends the value of a metadata key, whatever its type, the array values are joined by ", ".
+ */
+void info_append_meta_value(DBusMessageIter *iter, sbuf *output)
+{
+    char label[32];
+    const int type = dbus_message_iter_get_arg_type(iter);
+    switch (type) {
+        case DBUS_TYPE_STRING:
+        case DBUS_TYPE_OBJECT_PATH: {
+            const char *str = NULL;
+            dbus_message_iter_get_basic(iter, &str);
+            sbuf_append_str(output, str);
+            return;
+        }
+        case DBUS_TYPE_BOOLEAN: {
+            dbus_bool_t val = FALSE;
+            dbus_message_iter_get_basic(iter, &val);
+            sbuf_append_str(output, val ? TRUE_LABEL : FALSE_LABEL);
+            return;
+        }
+        case DBUS_TYPE_BYTE:
+        case DBUS_TYPE_INT16:
+        case DBUS_TYPE_UINT16:
+        case DBUS_TYPE_INT32:
+        case DBUS_TYPE_UINT32:
+        case DBUS_TYPE_INT64:
+        case DBUS_TYPE_UINT64: {
+            DBusBasicValue val = {0};
+            dbus_message_iter_get_basic(iter, &val);
+            if (type == DBUS_TYPE_BYTE) {
+                snprintf(label, sizeof(label), "%u", val.byt);
+            } else if (type == DBUS_TYPE_INT16) {
+                snprintf(label, sizeof(label), "%d", val.i16);
+            } else if (type == DBUS_TYPE_UINT16) {
+                snprintf(label, sizeof(label), "%u", val.u16);
+            } else if (type == DBUS_TYPE_INT32) {
+                snprintf(label, sizeof(label), "%" PRId32, val.i32);
+            } else if (type == DBUS_TYPE_UINT32) {
+                snprintf(label, sizeof(label), "%" PRIu32, val.u32);
+            } else if (type == DBUS_TYPE_INT64) {
+                snprintf(label, sizeof(label), "%" PRId64, (int64_t)val.i64);
+            } else {
+                snprintf(label, sizeof(label), "%" PRIu64, (uint64_t)val.u64);
+            }
+            sbuf_append_str(output, label);
+            return;
+        }
+        case DBUS_TYPE_DOUBLE: {
+            double val = 0;
+            dbus_message_iter_get_basic(iter, &val);
+            snprintf(label, sizeof(label), "%g", val);
+            sbuf_append_str(output, label);
+            return;
+        }
+        case DBUS_TYPE_VARIANT:
+        case DBUS_TYPE_ARRAY: {
+            DBusMessageIter sub;
+            dbus_message_iter_recurse(iter, &sub);
+            for (bool first = true; DBUS_TYPE_INVALID != dbus_message_iter_get_arg_type(&sub); first = false) {
+                if (!first) { sbuf_append(output, ", ", 2); }
+                info_append_meta_value(&sub, output);
+                dbus_message_iter_next(&sub);
+            }
+            return;
+        }
+        default:
+            return;
+    }
+}
+
+/**
+ * Renders the template for the player properties, appending the result to the output buffer.
+ * Only the metadata fields the template reads are decoded.
+ */
+void info_template_render(const info_template *tpl, mpris_properties *props, sbuf *output)
+{
+    mpris_metadata_decode(&props->metadata, tpl->metadata);
+    // the position is extrapolated once, so all the specifiers agree
+    const uint64_t position = tpl->properties & mpris_prop_position ? mpris_properties_position(props, mpris_now()) : 0;
+    const uint64_t length = props->metadata.length;
+
+    char label[32];
+    sbuf meta = {0};
+    for (int i = 0; i < tpl->segment_count; i++) {
+        const info_segment *seg = &tpl->segments[i];
+        switch (seg->type) {
+            case info_literal:
+                sbuf_append(output, tpl->literals.data + seg->offset, seg->length);
+                break;
+            case info_player_identity:
+                escape_append(output, props->player_identity, tpl->escape);
+                break;
+            case info_player_name:
+                escape_append(output, props->player_name, tpl->escape);
+                break;
+            case info_track_name:
+                escape_append(output, props->metadata.title, tpl->escape);
+                break;
+            case info_track_number:
+                snprintf(label, sizeof(label), "%d", props->metadata.track_number);
+                escape_append(output, label, tpl->escape);
+                break;
+            case info_track_length:
+                format_nanosecond_interval(label, sizeof(label), props->metadata.length);
+                escape_append(output, label, tpl->escape);
+                break;
+            case info_artist_name:
+                escape_append(output, props->metadata.artist, tpl->escape);
+                break;
+            case info_album_name:
+                escape_append(output, props->metadata.album, tpl->escape);
+                break;
+            case info_album_artist:
+                escape_append(output, props->metadata.album_artist, tpl->escape);
+                break;
+            case info_art_url:
+                escape_append(output, props->metadata.art_url, tpl->escape);
+                break;
+            case info_bitrate:
+                snprintf(label, sizeof(label), "%d", props->metadata.bitrate);
+                escape_append(output, label, tpl->escape);
+                break;
+            case info_comment:
+                escape_append(output, props->metadata.comment, tpl->escape);
+                break;
+            case info_playback_status:
+                escape_append(output, props->playback_status, tpl->escape);
+                break;
+            case info_shuffle_mode:
+                escape_append(output, props->shuffle ? TRUE_LABEL : FALSE_LABEL, tpl->escape);
+                break;
+            case info_volume:
+                snprintf(label, sizeof(label), "%.2lf%%", props->volume*MAX_VOLUME);
+                escape_append(output, label, tpl->escape);
+                break;
+            case info_loop_status:
+                escape_append(output, props->loop_status, tpl->escape);
+                break;
+            case info_position:
+                format_nanosecond_interval(label, sizeof(label), position);
+                escape_append(output, label, tpl->escape);
+                break;
+            case info_progress:
+                snprintf(label, sizeof(label), "%d%%", length > 0 ? (int)(position * 100 / length) : 0);
+                escape_append(output, label, tpl->escape);
+                break;
+            case info_remaining:
+                format_nanosecond_interval(label, sizeof(label), length > position ? length - position : 0);
+                escape_append(output, label, tpl->escape);
+                break;
+            case info_meta: {
+                const DBusMessageIter *value = mpris_metadata_find(&props->metadata, tpl->literals.data + seg->offset);
+                // the iterator is copied, so the value can be read again
+                DBusMessageIter iter = {0};
+                if (NULL != value) { iter = *value; }
+                if (tpl->escape == escape_none) {
+                    if (NULL != value) { info_append_meta_value(&iter, output); }
+                    break;
+                }
+                // the value is escaped as a whole, a missing one as an empty value
+                sbuf_reset(&meta);
+                if (NULL != value) { info_append_meta_value(&iter, &meta); }
+                escape_append(output, meta.data, tpl->escape);
+                break;
+            }
+        }
+    }
+    sbuf_free(&meta);
+}
+
+/**
+ * Appends the string as a JSON string, or null when it's missing.
+ */
+void json_append_string(sbuf *output, const char *str)
+{
+    if (NULL == str) {
+        sbuf_append(output, "null", 4);
+        return;
+    }
+    sbuf_append_char(output, '"');
+    escape_append(output, str, escape_json);
+    sbuf_append_char(output, '"');
+}
+
+// The keys are the names of the MPRIS properties, which don't need escaping
+void json_append_key(sbuf *output, const char *key, const bool first)
+{
+    sbuf_append(output, first ? "\"" : ",\"", first ? 1 : 2);
+    sbuf_append_str(output, key);
+    sbuf_append(output, "\":", 2);
+}
+
+/**
+ * Appends the fields described by the table as the members of a JSON object.
+ */
+void json_append_fields(sbuf *output, void *base, const mpris_field *fields, const int count, const uint64_t position, bool first)
+{
+    char label[32];
+    for (int i = 0; i < count; i++, first = false) {
+        const mpris_field *field = &fields[i];
+        const char *value = (const char*)base + field->offset;
+        json_append_key(output, field->key, first);
+        switch (field->type) {
+            case mpris_field_string:
+                json_append_string(output, *(const char**)value);
+                break;
+            case mpris_field_short:
+                snprintf(label, sizeof(label), "%u", *(const unsigned short*)value);
+                sbuf_append_str(output, label);
+                break;
+            case mpris_field_uint64:
+                snprintf(label, sizeof(label), "%" PRIu64, *(const uint64_t*)value);
+                sbuf_append_str(output, label);
+                break;
+            case mpris_field_position:
+                snprintf(label, sizeof(label), "%" PRIu64, position);
+                sbuf_append_str(output, label);
+                break;
+            case mpris_field_double: {
+                const double number = *(const double*)value;
+                // JSON has no representation for the infinities and NaN
+                if (isfinite(number)) {
+                    snprintf(label, sizeof(label), "%g", number);
+                    sbuf_append_str(output, label);
+                } else {
+                    sbuf_append(output, "null", 4);
+                }
+                break;
+            }
+            case mpris_field_boolean:
+                sbuf_append_str(output, *(const bool*)value ? TRUE_LABEL : FALSE_LABEL);
+                break;
+            case mpris_field_metadata:
+                sbuf_append_char(output, '{');
+                json_append_fields(output, (void*)value, mpris_metadata_fields, mpris_meta_count, position, true);
+                sbuf_append_char(output, '}');
+                break;
+        }
+    }
+}
+
+/**
+ * Appends all the properties of a player as a JSON object, keyed by their MPRIS names.
+ * The strings that are missing are null, and the position is extrapolated like for %position.
+ */
+void info_render_json(mpris_properties *props, sbuf *output)
+{
+    mpris_metadata_decode(&props->metadata, MPRIS_METADATA_ALL);
+
+    sbuf_append_char(output, '{');
+    json_append_key(output, INFO_JSON_PLAYER, true);
+    json_append_string(output, props->player_name);
+    json_append_key(output, MPRIS_ARG_PLAYER_IDENTITY, false);
+    json_append_string(output, props->player_identity);
+    json_append_fields(output, props, mpris_properties_fields, array_size(mpris_properties_fields),
+        mpris_properties_position(props, mpris_now()), false);
+    sbuf_append_char(output, '}');
+}
@@ -0,0 +1,379 @@
+/**
+ * @author Marius Orcsik <marius@habarnam.ro>
+ */
+
+#include <errno.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <dbus/dbus.h>
+
+#define HEALTH_FILE_NAME        "mpris-ctl.health"
+#define HEALTH_NAME_LENGTH      128
+#define HEALTH_IDENTITY_LENGTH  128
+// The record is kept small, when it is full the entries of the players which weren't seen are reused
+#define HEALTH_MAX_PLAYERS      64
+// A player answering quickly gets a timeout of this many times its usual latency, but not less than the minimum
+#define HEALTH_TIMEOUT_FACTOR   8
+#define HEALTH_MIN_TIMEOUT      25 //ms
+// The number of consecutive invocations in which a player timed out before it is quarantined
+#define HEALTH_QUARANTINE_RUNS  2
+// The owner recorded for a player whose unique name wasn't loaded
+#define HEALTH_UNKNOWN_OWNER    "-"
+
+/**
+ * The health record of the players, kept in $XDG_RUNTIME_DIR between invocations.
+ * Every player is identified by its unique bus name, so a player which is restarted, or replaced
+ * by another process, starts with a clean record.
+ *
+ * For each player we remember the moving average of its response latency, and the number of
+ * consecutive invocations in which it didn't answer at all. The timeout of the calls to a player is
+ * derived from its latency, and the players which timed out in too many invocations are quarantined:
+ * they are not called anymore until their owner changes, unless they are named explicitly.
+ *
+ * The record also caches the identity of the players, which doesn't change while they are running,
+ * so it isn't requested again by every invocation.
+ *
+ * The file has a line for each player: "<name> <unique name> <latency in µs> <timeouts> <identity>",
+ * the identity is the rest of the line, and it is empty when it isn't known.
+ * The unique name is only loaded when the player is already in the record, so a player seen
+ * for the first time is recorded with an unknown owner, which is replaced by the next one loaded.
+ * The file is only written again when an entry changed.
+ */
+typedef struct health_entry {
+    char name[HEALTH_NAME_LENGTH];
+    char owner[HEALTH_NAME_LENGTH];
+    // the moving average of the response latency, 0 when unknown
+    int64_t latency;
+    int timeouts;
+    char identity[HEALTH_IDENTITY_LENGTH];
+    // the player is on the bus with the same owner in this invocation
+    bool valid;
+    bool replied;
+    bool timed_out;
+} health_entry;
+
+typedef struct health_call {
+    DBusPendingCall *pending;
+    int entry;
+    int64_t start;
+} health_call;
+
+struct player_health {
+    bool enabled;
+    health_entry *entries;
+    int entry_count;
+    int entry_cap;
+    health_call *calls;
+    int call_count;
+    int call_cap;
+    // an entry changed since the record was loaded, so it has to be written again
+    bool changed;
+};
+
+struct player_health player_health = {0};
+
+bool get_health_path(char *path, const size_t max_len)
+{
+    const char *runtime_dir = getenv("XDG_RUNTIME_DIR");
+    if (NULL == runtime_dir || strlen(runtime_dir) == 0) { return false; }
+
+    const int len = snprintf(path, max_len, "%s/%s", runtime_dir, HEALTH_FILE_NAME);
+    return len > 0 && (size_t)len < max_len;
+}
+
+int64_t health_now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000L + ts.tv_nsec / 1000;
+}
+
+health_entry *health_add_entry(void)
+{
+    if (player_health.entry_count == player_health.entry_cap) {
+        const int cap = player_health.entry_cap > 0 ? player_health.entry_cap * 2 : 16;
+        health_entry *entries = realloc(player_health.entries, cap * sizeof(health_entry));
+        if (NULL == entries) { return NULL; }
+        player_health.entries = entries;
+        player_health.entry_cap = cap;
+    }
+    health_entry *entry = &player_health.entries[player_health.entry_count++];
+    memset(entry, 0, sizeof(health_entry));
+    return entry;
+}
+
+/**
+ * Loads the record, the players it contains are only trusted after their owner is checked.
+ * Without a runtime directory the record isn't used, and all the calls get the default timeout.
+ */
+void health_load(const char *path)
+{
+    player_health.enabled = true;
+
+    FILE *file = fopen(path, "r");
+    if (NULL == file) { return; }
+
+    char line[2 * HEALTH_NAME_LENGTH + HEALTH_IDENTITY_LENGTH + 64];
+    while (NULL != fgets(line, sizeof(line), file) && player_health.entry_count < HEALTH_MAX_PLAYERS) {
+        health_entry entry = {0};
+        int len = 0;
+        if (sscanf(line, "%127s %127s %" SCNd64 " %d%n", entry.name, entry.owner, &entry.latency, &entry.timeouts, &len) != 4) {
+            continue;
+        }
+        const char *identity = line + len;
+        if (*identity == ' ') { identity++; }
+        snprintf(entry.identity, sizeof(entry.identity), "%.*s", (int)strcspn(identity, "\n"), identity);
+        health_entry *added = health_add_entry();
+        if (NULL == added) { break; }
+        *added = entry;
+    }
+    fclose(file);
+}
+
+/**
+ * Writes the record, replacing the file atomically. The players which weren't seen in this invocation
+ * are kept as they were, as only the named players are looked up when no others are selected.
+ */
+void health_save(const char *path)
+{
+    if (!player_health.enabled) { return; }
+
+    for (int i = 0; i < player_health.entry_count; i++) {
+        health_entry *entry = &player_health.entries[i];
+        // the timeouts are counted once per invocation, no matter how many calls were lost
+        if (entry->timed_out) {
+            entry->timeouts++;
+            player_health.changed = true;
+        } else if (entry->replied && entry->timeouts > 0) {
+            entry->timeouts = 0;
+            player_health.changed = true;
+        }
+    }
+    if (!player_health.changed) { return; }
+
+    char tmp_path[MAX_OUTPUT_LENGTH];
+    const int len = snprintf(tmp_path, sizeof(tmp_path), "%s.%d", path, (int)getpid());
+    if (len < 0 || (size_t)len >= sizeof(tmp_path)) { return; }
+
+    FILE *file = fopen(tmp_path, "w");
+    if (NULL == file) { return; }
+
+    for (int i = 0; i < player_health.entry_count; i++) {
+        const health_entry *entry = &player_health.entries[i];
+        fprintf(file, "%s %s %" PRId64 " %d %s\n", entry->name, entry->owner, entry->latency, entry->timeouts, entry->identity);
+    }
+    if (fclose(file) != 0 || rename(tmp_path, path) != 0) {
+        unlink(tmp_path);
+    }
+}
+
+void health_free(void)
+{
+    free(player_health.entries);
+    free(player_health.calls);
+    player_health = (struct player_health){0};
+}
+
+/**
+ * Returns true if the player is in the record, even though its owner wasn't checked yet.
+ */
+bool health_recorded(const char *name)
+{
+    if (!player_health.enabled) { return false; }
+    if (NULL == name) { return false; }
+    for (int i = 0; i < player_health.entry_count; i++) {
+        if (strcmp(player_health.entries[i].name, name) == 0) { return true; }
+    }
+    return false;
+}
+
+health_entry *health_find(const char *name)
+{
+    if (NULL == name) { return NULL; }
+    for (int i = 0; i < player_health.entry_count; i++) {
+        health_entry *entry = &player_health.entries[i];
+        if (entry->valid && strcmp(entry->name, name) == 0) {
+            return entry;
+        }
+    }
+    return NULL;
+}
+
+/**
+ * Matches a player found on the bus with its record, creating a new one if the player is unknown,
+ * or if its owner has changed since the last time it was seen. The owner is NULL when it wasn't loaded.
+ * Returns true if the player is quarantined.
+ */
+bool health_check_player(const char *name, const char *owner)
+{
+    if (!player_health.enabled) { return false; }
+    if (NULL == name) { return false; }
+    if (NULL == owner) { owner = HEALTH_UNKNOWN_OWNER; }
+    if (strlen(name) >= HEALTH_NAME_LENGTH || strlen(owner) >= HEALTH_NAME_LENGTH) { return false; }
+
+    health_entry *entry = NULL;
+    for (int i = 0; i < player_health.entry_count; i++) {
+        if (strcmp(player_health.entries[i].name, name) == 0) {
+            entry = &player_health.entries[i];
+            break;
+        }
+    }
+    // only two known owners which differ tell that the player was replaced
+    const bool unknown = strcmp(owner, HEALTH_UNKNOWN_OWNER) == 0;
+    if (NULL != entry && !unknown && strcmp(entry->owner, HEALTH_UNKNOWN_OWNER) != 0 && strcmp(entry->owner, owner) != 0) {
+        memset(entry, 0, sizeof(health_entry));
+    }
+    // when the record is full, the entry of a player which wasn't seen in this invocation is reused
+    for (int i = 0; NULL == entry && player_health.entry_count >= HEALTH_MAX_PLAYERS && i < player_health.entry_count; i++) {
+        if (!player_health.entries[i].valid) {
+            entry = &player_health.entries[i];
+            memset(entry, 0, sizeof(health_entry));
+        }
+    }
+    if (NULL == entry) {
+        if (player_health.entry_count >= HEALTH_MAX_PLAYERS) { return false; }
+        entry = health_add_entry();
+        if (NULL == entry) { return false; }
+    }
+    if (unknown && strlen(entry->owner) > 0) {
+        owner = entry->owner;
+    }
+    if (strcmp(entry->name, name) != 0 || strcmp(entry->owner, owner) != 0) {
+        player_health.changed = true;
+        memmove(entry->name, name, strlen(name) + 1);
+        memmove(entry->owner, owner, strlen(owner) + 1);
+    }
+    entry->valid = true;
+
+    return entry->timeouts >= HEALTH_QUARANTINE_RUNS;
+}
+
+/**
+ * Returns the identity of the player recorded in a previous invocation, if its owner hasn't changed.
+ */
+const char *health_identity(const char *name)
+{
+    if (!player_health.enabled) { return NULL; }
+
+    const health_entry *entry = health_find(name);
+    if (NULL == entry || strlen(entry->identity) == 0) { return NULL; }
+    return entry->identity;
+}
+
+/**
+ * Records the identity of the player, unless it doesn't fit on a line of the record.
+ */
+void health_set_identity(const char *name, const char *identity)
+{
+    if (!player_health.enabled) { return; }
+    if (NULL == identity) { return; }
+
+    health_entry *entry = health_find(name);
+    if (NULL == entry) { return; }
+
+    const size_t len = strlen(identity);
+    if (len >= HEALTH_IDENTITY_LENGTH || strchr(identity, '\n') != NULL) { return; }
+    if (strcmp(entry->identity, identity) == 0) { return; }
+    memcpy(entry->identity, identity, len + 1);
+    player_health.changed = true;
+}
+
+/**
+ * Returns the timeout in ms derived from a latency, before it's bounded by the default one.
+ */
+int64_t health_latency_timeout(const int64_t latency)
+{
+    return MAX(latency * HEALTH_TIMEOUT_FACTOR / 1000, HEALTH_MIN_TIMEOUT);
+}
+
+/**
+ * Returns the timeout for a call to the destination. The players which are unknown, or which
+ * recently timed out, get the default one.
+ */
+int health_timeout(const char *destination, const int default_timeout)
+{
+    if (!player_health.enabled) { return default_timeout; }
+
+    const health_entry *entry = health_find(destination);
+    if (NULL == entry || entry->latency == 0 || entry->timeouts > 0) { return default_timeout; }
+
+    return (int)MIN(health_latency_timeout(entry->latency), default_timeout);
+}
+
+/**
+ * Records a call which was just sent to a player.
+ */
+void health_sent(DBusMessage *msg, DBusPendingCall *pending)
+{
+    if (!player_health.enabled) { return; }
+    if (NULL == pending) { return; }
+
+    const health_entry *entry = health_find(dbus_message_get_destination(msg));
+    if (NULL == entry) { return; }
+
+    if (player_health.call_count == player_health.call_cap) {
+        const int cap = player_health.call_cap > 0 ? player_health.call_cap * 2 : 16;
+        health_call *calls = realloc(player_health.calls, cap * sizeof(health_call));
+        if (NULL == calls) { return; }
+        player_health.calls = calls;
+        player_health.call_cap = cap;
+    }
+    health_call *call = &player_health.calls[player_health.call_count++];
+    call->pending = pending;
+    call->entry = entry - player_health.entries;
+    call->start = health_now();
+}
+
+/**
+ * Records the reply of a call, or its absence.
+ * The replies are collected in order, so the latency of a call answered while we were waiting
+ * for another one is overestimated, which only makes its timeout more lenient.
+ */
+void health_received(DBusPendingCall *pending, DBusMessage *reply)
+{
+    if (!player_health.enabled) { return; }
+
+    for (int i = player_health.call_count - 1; i >= 0; i--) {
+        const health_call call = player_health.calls[i];
+        if (call.pending != pending) { continue; }
+
+        player_health.calls[i] = player_health.calls[--player_health.call_count];
+
+        health_entry *entry = &player_health.entries[call.entry];
+        bool timeout = NULL == reply;
+        if (NULL != reply && dbus_message_get_type(reply) == DBUS_MESSAGE_TYPE_ERROR) {
+            const char *error = dbus_message_get_error_name(reply);
+            timeout = NULL != error && (strcmp(error, DBUS_ERROR_NO_REPLY) == 0 || strcmp(error, DBUS_ERROR_TIMEOUT) == 0);
+        }
+        if (timeout) {
+            entry->timed_out = true;
+            return;
+        }
+        const int64_t elapsed = health_now() - call.start;
+        const int64_t latency = MAX(elapsed, 1);
+        const int64_t previous = entry->latency;
+        entry->latency = previous == 0 ? latency : (3 * previous + latency) / 4;
+        entry->replied = true;
+        // the latency only matters through the timeout it gives, the record isn't written again for less
+        if (previous == 0 || health_latency_timeout(previous) != health_latency_timeout(entry->latency)) {
+            player_health.changed = true;
+        }
+        return;
+    }
+}
+
+/**
+ * Forgets everything, the players start with a clean record on the next invocation.
+ */
+bool health_clear(void)
+{
+    char path[MAX_OUTPUT_LENGTH];
+    if (!get_health_path(path, sizeof(path))) { return false; }
+    return unlink(path) == 0 || errno == ENOENT;
+}
@@ -0,0 +1,398 @@
+/**
+ * @author Marius Orcsik <marius@habarnam.ro>
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+#define HOOK_FIELD_TRACK      "track"
+#define HOOK_FIELD_STATUS     "status"
+#define HOOK_FIELD_VOLUME     "volume"
+#define HOOK_FIELD_SEPARATOR  ','
+
+#define HOOK_ENV_PLAYER       "MPRIS_PLAYER"
+#define HOOK_ENV_CHANGED      "MPRIS_CHANGED"
+#define HOOK_ENV_TRACK        "MPRIS_TRACK"
+#define HOOK_ENV_STATUS       "MPRIS_STATUS"
+#define HOOK_ENV_VOLUME       "MPRIS_VOLUME"
+#define HOOK_ENV_OUTPUT       "MPRIS_OUTPUT"
+
+#define HOOK_SHELL            "/bin/sh"
+// The minimum time between the start of two hooks, unless it's given on the command line
+#define HOOK_MIN_INTERVAL     1 //s
+// While a hook is running we check this often if it ended, as the next one waits for it
+#define HOOK_REAP_INTERVAL    100 //ms
+
+/**
+ * The hooks run when some of the fields of a player change, which are watched by comparing their values
+ * with the ones the player had the last time, after every signal. When they change again before the hook
+ * can run, because the previous one is still running, or because it ran too recently, the changes are
+ * merged, so the hook runs once with the latest values.
+ *
+ * The hook is a shell command, which gets the values in its environment and the rendered format on its
+ * standard input, or a FIFO, where the rendered format is written as a line when there is a reader.
+ */
+enum hook_field {
+    hook_field_none   = 0,
+    hook_field_track  = 1 << 0,
+    hook_field_status = 1 << 1,
+    hook_field_volume = 1 << 2,
+
+    hook_field_default = hook_field_track | hook_field_status,
+};
+
+const struct hook_field_name {
+    enum hook_field field;
+    const char *name;
+} hook_field_names[] = {
+    {hook_field_track, HOOK_FIELD_TRACK},
+    {hook_field_status, HOOK_FIELD_STATUS},
+    {hook_field_volume, HOOK_FIELD_VOLUME},
+};
+
+#define HOOK_FIELD_NAMES_COUNT (int)(sizeof(hook_field_names) / sizeof(hook_field_names[0]))
+
+// The properties of all the fields are loaded, even the ones not watched, as they are all passed to the hook
+#define HOOK_PROPERTIES (mpris_prop_playback_status | mpris_prop_metadata | mpris_prop_volume)
+
+/**
+ * The values of the fields of a player when the hook last looked at it.
+ */
+typedef struct hook_player {
+    // copies of the bus name and of the track, as the player can leave the bus in the meantime
+    char *name;
+    char *track;
+    enum mpris_playback status;
+    double volume;
+    bool selected;
+    // the fields which changed since the hook last ran for the player
+    unsigned changed;
+} hook_player;
+
+struct hooks {
+    // the shell command and the FIFO, when none is given the rendered format is printed
+    const char *exec;
+    const char *fifo;
+    unsigned fields;
+    // the minimum time between the start of two hooks, in µs
+    int64_t interval;
+    // the process of the hook which is running, 0 if none is
+    pid_t pid;
+    int64_t last_run;
+    hook_player *players;
+    int player_count;
+    int player_cap;
+};
+
+/**
+ * Parses a list of field names separated by commas into a mask of hook_field.
+ * Returns false if any of the names is unknown.
+ */
+bool parse_hook_fields(const char *list, unsigned *fields)
+{
+    *fields = hook_field_none;
+    while (true) {
+        const char *end = strchr(list, HOOK_FIELD_SEPARATOR);
+        const size_t len = NULL == end ? strlen(list) : (size_t)(end - list);
+
+        bool found = false;
+        for (int i = 0; i < HOOK_FIELD_NAMES_COUNT; i++) {
+            const char *name = hook_field_names[i].name;
+            if (strlen(name) == len && strncmp(list, name, len) == 0) {
+                *fields |= hook_field_names[i].field;
+                found = true;
+            }
+        }
+        if (!found) { return false; }
+        if (NULL == end) { break; }
+        list = end + 1;
+    }
+    return true;
+}
+
+/**
+ * Returns what identifies the track of the player: its id, or its URL or title when the player doesn't report one.
+ */
+const char *hook_track(mpris_properties *properties)
+{
+    if (NULL == properties) { return ""; }
+
+    mpris_metadata *track = &properties->metadata;
+    mpris_metadata_decode(track, (1u << mpris_meta_track_id) | (1u << mpris_meta_url) | (1u << mpris_meta_title));
+    if (NULL != track->track_id) { return track->track_id; }
+    if (NULL != track->url) { return track->url; }
+    if (NULL != track->title) { return track->title; }
+    return "";
+}
+
+hook_player *hook_find_player(struct hooks *hooks, const char *name)
+{
+    for (int i = 0; i < hooks->player_count; i++) {
+        if (strcmp(hooks->players[i].name, name) == 0) {
+            return &hooks->players[i];
+        }
+    }
+    return NULL;
+}
+
+hook_player *hook_add_player(struct hooks *hooks, const char *name)
+{
+    if (hooks->player_count == hooks->player_cap) {
+        const int cap = MAX(hooks->player_cap * 2, MIN_PLAYERS);
+        hook_player *players = realloc(hooks->players, cap * sizeof(hook_player));
+        if (NULL == players) { return NULL; }
+        hooks->players = players;
+        hooks->player_cap = cap;
+    }
+    hook_player *player = &hooks->players[hooks->player_count];
+    memset(player, 0, sizeof(hook_player));
+    player->name = strdup(name);
+    if (NULL == player->name) { return NULL; }
+    hooks->player_count++;
+    return player;
+}
+
+/**
+ * Compares the watched fields of the player with their previous values, and records them.
+ * The changes are only kept for the hook when the player is selected, or was selected before,
+ * so a player which stops being selected, as when it's paused, still runs it.
+ * When initial is set, the values are only recorded, the players which are found later are new.
+ */
+void hook_update_player(struct hooks *hooks, const mpris_player *player, const bool initial)
+{
+    if (NULL == player->properties) { return; }
+
+    hook_player *last = hook_find_player(hooks, player->name);
+    const bool found = NULL != last;
+    if (!found && NULL == (last = hook_add_player(hooks, player->name))) { return; }
+
+    unsigned changed = hook_field_none;
+    const char *track = hook_track(player->properties);
+    if (!found || NULL == last->track || strcmp(last->track, track) != 0) {
+        char *copy = strdup(track);
+        if (NULL != copy) {
+            free(last->track);
+            last->track = copy;
+            changed |= hook_field_track;
+        }
+    }
+    if (!found || last->status != player->status) {
+        last->status = player->status;
+        changed |= hook_field_status;
+    }
+    if (!found || last->volume != player->properties->volume) {
+        last->volume = player->properties->volume;
+        changed |= hook_field_volume;
+    }
+
+    if (!initial && (last->selected || !player->skip)) {
+        last->changed |= changed & hooks->fields;
+    }
+    last->selected = !player->skip;
+}
+
+void hook_free_player(hook_player *player)
+{
+    free(player->name);
+    free(player->track);
+}
+
+/**
+ * Forgets the players which left the bus.
+ */
+void hook_forget_players(struct hooks *hooks, const mpris_player *players, const int player_count)
+{
+    for (int i = hooks->player_count - 1; i >= 0; i--) {
+        if (find_player_by_name(players, player_count, hooks->players[i].name) >= 0) { continue; }
+
+        hook_free_player(&hooks->players[i]);
+        hooks->players[i] = hooks->players[--hooks->player_count];
+    }
+}
+
+void hooks_free(struct hooks *hooks)
+{
+    for (int i = 0; i < hooks->player_count; i++) {
+        hook_free_player(&hooks->players[i]);
+    }
+    free(hooks->players);
+    hooks->players = NULL;
+    hooks->player_count = 0;
+    hooks->player_cap = 0;
+}
+
+/**
+ * Collects the hook which ended, if any.
+ * Returns true if no hook is running.
+ */
+bool hook_reap(struct hooks *hooks)
+{
+    if (hooks->pid <= 0) { return true; }
+
+    int status = 0;
+    const pid_t pid = waitpid(hooks->pid, &status, WNOHANG);
+    if (pid == 0) { return false; }
+    if (pid < 0 && errno == EINTR) { return false; }
+
+    hooks->pid = 0;
+    return true;
+}
+
+/**
+ * Returns the player whose hook has to run now, or NULL when none has changed, or while the previous
+ * hook is running, or when it started less than the interval ago.
+ */
+hook_player *hook_next_player(struct hooks *hooks, const int64_t now)
+{
+    if (!hook_reap(hooks)) { return NULL; }
+    if (hooks->last_run > 0 && now - hooks->last_run < hooks->interval) { return NULL; }
+
+    for (int i = 0; i < hooks->player_count; i++) {
+        if (hooks->players[i].changed != hook_field_none) {
+            return &hooks->players[i];
+        }
+    }
+    return NULL;
+}
+
+/**
+ * Returns the time in ms until the next hook can run, or until the running one has to be checked,
+ * or -1 when there is nothing waiting.
+ */
+int hook_next_wait(const struct hooks *hooks, const int64_t now)
+{
+    if (hooks->pid > 0) { return HOOK_REAP_INTERVAL; }
+
+    for (int i = 0; i < hooks->player_count; i++) {
+        if (hooks->players[i].changed == hook_field_none) { continue; }
+
+        const int64_t wait = hooks->last_run + hooks->interval - now;
+        // rounded up, so we don't wake up just before the interval passed
+        return wait <= 0 ? 0 : (int)(wait / 1000) + 1;
+    }
+    return -1;
+}
+
+/**
+ * Appends the names of the changed fields, separated by commas.
+ */
+void hook_append_fields(sbuf *output, const unsigned fields)
+{
+    bool first = true;
+    for (int i = 0; i < HOOK_FIELD_NAMES_COUNT; i++) {
+        if (!(fields & hook_field_names[i].field)) { continue; }
+        if (!first) { sbuf_append_char(output, HOOK_FIELD_SEPARATOR); }
+        sbuf_append_str(output, hook_field_names[i].name);
+        first = false;
+    }
+}
+
+/**
+ * Creates the FIFO of the hooks if it doesn't exist, so the readers can open it before the first change.
+ * Returns false if it can't be created.
+ */
+bool hook_make_fifo(const struct hooks *hooks)
+{
+    if (NULL == hooks->fifo) { return true; }
+    return mkfifo(hooks->fifo, 0600) == 0 || errno == EEXIST;
+}
+
+/**
+ * Writes the output as a line to the FIFO.
+ * The line is dropped when no one is reading the FIFO, or when it's full.
+ */
+bool hook_write_fifo(const char *path, const char *output, const size_t len)
+{
+    // opening it without blocking fails when there is no reader
+    const int fd = open(path, O_WRONLY | O_NONBLOCK);
+    if (fd < 0) { return false; }
+
+    struct stat st;
+    if (fstat(fd, &st) < 0 || !S_ISFIFO(st.st_mode)) {
+        close(fd);
+        return false;
+    }
+
+    bool written = write_full(fd, output, len) && write_full(fd, "\n", 1);
+    close(fd);
+    return written;
+}
+
+/**
+ * Starts the shell command of the hook, with the values of the player in its environment,
+ * and the output on its standard input. The hook isn't waited for, it's collected by hook_reap().
+ */
+bool hook_exec(struct hooks *hooks, const hook_player *player, const char *changed, const char *output, const size_t len)
+{
+    int input[2];
+    if (pipe(input) < 0) { return false; }
+
+    const pid_t pid = fork();
+    if (pid < 0) {
+        close(input[0]);
+        close(input[1]);
+        return false;
+    }
+    if (pid == 0) {
+        dup2(input[0], STDIN_FILENO);
+        close(input[0]);
+        close(input[1]);
+
+        char volume[32];
+        snprintf(volume, sizeof(volume), "%.2lf", player->volume * MAX_VOLUME);
+        const char *status = player->status == mpris_playback_playing ? MPRIS_METADATA_VALUE_PLAYING :
+            player->status == mpris_playback_paused ? MPRIS_METADATA_VALUE_PAUSED :
+            player->status == mpris_playback_stopped ? MPRIS_METADATA_VALUE_STOPPED : "";
+        setenv(HOOK_ENV_PLAYER, get_player_name(player->name), 1);
+        setenv(HOOK_ENV_CHANGED, changed, 1);
+        setenv(HOOK_ENV_TRACK, NULL == player->track ? "" : player->track, 1);
+        setenv(HOOK_ENV_STATUS, status, 1);
+        setenv(HOOK_ENV_VOLUME, volume, 1);
+        setenv(HOOK_ENV_OUTPUT, output, 1);
+
+        execl(HOOK_SHELL, HOOK_SHELL, "-c", hooks->exec, (char*)NULL);
+        _exit(127);
+    }
+    close(input[0]);
+    // the hook doesn't have to read its input, nor to read all of it before we move on
+    fcntl(input[1], F_SETFL, O_NONBLOCK);
+    write_full(input[1], output, len);
+    write_full(input[1], "\n", 1);
+    close(input[1]);
+
+    hooks->pid = pid;
+    return true;
+}
+
+/**
+ * Runs the hook for the player, with the output rendered for it.
+ */
+void hook_run(struct hooks *hooks, hook_player *player, const char *output, const size_t len, const int64_t now)
+{
+    sbuf changed = {0};
+    hook_append_fields(&changed, player->changed);
+    player->changed = hook_field_none;
+    hooks->last_run = now;
+
+    if (NULL != hooks->fifo) {
+        hook_write_fifo(hooks->fifo, output, len);
+    }
+    if (NULL != hooks->exec) {
+        hook_exec(hooks, player, NULL == changed.data ? "" : changed.data, output, len);
+    }
+    if (NULL == hooks->fifo && NULL == hooks->exec) {
+        fwrite(output, 1, len, stdout);
+        fputc('\n', stdout);
+        fflush(stdout);
+    }
+    sbuf_free(&changed);
+}
@@ -0,0 +1,308 @@
+/**
+ * @author Marius Orcsik <marius@habarnam.ro>
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+// The size after which the names of the players are copied to a new arena
+#define ARENA_COMPACT_SIZE       64*1024
+// The initial capacity of the table of the properties waiting for a reply
+#define PLAYER_MIN_LOADS         16
+// The time the players get to answer a request for their properties
+#define PLAYER_LOAD_TIMEOUT      (DBUS_CONNECTION_TIMEOUT * 1000L) //µs
+
+/**
+ * A request for the properties of a player, matched with its reply by the serial of the message.
+ */
+typedef struct player_load {
+    dbus_uint32_t serial;
+    // the slot of the request, as built by mpris_player_requests()
+    int slot;
+    int64_t deadline;
+} player_load;
+
+/**
+ * The players on the bus, kept up to date from their signals. It's shared by the long running
+ * modes of the command line and by the library.
+ *
+ * When the loads don't block, the requests for the properties are only sent, and their replies are
+ * loaded by table_handle_message() like the signals, so the caller never waits for a player.
+ */
+typedef struct player_table {
+    mpris_player *players;
+    int player_count;
+    int player_cap;
+    // the mask of MPRIS properties loaded for the players
+    unsigned properties;
+    // how long the positions are extrapolated before being loaded again, in µs
+    int64_t resync;
+    // when the positions were last loaded again, so a player which doesn't answer isn't called in a loop
+    int64_t resynced;
+    // the bus names and the identities of the players
+    arena names;
+
+    bool nonblocking;
+    player_load *loads;
+    int load_count;
+    int load_cap;
+} player_table;
+
+void table_remove_player(player_table *table, const int index)
+{
+    if (index < 0 || index >= table->player_count) { return; }
+
+    mpris_player_free(&table->players[index]);
+    table->player_count--;
+    if (index < table->player_count) {
+        memmove(&table->players[index], &table->players[index+1], (table->player_count - index) * sizeof(mpris_player));
+    }
+    memset(&table->players[table->player_count], 0, sizeof(mpris_player));
+}
+
+/**
+ * The names of the players that left the bus are kept in the arena, so when it grew too much
+ * the names of the remaining players are copied to a new one.
+ */
+void table_compact_names(player_table *table)
+{
+    size_t live = 0;
+    for (int i = 0; i < table->player_count; i++) {
+        const mpris_player *player = &table->players[i];
+        live += strlen(player->name) + (NULL == player->unique_name ? 0 : strlen(player->unique_name)) + 2;
+        live += NULL == player->identity ? 0 : strlen(player->identity) + 1;
+    }
+    if (table->names.size <= ARENA_COMPACT_SIZE + 2 * live) { return; }
+
+    arena names = {0};
+    for (int i = 0; i < table->player_count; i++) {
+        mpris_player *player = &table->players[i];
+        const char *identity = player->identity;
+        player->name = arena_strdup(&names, player->name);
+        player->unique_name = arena_strdup(&names, player->unique_name);
+        player->identity = arena_strdup(&names, identity);
+        if (NULL == player->properties) { continue; }
+
+        load_player_name(player->properties, player->name);
+        if (NULL != identity && player->properties->player_identity == identity) {
+            player->properties->player_identity = player->identity;
+        }
+    }
+    arena_free(&table->names);
+    table->names = names;
+}
+
+/**
+ * Sends the requests for the properties of a player, and records them to be matched with their replies.
+ */
+void table_send_loads(player_table *table, DBusConnection *conn, mpris_player *player, const unsigned properties)
+{
+    load_player_name(player->properties, player->name);
+
+    DBusMessage *requests[MPRIS_REQUEST_SLOTS] = {0};
+    mpris_player_requests(player, properties, requests);
+    const int64_t deadline = mpris_now() + PLAYER_LOAD_TIMEOUT;
+    for (int i = 0; i < MPRIS_REQUEST_SLOTS; i++) {
+        if (NULL == requests[i]) { continue; }
+
+        if (table->load_count == table->load_cap) {
+            const int cap = MAX(table->load_cap * 2, PLAYER_MIN_LOADS);
+            player_load *loads = realloc(table->loads, cap * sizeof(player_load));
+            if (NULL == loads) { goto _unref_request; }
+            table->loads = loads;
+            table->load_cap = cap;
+        }
+        player_load *load = &table->loads[table->load_count];
+        *load = (player_load){ .slot = i, .deadline = deadline };
+        if (dbus_connection_send(conn, requests[i], &load->serial)) {
+            table->load_count++;
+        }
+_unref_request:
+        dbus_message_unref(requests[i]);
+    }
+}
+
+/**
+ * Loads the properties flagged in the mask for the players, or only requests them when the loads don't block.
+ */
+void table_load_properties(player_table *table, DBusConnection *conn, mpris_player *players, const int player_count, const unsigned properties)
+{
+    if (!table->nonblocking) {
+        load_mpris_players_properties(conn, players, player_count, properties);
+        return;
+    }
+    for (int i = 0; i < player_count; i++) {
+        if (NULL == players[i].properties) { continue; }
+        table_send_loads(table, conn, &players[i], properties);
+    }
+}
+
+/**
+ * Adds a player which appeared on the bus, and loads all its properties.
+ */
+void table_add_player(player_table *table, DBusConnection *conn, const char *name, const char *owner)
+{
+    if (!reserve_players(&table->players, &table->player_cap, table->player_count + 1)) { return; }
+
+    mpris_player *player = &table->players[table->player_count];
+    memset(player, 0, sizeof(mpris_player));
+    player->name = arena_strdup(&table->names, name);
+    player->unique_name = arena_strdup(&table->names, owner);
+    if (NULL == player->name || NULL == player->unique_name) { return; }
+    if (!mpris_player_alloc_properties(player)) { return; }
+
+    table->player_count++;
+    table_load_properties(table, conn, player, 1, table->properties);
+}
+
+/**
+ * Loads the reply to a request for the properties of a player, if the message is one.
+ * Returns false if the message isn't such a reply.
+ */
+bool table_handle_load(player_table *table, DBusMessage *msg)
+{
+    const int type = dbus_message_get_type(msg);
+    if (type != DBUS_MESSAGE_TYPE_METHOD_RETURN && type != DBUS_MESSAGE_TYPE_ERROR) { return false; }
+
+    const dbus_uint32_t serial = dbus_message_get_reply_serial(msg);
+    for (int i = 0; i < table->load_count; i++) {
+        const player_load load = table->loads[i];
+        if (load.serial != serial) { continue; }
+
+        table->loads[i] = table->loads[--table->load_count];
+        // the player may have left the bus, or changed its owner, in the meantime
+        const int index = find_player_by_owner(table->players, table->player_count, dbus_message_get_sender(msg));
+        if (index < 0 || NULL == table->players[index].properties) { return true; }
+
+        load_mpris_player_reply(&table->players[index], load.slot, msg);
+        mpris_player_loaded(&table->players[index]);
+        return true;
+    }
+    return false;
+}
+
+/**
+ * Updates the player table from a signal, or from the reply to a request for properties.
+ * Returns true if any of the players changed.
+ */
+bool table_handle_message(player_table *table, DBusConnection *conn, DBusMessage *msg)
+{
+    if (table_handle_load(table, msg)) { return true; }
+
+    const char *name = NULL;
+    const char *old_owner = NULL;
+    const char *new_owner = NULL;
+    if (is_name_owner_changed(msg, &name, &old_owner, &new_owner)) {
+        if (strncmp(name, MPRIS_PLAYER_NAMESPACE, strlen(MPRIS_PLAYER_NAMESPACE)) != 0) { return false; }
+
+        // a player that changed owner is treated as a new one
+        table_remove_player(table, find_player_by_name(table->players, table->player_count, name));
+        if (strlen(new_owner) > 0) {
+            table_add_player(table, conn, name, new_owner);
+        }
+        table_compact_names(table);
+        return true;
+    }
+
+    const int index = find_player_by_owner(table->players, table->player_count, dbus_message_get_sender(msg));
+    if (index < 0) { return false; }
+
+    mpris_player *player = &table->players[index];
+    if (NULL == player->properties) { return false; }
+
+    if (load_seeked(player->properties, msg)) { return true; }
+
+    const unsigned invalidated = load_properties_changed(player->properties, msg) & table->properties;
+    if (invalidated != mpris_prop_none) {
+        table_load_properties(table, conn, player, 1, invalidated);
+    }
+    update_player_status(player);
+    return true;
+}
+
+/**
+ * Forgets the requests for properties which weren't answered in time.
+ */
+void table_expire_loads(player_table *table, const int64_t now)
+{
+    for (int i = table->load_count - 1; i >= 0; i--) {
+        if (table->loads[i].deadline > now) { continue; }
+        table->loads[i] = table->loads[--table->load_count];
+    }
+}
+
+/**
+ * Returns the time when the position of a player will have been extrapolated for longer than the
+ * resync interval, or 0 if it doesn't have to be loaded again, as the player isn't playing.
+ * A position which was never loaded is stale, until an attempt to load it.
+ */
+int64_t table_position_deadline(const player_table *table, const mpris_player *player)
+{
+    if (!(table->properties & mpris_prop_position)) { return 0; }
+    if (NULL == player->properties) { return 0; }
+
+    const int64_t position_time = player->properties->position_time;
+    if (position_time != 0 && player->status != mpris_playback_playing) { return 0; }
+    return MAX(position_time, table->resynced) + table->resync;
+}
+
+/**
+ * Returns true if the position of any of the players is stale.
+ */
+bool table_has_stale_position(const player_table *table, const int64_t now)
+{
+    for (int i = 0; i < table->player_count; i++) {
+        const int64_t deadline = table_position_deadline(table, &table->players[i]);
+        if (deadline > 0 && deadline <= now) { return true; }
+    }
+    return false;
+}
+
+/**
+ * Loads again the positions of the players when any of them is stale, they are loaded all at once
+ * as a single pipelined round trip costs about the same as loading one.
+ * Returns true if they were loaded.
+ */
+bool table_resync_positions(player_table *table, DBusConnection *conn)
+{
+    const int64_t now = mpris_now();
+    if (!table_has_stale_position(table, now)) { return false; }
+
+    table_load_properties(table, conn, table->players, table->player_count, mpris_prop_position);
+    table->resynced = now;
+    return true;
+}
+
+/**
+ * Returns the earliest deadline of the requests for properties, or 0 when none is waiting for a reply.
+ */
+int64_t table_next_load_deadline(const player_table *table)
+{
+    int64_t next = 0;
+    for (int i = 0; i < table->load_count; i++) {
+        next = next == 0 ? table->loads[i].deadline : MIN(next, table->loads[i].deadline);
+    }
+    return next;
+}
+
+void table_free_players(player_table *table)
+{
+    // the properties may have been allocated past the players which were loaded successfully
+    for (int i = 0; i < table->player_cap; i++) {
+        mpris_player_free(&table->players[i]);
+    }
+    table->player_count = 0;
+    table->load_count = 0;
+    arena_reset(&table->names);
+}
+
+void table_free(player_table *table)
+{
+    table_free_players(table);
+    free(table->players);
+    free(table->loads);
+    arena_free(&table->names);
+    *table = (player_table){0};
+}
@@ -0,0 +1,418 @@
+/**
+ * @author Marius Orcsik <marius@habarnam.ro>
+ */
+
+#include <errno.h>
+#include <stdio.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#define SNAPSHOT_FILE_NAME  "mpris-ctl.state"
+#define SNAPSHOT_MAGIC      0x5349524dU // "MRIS"
+#define SNAPSHOT_VERSION    3
+// The file is sparse, only the pages actually used by the players take memory
+#define SNAPSHOT_SIZE       (1 << 20)
+#define SNAPSHOT_MAX_RETRIES 64
+
+/**
+ * Layout of the snapshot file, all the values are in host byte order:
+ *
+ *   snapshot_header
+ *   snapshot_player[player_count]
+ *   string pool: NUL terminated strings, referenced by their offset from the start of the pool.
+ *                The pool starts with an empty string, so offset 0 is always "".
+ *
+ * The publisher is identified by its pid and its start time, as found in /proc/<pid>/stat.
+ * The publisher increments the sequence before and after each update, so it is odd while the
+ * content is being changed. Readers copy what they need, and retry if the sequence was odd or
+ * has changed while they were reading.
+ */
+typedef struct snapshot_header {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t sequence;
+    uint32_t pid;
+    uint32_t size;
+    uint32_t player_count;
+    uint32_t strings_offset;
+    uint32_t strings_len;
+    // the start time of the publisher, so a process which reused its pid isn't taken for it
+    uint64_t start_time;
+} snapshot_header;
+
+enum snapshot_string {
+    ss_name,
+    ss_unique_name,
+    ss_player_name,
+    ss_player_identity,
+    ss_loop_status,
+    ss_playback_status,
+    ss_album_artist,
+    ss_composer,
+    ss_genre,
+    ss_artist,
+    ss_comment,
+    ss_track_id,
+    ss_album,
+    ss_content_created,
+    ss_title,
+    ss_url,
+    ss_art_url,
+
+    ss_count
+};
+
+enum snapshot_flag {
+    sf_can_control     = 1 << 0,
+    sf_can_go_next     = 1 << 1,
+    sf_can_go_previous = 1 << 2,
+    sf_can_play        = 1 << 3,
+    sf_can_pause       = 1 << 4,
+    sf_can_seek        = 1 << 5,
+    sf_shuffle         = 1 << 6,
+};
+
+typedef struct snapshot_player {
+    double volume;
+    double rate;
+    uint64_t position;
+    // the monotonic time the position was loaded at, it's the same clock in every process
+    int64_t position_time;
+    uint64_t length;
+    uint32_t flags;
+    uint16_t track_number;
+    uint16_t bitrate;
+    uint16_t disc_number;
+    uint16_t reserved;
+    uint32_t strings[ss_count];
+} snapshot_player;
+
+typedef struct snapshot {
+    int fd;
+    char *data;
+    sbuf staging;
+} snapshot;
+
+bool get_snapshot_path(char *path, const size_t max_len)
+{
+    const char *runtime_dir = getenv("XDG_RUNTIME_DIR");
+    if (NULL == runtime_dir || strlen(runtime_dir) == 0) { return false; }
+
+    const int len = snprintf(path, max_len, "%s/%s", runtime_dir, SNAPSHOT_FILE_NAME);
+    return len > 0 && (size_t)len < max_len;
+}
+
+/**
+ * Returns the start time of a process, in clock ticks since the boot, or 0 if it can't be read.
+ */
+uint64_t snapshot_process_start(const pid_t pid)
+{
+    char path[64];
+    snprintf(path, sizeof(path), "/proc/%d/stat", (int)pid);
+    FILE *file = fopen(path, "re");
+    if (NULL == file) { return 0; }
+
+    char stat[1024];
+    const size_t len = fread(stat, 1, sizeof(stat) - 1, file);
+    fclose(file);
+    stat[len] = 0;
+
+    // the name of the command can contain spaces, the fields are counted from its end: the state is the 3rd one
+    const char *field = strrchr(stat, ')');
+    if (NULL == field) { return 0; }
+    for (int i = 2; i < 22; i++) {
+        field = strchr(field + 1, ' ');
+        if (NULL == field) { return 0; }
+    }
+    return strtoull(field + 1, NULL, 10);
+}
+
+/**
+ * Returns true if the publisher of the snapshot is still running: a process of another user,
+ * or one which started after the publisher, only reused its pid.
+ */
+bool snapshot_publisher_alive(const snapshot_header *hdr)
+{
+    if (kill(hdr->pid, 0) < 0) { return false; }
+    return hdr->start_time == snapshot_process_start(hdr->pid);
+}
+
+bool snapshot_open_writer(snapshot *snap, const char *path)
+{
+    snap->staging = (sbuf){0};
+    snap->fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+    if (snap->fd < 0) { return false; }
+    if (ftruncate(snap->fd, SNAPSHOT_SIZE) < 0) {
+        goto _close;
+    }
+    snap->data = mmap(NULL, SNAPSHOT_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, snap->fd, 0);
+    if (MAP_FAILED == snap->data) {
+        goto _close;
+    }
+    snapshot_header *hdr = (snapshot_header*)snap->data;
+    hdr->magic = SNAPSHOT_MAGIC;
+    hdr->version = SNAPSHOT_VERSION;
+    hdr->size = SNAPSHOT_SIZE;
+    hdr->pid = getpid();
+    hdr->start_time = snapshot_process_start(hdr->pid);
+    __atomic_store_n(&hdr->sequence, 0, __ATOMIC_RELEASE);
+    return true;
+
+_close:
+    // a file shorter than the mapping would crash the readers
+    close(snap->fd);
+    unlink(path);
+    snap->fd = -1;
+    snap->data = NULL;
+    return false;
+}
+
+void snapshot_close_writer(snapshot *snap, const char *path)
+{
+    if (NULL != snap->data) {
+        munmap(snap->data, SNAPSHOT_SIZE);
+        snap->data = NULL;
+    }
+    if (snap->fd >= 0) {
+        close(snap->fd);
+        snap->fd = -1;
+        unlink(path);
+    }
+    sbuf_free(&snap->staging);
+}
+
+uint32_t snapshot_push_string(sbuf *pool, const char *str, const size_t max_len)
+{
+    if (NULL == str) { return 0; }
+
+    const size_t len = strlen(str);
+    if (len == 0) { return 0; }
+    // strings that don't fit in the file anymore are published as empty
+    if (pool->len + len + 1 > max_len) { return 0; }
+
+    const uint32_t offset = pool->len;
+    sbuf_append(pool, str, len + 1);
+    return offset;
+}
+
+/**
+ * Publishes the players to the snapshot.
+ * The new content is prepared beforehand so the window in which readers have to retry is only
+ * as long as a memcpy of the used part of the file.
+ */
+void snapshot_publish(snapshot *snap, const mpris_player *players, const int player_count)
+{
+    if (NULL == snap->data) { return; }
+
+    const size_t players_offset = sizeof(snapshot_header);
+    const size_t max_players = (SNAPSHOT_SIZE - players_offset) / sizeof(snapshot_player);
+    const int count = MIN((size_t)player_count, max_players);
+    const size_t strings_offset = players_offset + count * sizeof(snapshot_player);
+    const size_t strings_max = SNAPSHOT_SIZE - strings_offset;
+
+    sbuf *staging = &snap->staging;
+    sbuf_reset(staging);
+    sbuf_grow(staging, strings_offset);
+    staging->len = strings_offset;
+    memset(staging->data, 0, strings_offset);
+
+    static const mpris_properties no_properties = {0};
+    sbuf pool = {0};
+    sbuf_append(&pool, "", 1);
+    for (int i = 0; i < count; i++) {
+        const mpris_player *player = &players[i];
+        if (NULL != player->properties) {
+            mpris_metadata_decode(&player->properties->metadata, MPRIS_METADATA_ALL);
+        }
+        const mpris_properties *props = NULL == player->properties ? &no_properties : player->properties;
+        const mpris_metadata *meta = &props->metadata;
+
+        snapshot_player *sp = (snapshot_player*)(staging->data + players_offset) + i;
+        sp->volume = props->volume;
+        sp->position = props->position;
+        sp->position_time = props->position_time;
+        sp->rate = props->rate;
+        sp->length = meta->length;
+        sp->track_number = meta->track_number;
+        sp->bitrate = meta->bitrate;
+        sp->disc_number = meta->disc_number;
+        sp->flags = (props->can_control ? sf_can_control : 0) |
+            (props->can_go_next ? sf_can_go_next : 0) |
+            (props->can_go_previous ? sf_can_go_previous : 0) |
+            (props->can_play ? sf_can_play : 0) |
+            (props->can_pause ? sf_can_pause : 0) |
+            (props->can_seek ? sf_can_seek : 0) |
+            (props->shuffle ? sf_shuffle : 0);
+
+        const char *strings[ss_count] = {
+            [ss_name] = player->name,
+            [ss_unique_name] = player->unique_name,
+            [ss_player_name] = get_player_name(player->name),
+            [ss_player_identity] = props->player_identity,
+            [ss_loop_status] = props->loop_status,
+            [ss_playback_status] = props->playback_status,
+            [ss_album_artist] = meta->album_artist,
+            [ss_composer] = meta->composer,
+            [ss_genre] = meta->genre,
+            [ss_artist] = meta->artist,
+            [ss_comment] = meta->comment,
+            [ss_track_id] = meta->track_id,
+            [ss_album] = meta->album,
+            [ss_content_created] = meta->content_created,
+            [ss_title] = meta->title,
+            [ss_url] = meta->url,
+            [ss_art_url] = meta->art_url,
+        };
+        for (int j = 0; j < ss_count; j++) {
+            sp->strings[j] = snapshot_push_string(&pool, strings[j], strings_max);
+        }
+    }
+
+    snapshot_header *hdr = (snapshot_header*)snap->data;
+    const uint32_t sequence = __atomic_load_n(&hdr->sequence, __ATOMIC_RELAXED);
+    __atomic_store_n(&hdr->sequence, sequence + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+
+    memcpy(snap->data + players_offset, staging->data + players_offset, strings_offset - players_offset);
+    memcpy(snap->data + strings_offset, pool.data, pool.len);
+    hdr->player_count = count;
+    hdr->strings_offset = strings_offset;
+    hdr->strings_len = pool.len;
+
+    __atomic_store_n(&hdr->sequence, sequence + 2, __ATOMIC_RELEASE);
+    sbuf_free(&pool);
+}
+
+/**
+ * Copies a string from the pool to the arena.
+ * The content can be torn while we read it, so it's never trusted to be NUL terminated.
+ */
+const char* snapshot_copy_string(arena *strings, const char *pool, const uint32_t pool_len, const uint32_t offset)
+{
+    if (offset >= pool_len) { return ""; }
+    return arena_strndup(strings, pool + offset, strnlen(pool + offset, pool_len - offset));
+}
+
+void snapshot_load_player(mpris_player *player, const snapshot_player *sp, const char *pool, const uint32_t pool_len, arena *strings)
+{
+    mpris_properties *props = player->properties;
+    mpris_metadata *meta = &props->metadata;
+
+    props->volume = sp->volume;
+    props->position = sp->position;
+    props->position_time = sp->position_time;
+    props->rate = sp->rate;
+    props->can_control = sp->flags & sf_can_control;
+    props->can_go_next = sp->flags & sf_can_go_next;
+    props->can_go_previous = sp->flags & sf_can_go_previous;
+    props->can_play = sp->flags & sf_can_play;
+    props->can_pause = sp->flags & sf_can_pause;
+    props->can_seek = sp->flags & sf_can_seek;
+    props->shuffle = sp->flags & sf_shuffle;
+    meta->length = sp->length;
+    meta->track_number = sp->track_number;
+    meta->bitrate = sp->bitrate;
+    meta->disc_number = sp->disc_number;
+
+    const char **fields[ss_count] = {
+        [ss_name] = &player->name,
+        [ss_unique_name] = &player->unique_name,
+        [ss_player_name] = &props->player_name,
+        [ss_player_identity] = &props->player_identity,
+        [ss_loop_status] = &props->loop_status,
+        [ss_playback_status] = &props->playback_status,
+        [ss_album_artist] = &meta->album_artist,
+        [ss_composer] = &meta->composer,
+        [ss_genre] = &meta->genre,
+        [ss_artist] = &meta->artist,
+        [ss_comment] = &meta->comment,
+        [ss_track_id] = &meta->track_id,
+        [ss_album] = &meta->album,
+        [ss_content_created] = &meta->content_created,
+        [ss_title] = &meta->title,
+        [ss_url] = &meta->url,
+        [ss_art_url] = &meta->art_url,
+    };
+    for (int j = 0; j < ss_count; j++) {
+        *fields[j] = snapshot_copy_string(strings, pool, pool_len, sp->strings[j]);
+    }
+    update_player_status(player);
+}
+
+/**
+ * Loads the players from the snapshot published by a running daemon, growing the player table
+ * as needed. The strings of the players are allocated in the arena.
+ * Returns the number of players loaded, or -1 if there is no valid snapshot.
+ */
+int snapshot_load(const char *path, mpris_player **players, int *cap, arena *strings)
+{
+    const int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) { return -1; }
+
+    // the pages past the end of the file can't be read, even though they are mapped
+    struct stat st;
+    if (fstat(fd, &st) < 0 || st.st_size < SNAPSHOT_SIZE) {
+        close(fd);
+        return -1;
+    }
+    const char *data = mmap(NULL, SNAPSHOT_SIZE, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (MAP_FAILED == data) { return -1; }
+
+    int count = -1;
+    const snapshot_header *hdr = (const snapshot_header*)data;
+    if (hdr->magic != SNAPSHOT_MAGIC || hdr->version != SNAPSHOT_VERSION || hdr->size != SNAPSHOT_SIZE) {
+        goto _unmap;
+    }
+    // a snapshot left behind by a daemon that didn't exit cleanly is not valid anymore
+    if (!snapshot_publisher_alive(hdr)) {
+        goto _unmap;
+    }
+
+    const arena_mark mark = arena_get_mark(strings);
+    for (int retry = 0; retry < SNAPSHOT_MAX_RETRIES; retry++) {
+        const uint32_t sequence = __atomic_load_n(&hdr->sequence, __ATOMIC_ACQUIRE);
+        if (sequence == 0) { break; } // nothing was published yet
+        if (sequence & 1) { continue; }
+
+        const uint32_t player_count = hdr->player_count;
+        const uint32_t strings_offset = hdr->strings_offset;
+        const uint32_t strings_len = hdr->strings_len;
+        const size_t players_end = sizeof(snapshot_header) + (size_t)player_count * sizeof(snapshot_player);
+        if (players_end > SNAPSHOT_SIZE || strings_offset > SNAPSHOT_SIZE || strings_len > SNAPSHOT_SIZE - strings_offset) {
+            continue;
+        }
+
+        if (!reserve_players(players, cap, player_count)) { break; }
+
+        count = 0;
+        const snapshot_player *sps = (const snapshot_player*)(data + sizeof(snapshot_header));
+        for (uint32_t i = 0; i < player_count; i++) {
+            mpris_player *player = &(*players)[i];
+            if (!mpris_player_alloc_properties(player)) { break; }
+
+            mpris_properties_free(player->properties);
+            snapshot_load_player(player, &sps[i], data + strings_offset, strings_len, strings);
+            count++;
+        }
+
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if (__atomic_load_n(&hdr->sequence, __ATOMIC_RELAXED) == sequence) {
+            goto _unmap;
+        }
+        // the copies of a torn read are discarded
+        arena_rewind(strings, mark);
+        count = -1;
+    }
+
+_unmap:
+    munmap((void*)data, SNAPSHOT_SIZE);
+    return count;
+}
@@ -0,0 +1,267 @@
+/**
+ * @author Marius Orcsik <marius@habarnam.ro>
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <dbus/dbus.h>
+
+#define TRACE_DESTINATION_LENGTH 128
+#define TRACE_METHOD_LENGTH      64
+
+/**
+ * Instrumentation of the calls made on the bus, it records for every call the destination, the method,
+ * when it was sent and when its reply was collected, the size of the reply, how it ended, and the time
+ * spent decoding it.
+ * With --trace every call is printed as a JSON line, with --stats a table summing them up for every
+ * destination and method is printed at exit. When neither is set, recording a call is a single test.
+ */
+enum trace_mode {
+    trace_off,
+    trace_stats,
+    trace_lines,
+};
+
+enum trace_outcome {
+    trace_pending,
+    trace_success,
+    trace_error,
+    trace_timeout,
+};
+
+const char *trace_outcome_names[] = { "pending", "success", "error", "timeout" };
+
+typedef struct trace_call {
+    DBusPendingCall *pending;
+    char destination[TRACE_DESTINATION_LENGTH];
+    char method[TRACE_METHOD_LENGTH];
+    // nanoseconds since the tracing started
+    int64_t start;
+    int64_t end;
+    int64_t decode;
+    size_t reply_size;
+    enum trace_outcome outcome;
+} trace_call;
+
+typedef struct trace_summary {
+    char destination[TRACE_DESTINATION_LENGTH];
+    char method[TRACE_METHOD_LENGTH];
+    int calls;
+    int errors;
+    int timeouts;
+    int64_t total;
+    int64_t max;
+    int64_t decode;
+    size_t reply_size;
+} trace_summary;
+
+struct bus_trace {
+    enum trace_mode mode;
+    int64_t origin;
+    trace_call *calls;
+    int call_count;
+    int call_cap;
+    // the call whose reply was collected last, it is being decoded
+    int last;
+    trace_summary *summaries;
+    int summary_count;
+    int summary_cap;
+};
+
+struct bus_trace bus_trace = { .mode = trace_off, .last = -1 };
+
+int64_t trace_now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000000L + ts.tv_nsec - bus_trace.origin;
+}
+
+void trace_start(const enum trace_mode mode)
+{
+    bus_trace.origin = 0;
+    bus_trace.origin = trace_now();
+    bus_trace.mode = mode;
+}
+
+/**
+ * Describes the call by its member, and for the properties interface by the property name too.
+ */
+void trace_describe_method(DBusMessage *msg, char *method, const size_t max_len)
+{
+    const char *member = dbus_message_get_member(msg);
+    const char *interface = dbus_message_get_interface(msg);
+    if (NULL == member) { member = ""; }
+
+    const char *property = NULL;
+    DBusMessageIter args;
+    if (NULL != interface && strcmp(interface, DBUS_INTERFACE_PROPERTIES) == 0 && dbus_message_iter_init(msg, &args)) {
+        // the first argument is the interface, the second one the name of the property
+        if (dbus_message_iter_next(&args) && DBUS_TYPE_STRING == dbus_message_iter_get_arg_type(&args)) {
+            dbus_message_iter_get_basic(&args, &property);
+        }
+    }
+    if (NULL != property) {
+        snprintf(method, max_len, "%s:%s", member, property);
+    } else {
+        snprintf(method, max_len, "%s", member);
+    }
+}
+
+/**
+ * Records a call which was just sent.
+ */
+void trace_sent(DBusMessage *msg, DBusPendingCall *pending)
+{
+    if (bus_trace.mode == trace_off) { return; }
+    if (NULL == pending) { return; }
+
+    if (bus_trace.call_count == bus_trace.call_cap) {
+        const int cap = bus_trace.call_cap > 0 ? bus_trace.call_cap * 2 : 16;
+        trace_call *calls = realloc(bus_trace.calls, cap * sizeof(trace_call));
+        if (NULL == calls) { return; }
+        bus_trace.calls = calls;
+        bus_trace.call_cap = cap;
+    }
+    trace_call *call = &bus_trace.calls[bus_trace.call_count++];
+    memset(call, 0, sizeof(trace_call));
+    call->pending = pending;
+    const char *destination = dbus_message_get_destination(msg);
+    snprintf(call->destination, sizeof(call->destination), "%s", NULL == destination ? "" : destination);
+    trace_describe_method(msg, call->method, sizeof(call->method));
+    call->start = trace_now();
+}
+
+/**
+ * Records the reply of a call, which is about to be decoded.
+ */
+void trace_received(DBusPendingCall *pending, DBusMessage *reply)
+{
+    if (bus_trace.mode == trace_off) { return; }
+
+    bus_trace.last = -1;
+    for (int i = bus_trace.call_count - 1; i >= 0; i--) {
+        trace_call *call = &bus_trace.calls[i];
+        if (call->pending != pending) { continue; }
+
+        call->pending = NULL;
+        call->end = trace_now();
+        call->outcome = trace_timeout;
+        if (NULL != reply) {
+            char *data = NULL;
+            int len = 0;
+            if (dbus_message_marshal(reply, &data, &len)) {
+                call->reply_size = len;
+                dbus_free(data);
+            }
+            call->outcome = trace_success;
+            if (dbus_message_get_type(reply) == DBUS_MESSAGE_TYPE_ERROR) {
+                const char *error = dbus_message_get_error_name(reply);
+                const bool timeout = NULL != error && (strcmp(error, DBUS_ERROR_NO_REPLY) == 0 || strcmp(error, DBUS_ERROR_TIMEOUT) == 0);
+                call->outcome = timeout ? trace_timeout : trace_error;
+            }
+        }
+        bus_trace.last = i;
+        return;
+    }
+}
+
+/**
+ * Marks the end of decoding the reply which was collected last.
+ */
+void trace_reply_decoded(void)
+{
+    if (bus_trace.mode == trace_off) { return; }
+    if (bus_trace.last < 0) { return; }
+
+    trace_call *call = &bus_trace.calls[bus_trace.last];
+    call->decode = trace_now() - call->end;
+    bus_trace.last = -1;
+}
+
+trace_summary *trace_get_summary(const trace_call *call)
+{
+    for (int i = 0; i < bus_trace.summary_count; i++) {
+        trace_summary *summary = &bus_trace.summaries[i];
+        if (strcmp(summary->destination, call->destination) == 0 && strcmp(summary->method, call->method) == 0) {
+            return summary;
+        }
+    }
+    if (bus_trace.summary_count == bus_trace.summary_cap) {
+        const int cap = bus_trace.summary_cap > 0 ? bus_trace.summary_cap * 2 : 16;
+        trace_summary *summaries = realloc(bus_trace.summaries, cap * sizeof(trace_summary));
+        if (NULL == summaries) { return NULL; }
+        bus_trace.summaries = summaries;
+        bus_trace.summary_cap = cap;
+    }
+    trace_summary *summary = &bus_trace.summaries[bus_trace.summary_count++];
+    memset(summary, 0, sizeof(trace_summary));
+    memcpy(summary->destination, call->destination, sizeof(summary->destination));
+    memcpy(summary->method, call->method, sizeof(summary->method));
+    return summary;
+}
+
+/**
+ * Prints the calls whose reply was collected, or adds them to the summary, and forgets them.
+ * The long running modes flush after every command, so the recorded calls don't pile up.
+ */
+void trace_flush(FILE *out)
+{
+    if (bus_trace.mode == trace_off) { return; }
+
+    int kept = 0;
+    for (int i = 0; i < bus_trace.call_count; i++) {
+        const trace_call *call = &bus_trace.calls[i];
+        if (call->outcome == trace_pending) {
+            bus_trace.calls[kept++] = *call;
+            continue;
+        }
+        if (bus_trace.mode == trace_lines) {
+            fprintf(out, "{\"destination\":\"%s\",\"method\":\"%s\",\"start_us\":%.1f,\"end_us\":%.1f,"
+                    "\"duration_us\":%.1f,\"reply_bytes\":%zu,\"outcome\":\"%s\",\"decode_us\":%.1f}\n",
+                    call->destination, call->method, call->start / 1e3, call->end / 1e3,
+                    (call->end - call->start) / 1e3, call->reply_size, trace_outcome_names[call->outcome],
+                    call->decode / 1e3);
+            continue;
+        }
+        trace_summary *summary = trace_get_summary(call);
+        if (NULL == summary) { continue; }
+
+        const int64_t duration = call->end - call->start;
+        summary->calls++;
+        summary->errors += call->outcome == trace_error;
+        summary->timeouts += call->outcome == trace_timeout;
+        summary->total += duration;
+        summary->max = MAX(summary->max, duration);
+        summary->decode += call->decode;
+        summary->reply_size += call->reply_size;
+    }
+    bus_trace.call_count = kept;
+    bus_trace.last = -1;
+    fflush(out);
+}
+
+/**
+ * Flushes the recorded calls, prints the summary table, and releases everything.
+ */
+void trace_report(FILE *out)
+{
+    trace_flush(out);
+    if (bus_trace.mode == trace_stats && bus_trace.summary_count > 0) {
+        fprintf(out, "%-48s %-28s %6s %6s %8s %10s %10s %10s %10s\n", "destination", "method", "calls",
+                "errors", "timeouts", "avg ms", "max ms", "bytes", "decode ms");
+        for (int i = 0; i < bus_trace.summary_count; i++) {
+            const trace_summary *s = &bus_trace.summaries[i];
+            fprintf(out, "%-48s %-28s %6d %6d %8d %10.3f %10.3f %10zu %10.3f\n", s->destination, s->method,
+                    s->calls, s->errors, s->timeouts, s->total / 1e6 / s->calls, s->max / 1e6,
+                    s->reply_size, s->decode / 1e6);
+        }
+    }
+    free(bus_trace.calls);
+    free(bus_trace.summaries);
+    bus_trace = (struct bus_trace){ .mode = trace_off, .last = -1 };
+}
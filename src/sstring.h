@@ -2,6 +2,8 @@
  * @author Marius Orcsik <marius@habarnam.ro>
  */
 
+#include <stdbool.h>
+#include <stdlib.h>
 #include <string.h>
 #include <assert.h>
 
@@ -75,3 +77,64 @@ void str_replace(char* source, const char* search, const char* replace)
         source[i] = 0;
     }
 }
+
+/**
+ * Growable output buffer, the content is always kept NUL terminated.
+ */
+typedef struct sbuf {
+    char *data;
+    size_t len;
+    size_t cap;
+} sbuf;
+
+bool sbuf_grow(sbuf *buf, const size_t len)
+{
+    if (buf->len + len + 1 <= buf->cap) { return true; }
+
+    size_t cap = MAX(buf->cap * 2, 256);
+    while (cap < buf->len + len + 1) {
+        cap *= 2;
+    }
+    char *data = realloc(buf->data, cap);
+    if (NULL == data) { return false; }
+    buf->data = data;
+    buf->cap = cap;
+    return true;
+}
+
+void sbuf_append(sbuf *buf, const char *str, const size_t len)
+{
+    if (NULL == str || len == 0) { return; }
+    if (!sbuf_grow(buf, len)) { return; }
+
+    memcpy(buf->data + buf->len, str, len);
+    buf->len += len;
+    buf->data[buf->len] = 0;
+}
+
+void sbuf_append_str(sbuf *buf, const char *str)
+{
+    if (NULL == str) { return; }
+    sbuf_append(buf, str, strlen(str));
+}
+
+void sbuf_append_char(sbuf *buf, const char c)
+{
+    sbuf_append(buf, &c, 1);
+}
+
+void sbuf_reset(sbuf *buf)
+{
+    buf->len = 0;
+    if (NULL != buf->data) {
+        buf->data[0] = 0;
+    }
+}
+
+void sbuf_free(sbuf *buf)
+{
+    free(buf->data);
+    buf->data = NULL;
+    buf->len = 0;
+    buf->cap = 0;
+}